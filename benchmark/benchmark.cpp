@@ -0,0 +1,281 @@
+// Microbenchmarks of the intersection and traversal kernels. Every kernel is
+// timed single threaded on a fixed set of seeded rays and the results are
+// written as JSON, so runs on different versions can be compared.
+//
+// Usage: benchmark [--output file] [--rays n] [--time seconds] [--meshes directory]
+
+// Defines
+#define _USE_MATH_DEFINES // for C++
+
+// Includes
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdlib>
+
+#include "../include/Scene.h"
+#include "../include/Camera.h"
+#include "../include/SceneObject.h"
+#include "../include/OctreeAABB.h"
+#include "../include/Material.h"
+#include "../include/Sampler.h"
+#include "../include/Utility.h"
+
+namespace {
+	const uint64_t SEED = 1;			// Same rays in every run
+	const int VERSION = 1;				// Of the JSON report
+
+	typedef std::vector<std::shared_ptr<Ray>> RaySet;
+
+	struct Options {
+		int m_nrRays = 1 << 16;
+		double m_minTime = 0.5;			// Seconds per kernel
+		std::string m_outputPath = "data/output/benchmark.json";
+		std::string m_meshDirectory = "data/meshes";
+	};
+
+	struct Result {
+		std::string m_kernel;
+		std::string m_scene;
+		std::string m_rays;				// Name of the ray set
+		size_t m_nrRays;
+		int m_nrPasses;
+		double m_seconds;
+		size_t m_nrHits;				// Per pass, the same for every version of a kernel
+
+		double getRaysPerSecond() const { return m_nrRays * (double)m_nrPasses / m_seconds; }
+	};
+
+	bool fileExists(const std::string& path) {
+		std::ifstream file(path);
+		return (bool)file;
+	}
+
+	// Rays from a sphere around the bounds towards random points inside them
+	RaySet createRays(const glm::vec3 min, const glm::vec3 max, const int nrRays, const uint64_t stream) {
+		glm::vec3 center = 0.5f * (min + max);
+		float radius = glm::max(glm::length(max - min), 0.001f);
+
+		RaySet rays;
+		rays.reserve(nrRays);
+		for (int i = 0; i < nrRays; ++i) {
+			Sampler sampler(SEED, stream, i);
+			float z = 1.0f - 2.0f * sampler.next();
+			float phi = 2.0f * glm::pi<float>() * sampler.next();
+			float r = glm::sqrt(glm::max(0.0f, 1.0f - z * z));
+			glm::vec3 origin = center + radius * glm::vec3(r * glm::cos(phi), r * glm::sin(phi), z);
+			glm::vec3 target = min + (max - min) * glm::vec3(sampler.next(), sampler.next(), sampler.next());
+			rays.emplace_back(std::make_shared<Ray>(origin, target - origin));
+		}
+		return rays;
+	}
+
+	// Jittered camera rays through random pixels
+	RaySet createCameraRays(std::shared_ptr<Camera> camera, const int nrRays, const uint64_t stream) {
+		int width = camera->getPixelWidth();
+		int height = camera->getPixelHeight();
+
+		RaySet rays;
+		rays.reserve(nrRays);
+		for (int i = 0; i < nrRays; ++i) {
+			Sampler sampler(SEED, stream, i);
+			int x = glm::min((int)(sampler.next() * width), width - 1);
+			int y = glm::min((int)(sampler.next() * height), height - 1);
+			float randX = sampler.next() - 0.5f, randY = sampler.next() - 0.5f;
+			rays.emplace_back(camera->castCameraRay(x, y, randX, randY));
+		}
+		return rays;
+	}
+
+	// Diffuse bounces from the hits of the camera rays
+	RaySet createSecondaryRays(std::shared_ptr<Scene> scene, const RaySet& cameraRays, const uint64_t stream) {
+		RaySet rays;
+		rays.reserve(cameraRays.size());
+		for (size_t i = 0; i < cameraRays.size(); ++i) {
+			std::shared_ptr<Ray> cameraRay = std::make_shared<Ray>(cameraRays[i]->getStartPt(), cameraRays[i]->getDirection());
+			if (!scene->findRayIntersection(cameraRay)) continue;
+
+			std::shared_ptr<Intersection> intersection = cameraRay->getIntersection();
+			glm::vec3 normal = glm::normalize(intersection->m_normal);
+			if (glm::dot(normal, cameraRay->getDirection()) > 0.0f) normal = -normal;
+
+			Sampler sampler(SEED, stream, i);
+			float rand1 = sampler.next(), rand2 = sampler.next();
+			glm::vec3 direction = Utility::CosineWeightedHemisphereSampleDirection(normal, rand1, rand2);
+			rays.emplace_back(std::make_shared<Ray>(intersection->m_intersectionPt + normal * 0.0001f, direction));
+		}
+		return rays;
+	}
+
+	// Time passes over all rays until the minimum time has passed, after one untimed pass
+	template <typename Intersect>
+	Result measure(const std::string& kernel, const std::string& scene, const std::string& rayName,
+		const RaySet& rays, const Options& options, Intersect intersect) {
+		typedef std::chrono::steady_clock Clock;
+
+		Result result;
+		result.m_kernel = kernel;
+		result.m_scene = scene;
+		result.m_rays = rayName;
+		result.m_nrRays = rays.size();
+		result.m_nrPasses = 0;
+		result.m_nrHits = 0;
+
+		for (const std::shared_ptr<Ray>& ray : rays) {
+			ray->setRayIntersection(nullptr);
+			if (intersect(ray)) result.m_nrHits++;
+		}
+
+		Clock::time_point start = Clock::now();
+		double seconds = 0.0;
+		do {
+			for (const std::shared_ptr<Ray>& ray : rays) {
+				ray->setRayIntersection(nullptr);
+				intersect(ray);
+			}
+			result.m_nrPasses++;
+			seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		} while (seconds < options.m_minTime);
+		result.m_seconds = seconds;
+
+		std::cout << std::left << std::setw(28) << kernel << std::setw(10) << scene << std::setw(10) << rayName
+			<< std::right << std::setw(12) << std::fixed << std::setprecision(3) << result.getRaysPerSecond() / 1e6 << " Mrays/s"
+			<< std::setw(10) << std::setprecision(1) << 100.0 * result.m_nrHits / glm::max(result.m_nrRays, (size_t)1) << "% hits"
+			<< std::defaultfloat << std::endl;
+		return result;
+	}
+
+	bool writeReport(const std::string& path, const Options& options, const std::vector<Result>& results,
+		const std::vector<std::string>& skipped) {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			std::cout << "Could not write " << path << std::endl;
+			return false;
+		}
+
+		file << std::setprecision(9);
+		file << "{\n";
+		file << "\t\"version\": " << VERSION << ",\n";
+		file << "\t\"seed\": " << SEED << ",\n";
+		file << "\t\"rays\": " << options.m_nrRays << ",\n";
+		file << "\t\"minTime\": " << options.m_minTime << ",\n";
+		file << "\t\"results\": [";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const Result& result = results[i];
+			file << ((i == 0) ? "\n" : ",\n");
+			file << "\t\t{ \"kernel\": \"" << result.m_kernel << "\", \"scene\": \"" << result.m_scene
+				<< "\", \"rays\": \"" << result.m_rays << "\", \"nrRays\": " << result.m_nrRays
+				<< ", \"passes\": " << result.m_nrPasses << ", \"seconds\": " << result.m_seconds
+				<< ", \"raysPerSecond\": " << result.getRaysPerSecond()
+				<< ", \"nsPerRay\": " << 1e9 / result.getRaysPerSecond()
+				<< ", \"hits\": " << result.m_nrHits << " }";
+		}
+		file << "\n\t],\n";
+		file << "\t\"skipped\": [";
+		for (size_t i = 0; i < skipped.size(); ++i) {
+			file << ((i == 0) ? "" : ", ") << "\"" << skipped[i] << "\"";
+		}
+		file << "]\n}\n";
+		return (bool)file;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--output" && i + 1 < argc) options.m_outputPath = argv[++i];
+		else if (arg == "--rays" && i + 1 < argc) options.m_nrRays = glm::max(std::atoi(argv[++i]), 1);
+		else if (arg == "--time" && i + 1 < argc) options.m_minTime = std::atof(argv[++i]);
+		else if (arg == "--meshes" && i + 1 < argc) options.m_meshDirectory = argv[++i];
+		else {
+			std::cout << "Usage: " << argv[0] << " [--output file] [--rays n] [--time seconds] [--meshes directory]" << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<Result> results;
+	std::vector<std::string> skipped;
+	std::shared_ptr<Material> material = std::make_shared<LambertianMaterial>(glm::vec3(1.0f));
+
+	/**************** Primitives ****************/
+	{
+		Surface::Triangle triangle(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), material);
+		RaySet rays = createRays(glm::vec3(0.0f), glm::vec3(1.0f, 1.0f, 0.0f), options.m_nrRays, 0);
+		results.emplace_back(measure("Triangle::intersect", "triangle", "random", rays, options,
+			[&](const std::shared_ptr<Ray>& ray) { return triangle.intersect(ray); }));
+	}
+	{
+		Surface::Sphere sphere(1.0f, glm::vec3(0.0f), material);
+		RaySet rays = createRays(glm::vec3(-1.0f), glm::vec3(1.0f), options.m_nrRays, 1);
+		results.emplace_back(measure("Sphere::intersect", "sphere", "random", rays, options,
+			[&](const std::shared_ptr<Ray>& ray) { return sphere.intersect(ray); }));
+	}
+	{
+		AABB aabb;
+		aabb.m_min = glm::vec3(-0.5f);
+		aabb.m_max = glm::vec3(0.5f);
+		RaySet rays = createRays(glm::vec3(-1.0f), glm::vec3(1.0f), options.m_nrRays, 2);
+		results.emplace_back(measure("AABB::intersect", "box", "random", rays, options,
+			[&](const std::shared_ptr<Ray>& ray) { return aabb.intersect(ray); }));
+	}
+
+	/**************** Mesh octrees ****************/
+	const char* meshNames[] = { "cube", "suzanne", "bunny", "dragon" };
+	for (const char* name : meshNames) {
+		std::string path = options.m_meshDirectory + "/" + name + ".obj";
+		if (!fileExists(path)) {
+			std::cout << "Skipping " << path << ", the file does not exist" << std::endl;
+			skipped.emplace_back(path);
+			continue;
+		}
+
+		Surface::Mesh mesh(glm::mat4(1.0f), path.c_str(), material);
+		std::shared_ptr<OctreeAABB> octree = mesh.getOctree();
+		const OctreeNodeAABB& root = octree->getNodes()[0];
+		RaySet rays = createRays(root.m_aabb.m_min, root.m_aabb.m_max, options.m_nrRays, 3);
+		results.emplace_back(measure("OctreeNodeAABB::intersect", name, "random", rays, options,
+			[&](const std::shared_ptr<Ray>& ray) { return root.intersect(ray, *octree); }));
+	}
+
+	/**************** Scenes ****************/
+	// Scene file and the mesh it needs, the Cornell box has the cube
+	const char* scenes[][3] = {
+		{ "cornell", "data/scenes/cornell.scene", "cube" },
+		{ "suzanne", "data/scenes/suzanne.scene", "suzanne" },
+		{ "bunny", "data/scenes/bunny.scene", "bunny" },
+		{ "dragon", "data/scenes/dragon.scene", "dragon" },
+	};
+	for (const auto& entry : scenes) {
+		std::string meshPath = options.m_meshDirectory + "/" + entry[2] + ".obj";
+		if (!fileExists(entry[1]) || !fileExists(meshPath)) {
+			std::cout << "Skipping " << entry[1] << ", the scene or " << meshPath << " does not exist" << std::endl;
+			skipped.emplace_back(entry[1]);
+			continue;
+		}
+
+		RenderSettings settings;
+		settings.m_meshDirectory = options.m_meshDirectory; // The scene files refer to data/meshes
+		std::shared_ptr<Scene> scene = Scene::loadScene(entry[1], settings);
+		if (!scene) {
+			skipped.emplace_back(entry[1]);
+			continue;
+		}
+		std::shared_ptr<Camera> camera = settings.createCamera();
+		RaySet cameraRays = createCameraRays(camera, options.m_nrRays, 4);
+		RaySet secondaryRays = createSecondaryRays(scene, cameraRays, 5);
+
+		results.emplace_back(measure("Scene::findRayIntersection", entry[0], "camera", cameraRays, options,
+			[&](const std::shared_ptr<Ray>& ray) { return scene->findRayIntersection(ray); }));
+		results.emplace_back(measure("Scene::findRayIntersection", entry[0], "diffuse", secondaryRays, options,
+			[&](const std::shared_ptr<Ray>& ray) { return scene->findRayIntersection(ray); }));
+	}
+
+	if (!writeReport(options.m_outputPath, options, results, skipped)) return 1;
+	std::cout << "Results written to " << options.m_outputPath << std::endl;
+	return 0;
+}
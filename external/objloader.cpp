@@ -4,112 +4,350 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <omp.h>
 
 #include "glm/glm/glm.hpp"
 
-// Very, VERY simple OBJ loader.
+#include "../include/MappedFile.h"
+
+// Simple OBJ loader.
 // Here is a short list of features a real function would provide : 
 // - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
 // - Animations & bones (includes bones weights)
 // - Multiple UVs
-// - All attributes should be optional, not "forced"
-// - More stable. Change a line in the OBJ file and it crashes.
-// - More secure. Change another line and you can inject code.
-// - Loading from memory, stream, etc
+// - Materials and groups
 
-bool loadOBJ(
-	const char* path,
-	std::vector<glm::vec3>& out_vertices,
-	std::vector<glm::vec2>& out_uvs,
-	std::vector<glm::vec3>& out_normals
-) {
-	printf("Loading OBJ file %s...\n", path);
+namespace {
+	// Parsed corner of a face, 0-based indices or -1 if the attribute is missing
+	struct FaceCorner {
+		int vertex, uv, normal;
+	};
 
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<glm::vec3> temp_vertices;
-	std::vector<glm::vec2> temp_uvs;
-	std::vector<glm::vec3> temp_normals;
+	// Number of v, vt, vn lines and triangles in a chunk of the file
+	struct ChunkCount {
+		size_t vertices, uvs, normals, triangles;
+	};
 
+	inline bool isSpace(const char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
 
-	FILE* file = fopen(path, "r");
-	if (file == NULL) {
-		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
-		return false;
+	inline const char* skipSpaces(const char* p, const char* end) {
+		while (p < end && isSpace(*p)) ++p;
+		return p;
+	}
+
+	inline const char* skipLine(const char* p, const char* end) {
+		while (p < end && *p != '\n') ++p;
+		return (p < end) ? p + 1 : end;
+	}
+
+	// Hand written float parser, much faster than sscanf/strtof and locale independent
+	const char* parseFloat(const char* p, const char* end, float& value) {
+		static const double POW10[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+		p = skipSpaces(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+		// Only significant digits count towards the 19 that fit in the mantissa
+		unsigned long long mantissa = 0;
+		int exponent = 0, nrDigits = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+			if (nrDigits == 0 && *p == '0') continue;
+			if (nrDigits < 19) mantissa = mantissa * 10 + (*p - '0');
+			else exponent++;
+			nrDigits++;
+		}
+		if (p < end && *p == '.') {
+			for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+				if (nrDigits == 0 && *p == '0') {
+					exponent--;
+					continue;
+				}
+				if (nrDigits < 19) {
+					mantissa = mantissa * 10 + (*p - '0');
+					exponent--;
+				}
+				nrDigits++;
+			}
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char* q = p + 1;
+			bool negativeExponent = false;
+			if (q < end && (*q == '-' || *q == '+')) negativeExponent = (*q++ == '-');
+			if (q < end && *q >= '0' && *q <= '9') {
+				int e = 0;
+				for (; q < end && *q >= '0' && *q <= '9'; ++q) e = glm::min(e * 10 + (*q - '0'), 1000);
+				exponent += negativeExponent ? -e : e;
+				p = q;
+			}
+		}
+
+		double result = (double)mantissa;
+		if (exponent < 0) result = (exponent >= -22) ? result / POW10[-exponent] : result * std::pow(10.0, exponent);
+		else if (exponent > 0) result = (exponent <= 22) ? result * POW10[exponent] : result * std::pow(10.0, exponent);
+		value = (float)(negative ? -result : result);
+		return p;
 	}
 
-	while (1) {
+	const char* parseInt(const char* p, const char* end, int& value) {
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+		int result = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p) result = result * 10 + (*p - '0');
+		value = negative ? -result : result;
+		return p;
+	}
 
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
+	// Index of a face corner that is given but refers to no element, it fails every
+	// range check. -1 means the corner has no uv or normal.
+	const int INVALID_INDEX = std::numeric_limits<int>::max();
 
-		// else : parse lineHeader
+	// Converts a 1-based (or negative, relative) OBJ index to a 0-based index
+	inline int resolveIndex(const int index, const size_t count) {
+		if (index > 0) return index - 1;
+		if (index < 0 && (int)count + index >= 0) return (int)count + index;
+		return INVALID_INDEX;
+	}
 
-		if (strcmp(lineHeader, "v") == 0) {
-			glm::vec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
-			temp_vertices.push_back(vertex);
-		}
-		else if (strcmp(lineHeader, "vt") == 0) {
-			glm::vec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y);
-			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
+	// Parses one face corner: v, v/vt, v//vn or v/vt/vn
+	const char* parseCorner(const char* p, const char* end, const size_t nrVertices, const size_t nrUvs,
+		const size_t nrNormals, FaceCorner& corner) {
+		int index = 0;
+		p = parseInt(p, end, index);
+		corner.vertex = resolveIndex(index, nrVertices);
+		corner.uv = corner.normal = -1;
+		if (p < end && *p == '/') {
+			++p;
+			if (p < end && *p != '/') {
+				p = parseInt(p, end, index);
+				corner.uv = resolveIndex(index, nrUvs);
+			}
+			if (p < end && *p == '/') {
+				p = parseInt(p + 1, end, index);
+				corner.normal = resolveIndex(index, nrNormals);
+			}
 		}
-		else if (strcmp(lineHeader, "vn") == 0) {
-			glm::vec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
-			temp_normals.push_back(normal);
+		return p;
+	}
+
+	inline size_t countFaceCorners(const char* p, const char* end) {
+		size_t nrCorners = 0;
+		while (true) {
+			p = skipSpaces(p, end);
+			if (p >= end || *p == '\n' || *p == '#') break;
+			nrCorners++;
+			while (p < end && !isSpace(*p) && *p != '\n') ++p;
 		}
-		else if (strcmp(lineHeader, "f") == 0) {
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2]);
-			if (matches != 9) {
-				printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-				return false;
+		return nrCorners;
+	}
+
+	// Line type from its first token
+	enum LineType { LINE_OTHER, LINE_VERTEX, LINE_UV, LINE_NORMAL, LINE_FACE };
+
+	inline LineType getLineType(const char*& p, const char* end) {
+		p = skipSpaces(p, end);
+		if (p + 1 >= end) return LINE_OTHER;
+		if (p[0] == 'v') {
+			if (isSpace(p[1])) { p += 2; return LINE_VERTEX; }
+			if (p + 2 < end && isSpace(p[2])) {
+				if (p[1] == 't') { p += 3; return LINE_UV; }
+				if (p[1] == 'n') { p += 3; return LINE_NORMAL; }
 			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices.push_back(uvIndex[0]);
-			uvIndices.push_back(uvIndex[1]);
-			uvIndices.push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
 		}
-		else {
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
+		else if (p[0] == 'f' && isSpace(p[1])) {
+			p += 2;
+			return LINE_FACE;
 		}
+		return LINE_OTHER;
+	}
+}
 
+// OBJ loader that parses a memory mapped file in parallel chunks.
+// Supports v, v/vt, v//vn and v/vt/vn corners, negative indices and
+// polygon faces (triangulated as fans). Missing uvs are set to zero and
+// missing normals are replaced with the face normal. Faces with indices
+// outside of the file are skipped with a warning.
+bool loadOBJ(
+	const char* path,
+	std::vector<glm::vec3>& out_vertices,
+	std::vector<glm::vec2>& out_uvs,
+	std::vector<glm::vec3>& out_normals
+) {
+	printf("Loading OBJ file %s...\n", path);
+
+	MappedFile file(path);
+	if (!file.isOpen()) {
+		printf("Impossible to open the file ! Are you in the right path ?\n");
+		return false;
+	}
+	const char* data = file.getData();
+	const char* dataEnd = data + file.getSize();
+
+	// Split the file into chunks that start at the beginning of a line
+	int nrChunks = glm::max(1, glm::min(omp_get_max_threads() * 4, (int)(file.getSize() / (64 * 1024)) + 1));
+	std::vector<const char*> chunkBegin(nrChunks + 1);
+	chunkBegin[0] = data;
+	chunkBegin[nrChunks] = dataEnd;
+	for (int c = 1; c < nrChunks; ++c) {
+		const char* p = data + file.getSize() * c / nrChunks;
+		p = std::max(p, chunkBegin[c - 1]);
+		chunkBegin[c] = (p > data && p[-1] == '\n') ? p : skipLine(p, dataEnd);
 	}
 
-	// For each vertex of each triangle
-	for (unsigned int i = 0; i < vertexIndices.size(); i++) {
+	// First pass: count the elements of every chunk
+	std::vector<ChunkCount> counts(nrChunks + 1, ChunkCount{ 0, 0, 0, 0 });
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = 0; c < nrChunks; ++c) {
+		ChunkCount count = { 0, 0, 0, 0 };
+		for (const char* p = chunkBegin[c]; p < chunkBegin[c + 1]; p = skipLine(p, chunkBegin[c + 1])) {
+			switch (getLineType(p, chunkBegin[c + 1])) {
+			case LINE_VERTEX: count.vertices++; break;
+			case LINE_UV: count.uvs++; break;
+			case LINE_NORMAL: count.normals++; break;
+			case LINE_FACE: {
+				size_t nrCorners = countFaceCorners(p, chunkBegin[c + 1]);
+				if (nrCorners >= 3) count.triangles += nrCorners - 2;
+				break;
+			}
+			default: break;
+			}
+		}
+		counts[c + 1] = count;
+	}
 
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
+	// Prefix sums give the offset of every chunk in the shared arrays
+	for (int c = 1; c <= nrChunks; ++c) {
+		counts[c].vertices += counts[c - 1].vertices;
+		counts[c].uvs += counts[c - 1].uvs;
+		counts[c].normals += counts[c - 1].normals;
+		counts[c].triangles += counts[c - 1].triangles;
+	}
+	const ChunkCount total = counts[nrChunks];
+
+	std::vector<glm::vec3> temp_vertices(total.vertices);
+	std::vector<glm::vec2> temp_uvs(total.uvs);
+	std::vector<glm::vec3> temp_normals(total.normals);
+	std::vector<FaceCorner> corners(3 * total.triangles);
+
+	// Second pass: parse every chunk straight into its part of the arrays
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = 0; c < nrChunks; ++c) {
+		ChunkCount offset = counts[c];
+		std::vector<FaceCorner> polygon;
+		for (const char* p = chunkBegin[c]; p < chunkBegin[c + 1]; p = skipLine(p, chunkBegin[c + 1])) {
+			const char* end = chunkBegin[c + 1];
+			switch (getLineType(p, end)) {
+			case LINE_VERTEX: {
+				glm::vec3& vertex = temp_vertices[offset.vertices++];
+				p = parseFloat(p, end, vertex.x);
+				p = parseFloat(p, end, vertex.y);
+				p = parseFloat(p, end, vertex.z);
+				break;
+			}
+			case LINE_UV: {
+				glm::vec2& uv = temp_uvs[offset.uvs++];
+				p = parseFloat(p, end, uv.x);
+				p = parseFloat(p, end, uv.y);
+				uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+				break;
+			}
+			case LINE_NORMAL: {
+				glm::vec3& normal = temp_normals[offset.normals++];
+				p = parseFloat(p, end, normal.x);
+				p = parseFloat(p, end, normal.y);
+				p = parseFloat(p, end, normal.z);
+				break;
+			}
+			case LINE_FACE: {
+				polygon.clear();
+				while (true) {
+					p = skipSpaces(p, end);
+					if (p >= end || *p == '\n' || *p == '#') break;
+					FaceCorner corner;
+					const char* next = parseCorner(p, end, offset.vertices, offset.uvs, offset.normals, corner);
+					polygon.emplace_back(corner);
+					while (next < end && !isSpace(*next) && *next != '\n') ++next; // Skip malformed tokens
+					p = next;
+				}
+				// Triangle fan
+				for (size_t i = 2; i < polygon.size(); ++i) {
+					FaceCorner* triangle = &corners[3 * offset.triangles++];
+					triangle[0] = polygon[0];
+					triangle[1] = polygon[i - 1];
+					triangle[2] = polygon[i];
+				}
+				break;
+			}
+			default: break;
+			}
+		}
+	}
 
-		// Get the attributes thanks to the index
-		glm::vec3 vertex = temp_vertices[vertexIndex - 1];
-		glm::vec2 uv = temp_uvs[uvIndex - 1];
-		glm::vec3 normal = temp_normals[normalIndex - 1];
+	// Expand the indexed data into one vertex per triangle corner
+	out_vertices.resize(corners.size());
+	out_uvs.resize(corners.size());
+	out_normals.resize(corners.size());
+	std::vector<char> isValidTriangle(total.triangles, 1);
+	int nrInvalidCorners = 0;
+
+	#pragma omp parallel for reduction(+:nrInvalidCorners)
+	for (long long t = 0; t < (long long)total.triangles; ++t) {
+		const FaceCorner* triangle = &corners[3 * t];
+		bool isValid = true;
+		for (int k = 0; k < 3; ++k) {
+			// Given uv and normal indices are checked like the vertex index
+			isValid = isValid && triangle[k].vertex >= 0 && triangle[k].vertex < (int)temp_vertices.size() &&
+				triangle[k].uv < (int)temp_uvs.size() && triangle[k].normal < (int)temp_normals.size();
+		}
+		if (!isValid) {
+			isValidTriangle[t] = 0;
+			nrInvalidCorners++;
+			continue;
+		}
 
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_uvs.push_back(uv);
-		out_normals.push_back(normal);
+		glm::vec3 v0 = temp_vertices[triangle[0].vertex];
+		glm::vec3 v1 = temp_vertices[triangle[1].vertex];
+		glm::vec3 v2 = temp_vertices[triangle[2].vertex];
+		glm::vec3 faceNormal = glm::cross(v1 - v0, v2 - v0);
+		float faceNormalLength = glm::length(faceNormal);
+		faceNormal = (faceNormalLength > 0.0f) ? faceNormal / faceNormalLength : glm::vec3(0.0f, 1.0f, 0.0f);
+
+		for (int k = 0; k < 3; ++k) {
+			const FaceCorner& corner = triangle[k];
+			out_vertices[3 * t + k] = temp_vertices[corner.vertex];
+			out_uvs[3 * t + k] = (corner.uv >= 0) ? temp_uvs[corner.uv] : glm::vec2(0.0f);
+			out_normals[3 * t + k] = (corner.normal >= 0) ? temp_normals[corner.normal] : faceNormal;
+		}
+	}
 
+	// Faces with invalid indices are dropped, the rest of the mesh is kept
+	size_t nrTriangles = total.triangles;
+	if (nrInvalidCorners > 0) {
+		printf("File %s has %d faces with invalid indices, they are skipped\n", path, nrInvalidCorners);
+		nrTriangles = 0;
+		for (size_t t = 0; t < total.triangles; ++t) {
+			if (!isValidTriangle[t]) continue;
+			for (int k = 0; k < 3; ++k) {
+				out_vertices[3 * nrTriangles + k] = out_vertices[3 * t + k];
+				out_uvs[3 * nrTriangles + k] = out_uvs[3 * t + k];
+				out_normals[3 * nrTriangles + k] = out_normals[3 * t + k];
+			}
+			nrTriangles++;
+		}
+		out_vertices.resize(3 * nrTriangles);
+		out_uvs.resize(3 * nrTriangles);
+		out_normals.resize(3 * nrTriangles);
+		if (nrTriangles == 0) return false;
 	}
 
+	printf("Loaded %zu vertices and %zu triangles\n", temp_vertices.size(), nrTriangles);
 	return true;
 }
 
@@ -1,7 +1,9 @@
 #include <vector>
-#include <map>
+#include <cmath>
+#include <cstdint>
+#include <omp.h>
 
-#include <string.h> // for memcmp
+#include <string.h> // for memcmp, memcpy
 
 #include "glm/glm/glm.hpp"
 #include "vboindexer.h"
@@ -44,56 +46,50 @@ bool getSimilarVertexIndex(
 	return false;
 }
 
-void indexVBO_slow(
-	std::vector<glm::vec3>& in_vertices,
-	std::vector<glm::vec2>& in_uvs,
-	std::vector<glm::vec3>& in_normals,
-
-	std::vector<unsigned int>& out_indices,
-	std::vector<glm::vec3>& out_vertices,
-	std::vector<glm::vec2>& out_uvs,
-	std::vector<glm::vec3>& out_normals
-) {
-	// For each input vertex
-	for (unsigned int i = 0; i < in_vertices.size(); i++) {
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned int index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i], out_vertices, out_uvs, out_normals, index);
+namespace {
+	// Vertex attributes reduced to 6 words, compared and hashed as a whole
+	struct VertexKey {
+		uint64_t words[6];
 
-		if (found) { // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back(index);
-		}
-		else { // If not, it needs to be added in the output data.
-			out_vertices.push_back(in_vertices[i]);
-			out_uvs.push_back(in_uvs[i]);
-			out_normals.push_back(in_normals[i]);
-			out_indices.push_back((unsigned int)out_vertices.size() - 1);
+		bool operator==(const VertexKey& that) const {
+			return memcmp(words, that.words, sizeof(words)) == 0;
 		}
+	};
+
+	inline uint32_t getBits(const float value) {
+		float canonical = value + 0.0f; // -0.0f and 0.0f are the same vertex
+		uint32_t bits;
+		memcpy(&bits, &canonical, sizeof(bits));
+		return bits;
 	}
-}
 
-struct PackedVertex {
-	glm::vec3 position;
-	glm::vec2 uv;
-	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const {
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex)) > 0;
-	};
-};
+	inline uint64_t quantize(const float value, const float invEpsilon) {
+		// Grid cell of the value, vertices in the same cell are welded. Beyond 2^23 cells
+		// floats are further apart than a cell, they and NaN keep their own bits.
+		const float MAX_CELL = 8388608.0f;
+		float cell = value * invEpsilon;
+		if (invEpsilon > 0.0f && std::fabs(cell) < MAX_CELL) return (uint64_t)(int64_t)std::floor(cell + 0.5f);
+		return (1ull << 32) | getBits(value); // Cells are below 2^23 or negative, this never equals one
+	}
 
-bool getSimilarVertexIndex_fast(
-	PackedVertex& packed,
-	std::map<PackedVertex, unsigned int>& VertexToOutIndex,
-	unsigned int& result
-) {
-	std::map<PackedVertex, unsigned int>::iterator it = VertexToOutIndex.find(packed);
-	if (it == VertexToOutIndex.end()) {
-		return false;
+	inline VertexKey makeKey(const glm::vec3& vertex, const glm::vec2& uv, const glm::vec3& normal, const float invEpsilon) {
+		// Only positions are snapped, uvs and normals must be equal
+		VertexKey key = { {
+			quantize(vertex.x, invEpsilon), quantize(vertex.y, invEpsilon), quantize(vertex.z, invEpsilon),
+			((uint64_t)getBits(uv.x) << 32) | getBits(uv.y),
+			((uint64_t)getBits(normal.x) << 32) | getBits(normal.y),
+			getBits(normal.z) } };
+		return key;
 	}
-	else {
-		result = it->second;
-		return true;
+
+	inline uint64_t hashKey(const VertexKey& key) {
+		uint64_t hash = 0x9E3779B97F4A7C15ull;
+		for (int i = 0; i < 6; ++i) {
+			hash ^= key.words[i];
+			hash *= 0xFF51AFD7ED558CCDull;
+			hash ^= hash >> 32;
+		}
+		return hash;
 	}
 }
 
@@ -105,40 +101,87 @@ void indexVBO(
 	std::vector<unsigned int>& out_indices,
 	std::vector<glm::vec3>& out_vertices,
 	std::vector<glm::vec2>& out_uvs,
-	std::vector<glm::vec3>& out_normals
+	std::vector<glm::vec3>& out_normals,
+	const float weldEpsilon
 ) {
-	std::map<PackedVertex, unsigned int> VertexToOutIndex;
-
-	// For each input vertex
-	for (unsigned int i = 0; i < in_vertices.size(); i++) {
+	const long long nrVertices = (long long)in_vertices.size();
+	const float invEpsilon = (weldEpsilon > 0.0f) ? 1.0f / weldEpsilon : 0.0f;
+
+	// Keys and hashes of all input vertices
+	std::vector<VertexKey> keys(nrVertices);
+	std::vector<uint64_t> hashes(nrVertices);
+	#pragma omp parallel for
+	for (long long i = 0; i < nrVertices; ++i) {
+		keys[i] = makeKey(in_vertices[i], in_uvs[i], in_normals[i], invEpsilon);
+		hashes[i] = hashKey(keys[i]);
+	}
 
-		PackedVertex packed = { in_vertices[i], in_uvs[i], in_normals[i] };
+	// Partition the vertices on the top bits of the hash. Equal vertices end up in
+	// the same partition, so every partition can be welded without locks.
+	int partitionBits = 0;
+	while ((1 << partitionBits) < 4 * omp_get_max_threads() && (nrVertices >> partitionBits) > 4096) partitionBits++;
+	const int nrPartitions = 1 << partitionBits;
 
+	std::vector<long long> partitionBegin(nrPartitions + 1, 0);
+	for (long long i = 0; i < nrVertices; ++i) {
+		partitionBegin[(partitionBits > 0) ? (hashes[i] >> (64 - partitionBits)) + 1 : 1]++;
+	}
+	for (int p = 0; p < nrPartitions; ++p) partitionBegin[p + 1] += partitionBegin[p];
 
-		// Try to find a similar vertex in out_XXXX
-		unsigned int index;
-		bool found = getSimilarVertexIndex_fast(packed, VertexToOutIndex, index);
+	// Vertices of each partition in input order
+	std::vector<long long> order(nrVertices);
+	std::vector<long long> fill(partitionBegin.begin(), partitionBegin.end() - 1);
+	for (long long i = 0; i < nrVertices; ++i) {
+		order[fill[(partitionBits > 0) ? hashes[i] >> (64 - partitionBits) : 0]++] = i;
+	}
 
-		if (found) { // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back(index);
+	// Open addressing hash table per partition. The first occurrence of a
+	// vertex becomes the representative of all its copies.
+	std::vector<long long> representative(nrVertices);
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int p = 0; p < nrPartitions; ++p) {
+		long long size = partitionBegin[p + 1] - partitionBegin[p];
+		if (size == 0) continue;
+
+		size_t capacity = 16;
+		while (capacity < 2 * (size_t)size) capacity *= 2;
+		const size_t mask = capacity - 1;
+		std::vector<long long> table(capacity, -1);
+
+		for (long long k = partitionBegin[p]; k < partitionBegin[p + 1]; ++k) {
+			long long i = order[k];
+			size_t slot = (size_t)hashes[i] & mask;
+			while (true) {
+				long long j = table[slot];
+				if (j < 0) {
+					table[slot] = i;
+					representative[i] = i;
+					break;
+				}
+				if (hashes[j] == hashes[i] && keys[j] == keys[i]) {
+					representative[i] = j;
+					break;
+				}
+				slot = (slot + 1) & mask;
+			}
 		}
-		else { // If not, it needs to be added in the output data.
+	}
+
+	// Representatives get output indices in input order, like the map based version did
+	std::vector<unsigned int> outIndex(nrVertices);
+	size_t indexBase = out_indices.size();
+	out_indices.resize(indexBase + nrVertices);
+	for (long long i = 0; i < nrVertices; ++i) {
+		if (representative[i] == i) {
+			outIndex[i] = (unsigned int)out_vertices.size();
 			out_vertices.push_back(in_vertices[i]);
 			out_uvs.push_back(in_uvs[i]);
 			out_normals.push_back(in_normals[i]);
-			unsigned int newindex = (unsigned int)out_vertices.size() - 1;
-			out_indices.push_back(newindex);
-			VertexToOutIndex[packed] = newindex;
 		}
+		out_indices[indexBase + i] = outIndex[representative[i]];
 	}
 }
 
-
-
-
-
-
-
 void indexVBO_TBN(
 	std::vector<glm::vec3>& in_vertices,
 	std::vector<glm::vec2>& in_uvs,
@@ -16,7 +16,11 @@ void indexVBO(
 	std::vector<unsigned int>& out_indices,
 	std::vector<glm::vec3>& out_vertices,
 	std::vector<glm::vec2>& out_uvs,
-	std::vector<glm::vec3>& out_normals
+	std::vector<glm::vec3>& out_normals,
+	// Grid snapping: positions are rounded to a multiple of weldEpsilon and vertices that round to
+	// the same cell with equal uvs and normals are welded. Close vertices on both sides of a cell
+	// boundary are not welded. 0 only merges identical vertices.
+	const float weldEpsilon = 0.0f
 );
 
 
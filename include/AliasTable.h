@@ -0,0 +1,34 @@
+#pragma once
+
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include <vector>
+
+/**************** Alias table ****************/
+// Samples an index with probability proportional to its weight in constant
+// time, Walker's alias method built with Vose's algorithm (1991). Every cell
+// holds its own index with probability m_threshold and its alias otherwise.
+class AliasTable {
+public:
+	AliasTable();
+
+	// Weights that are negative or not finite count as zero, all zero weights give a uniform table
+	void build(const std::vector<float>& weights);
+
+	// Index for a uniform number u in [0, 1), pdf is its probability. -1 with pdf 0 if the table is empty
+	int sample(const float u, float& pdf) const;
+	float getPdf(const int index) const;
+	int getSize() const;
+	bool isEmpty() const;
+
+private:
+	struct Cell {
+		float m_threshold;
+		int m_alias;
+	};
+	std::vector<Cell> m_cells;
+	std::vector<float> m_pdfs;
+};
+
+#endif // ALIAS_TABLE_H
@@ -7,11 +7,13 @@
 #include <iomanip>
 #include <vector>
 #include <fstream>
+#include <future>
 
 #include "../external/glm/glm/glm.hpp"
 #include "../external/glm/glm/ext.hpp"
 
 #include "../include/Ray.h"
+#include "../include/Film.h"
 
 class Camera {
 public:
@@ -24,12 +26,14 @@ public:
 	*/
 	// Constructor
 	explicit Camera(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov,
-		const int pixelWidht, const int pixelHeight // ImageResolution imageResolution
+		const int pixelWidht, const int pixelHeight, // ImageResolution imageResolution
+		const int aovs = Film::AOV_NONE				// AOV channels stored in the film
 	);
 
 	// Getters
 	int getPixelWidth() const;
 	int getPixelHeight() const;
+	Film& getFilm();
 
 	// Cast ray from pixel [x, y] with some randomness in range [-0.5, 0.5] for subsampling
 	std::shared_ptr<Ray> castCameraRay(
@@ -38,12 +42,15 @@ public:
 		const float randX,	// [-0.5, 0.5]
 		const float randY); // [-0.5, 0.5]
 
-	// Set value of pixel [x, y] in m_pixels to the given value
+	// Set value of pixel [x, y] in the film to the given value
  	void setPixelValues(const int x, const int y, const glm::vec3 pixelValue);
 
-	// Create a .ppm image from m_pixels
+	// Create an image from the film, the format is given by the extension (.ppm, .pfm or .hdr).
+	// Enabled AOVs are written next to it as <name>_<aov>.pfm.
 	void generateImage();
-	void generateImage(const std::string fileName, bool createTGA = false);
+	void generateImage(const std::string fileName);
+	// Create the images on a background thread from a copy of the film
+	std::future<bool> generateImageAsync(const std::string fileName);
 
 private:
 	// Image resolution
@@ -60,10 +67,7 @@ private:
 	glm::mat4 m_invVP;
 
 	// Image pixels
-	std::vector<std::vector<glm::vec3>> m_pixels;
-
-	// Create image
-	void createPPMImage(const std::string path);
+	Film m_film;
 	//void createTGAImage(const std::string path);
 };
 
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "../include/Film.h"
+#include "../include/Photon.h"
+
+/**************** Checkpoint state ****************/
+// Settings a checkpoint was made with and how far the render has come. The
+// sampler is counter based, so the seed and the nr of completed passes are
+// all that is needed to continue with the same random numbers.
+struct CheckpointState {
+	uint64_t m_seed = 0;
+	int32_t m_renderMode = 0;
+	int32_t m_width = 0;
+	int32_t m_height = 0;
+	int32_t m_aovs = 0;
+	int32_t m_nrPasses = 0;				// Samples per pixel, or photon passes in progressive mode
+	int32_t m_nrPhotonEmission = 0;
+	int32_t m_nrCompletedPasses = 0;
+	double m_nrEmittedPhotons = 0.0;	// Only used in progressive mode
+	int32_t m_shardMode = 0;			// Part of the render made by one worker, see Scene::setShard
+	int32_t m_shardIndex = 0;
+	int32_t m_nrShards = 1;
+
+	// True if other has the same settings, the shard may differ
+	bool isSameRender(const CheckpointState& other) const;
+	// True if a render with these settings can be resumed from other
+	bool isCompatible(const CheckpointState& other) const;
+};
+
+/**************** Checkpoint ****************/
+// The film and, in progressive mode, the visible points. Checkpoints are
+// written to a temporary file which is then renamed, so a render that is
+// killed while writing leaves the previous checkpoint intact. The finished
+// film of a shard is written in the same format.
+namespace Checkpoint {
+	static const uint32_t VERSION = 2;
+
+	bool write(const std::string& path, const CheckpointState& state, const Film& film,
+		const std::vector<VisiblePoint>* visiblePoints = nullptr);
+	// Returns false if the file is missing or unreadable
+	bool read(const std::string& path, CheckpointState& state, Film& film,
+		std::vector<VisiblePoint>* visiblePoints = nullptr);
+	// Only the state, to create a film of the right size. The size, AOVs and
+	// shard are checked, so a film and per shard flags can be made from them
+	bool readState(const std::string& path, CheckpointState& state);
+}
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,127 @@
+#pragma once
+
+#ifndef FILM_H
+#define FILM_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <memory>
+#include <new>
+
+#include "../external/glm/glm/glm.hpp"
+
+#include "../include/ImageWriter.h"
+
+/**************** Film sample ****************/
+// Radiance of one camera sample and the first hit used for the AOVs
+struct FilmSample {
+	glm::vec3 m_radiance = glm::vec3(0.0f);
+	glm::vec3 m_albedo = glm::vec3(0.0f);
+	glm::vec3 m_normal = glm::vec3(0.0f);
+	float m_depth = 0.0f;
+};
+
+/**************** Film buffer ****************/
+// Pixel channels stored as planes in one contiguous buffer aligned to a
+// cache line. Each plane is a row major image with one or three floats per
+// pixel. Colour and AOVs are sums over the samples of a pixel.
+class FilmBuffer {
+public:
+	enum aov {
+		AOV_NONE	= 0,
+		AOV_ALBEDO	= 1 << 0,
+		AOV_NORMAL	= 1 << 1,
+		AOV_DEPTH	= 1 << 2,
+	};
+
+	int getWidth() const;
+	int getHeight() const;
+	int getAOVs() const;
+
+	// Reset all channels to zero
+	void clear();
+
+	// Raw channel data, for saving and loading the film
+	float* getData();
+	const float* getData() const;
+	size_t getDataSize() const; // Nr of floats
+
+protected:
+	enum channel {
+		SUM,		// RGB
+		COUNT,		// Nr of samples
+		ALBEDO,		// RGB
+		NORMAL,		// XYZ
+		DEPTH,
+		NR_CHANNELS,
+	};
+
+	FilmBuffer(const int width, const int height, const int aovs);
+
+	float* getChannel(const int c);
+	const float* getChannel(const int c) const;
+	bool hasChannel(const int c) const;
+	static int getChannelSize(const int c); // Floats per pixel
+
+	void addSample(const int i, const FilmSample& sample);
+
+	int m_width, m_height;
+	int m_aovs;
+
+private:
+	struct AlignedDelete {
+		void operator()(float* data) const { ::operator delete[](data, std::align_val_t(64)); }
+	};
+
+	std::unique_ptr<float[], AlignedDelete> m_data;
+	size_t m_channelOffsets[NR_CHANNELS];	// Offset of each plane in m_data, in floats
+	size_t m_size;							// Total nr of floats
+};
+
+/**************** Film tile ****************/
+// Private accumulation buffer for one render tile, merged into the film when
+// the tile is done so that threads never write to the same cache lines
+class FilmTile : public FilmBuffer {
+public:
+	FilmTile(const int tileX, const int tileY, const int width, const int height, const int aovs);
+
+	// Add a sample to pixel [x, y] of the image, which must be inside the tile
+	void addSample(const int x, const int y, const FilmSample& sample);
+
+private:
+	int m_tileX, m_tileY;
+
+	friend class Film;
+};
+
+/**************** Film ****************/
+class Film : public FilmBuffer {
+public:
+	Film(const int width, const int height, const int aovs = AOV_NONE);
+
+	FilmTile createTile(const int tileX, const int tileY, const int tileWidth, const int tileHeight) const;
+	void mergeTile(const FilmTile& tile);
+
+	// Replace pixel [x, y] with a single sample of the given value
+	void setPixel(const int x, const int y, const glm::vec3 value);
+
+	// Averages over the samples of pixel [x, y]
+	glm::vec3 getPixel(const int x, const int y) const;
+	glm::vec3 getAlbedo(const int x, const int y) const;
+	glm::vec3 getNormal(const int x, const int y) const;
+	float getDepth(const int x, const int y) const;
+	float getSampleCount(const int x, const int y) const;
+
+	// Average colour of all pixels, or of an AOV channel (depth is written to all three channels)
+	void resolve(Image& image, const int aov = AOV_NONE) const;
+	// Images of the film and its AOVs, with the file names they are written to
+	std::vector<std::pair<std::string, Image>> resolveImages(const std::string& fileName) const;
+	// Write the images of resolveImages, false if one could not be written
+	bool writeImages(const std::string& fileName) const;
+
+private:
+	glm::vec3 getAverage(const int c, const int x, const int y) const;
+};
+
+#endif // FILM_H
@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include "../include/MappedFile.h"
+#include "../include/Film.h"
+
+/**************** Image stream header ****************/
+// Start of a stream file, followed by width * height RGB floats with the top
+// row first. A viewer maps the file read-only and polls the generation,
+// which is incremented after every published tile or pass. Writers count
+// themselves in m_nrWriters while they change the file.
+struct ImageStreamHeader {
+	char m_magic[8];					// "MCRTIMG"
+	uint32_t m_version;
+	uint32_t m_headerSize;				// Offset of the pixels in bytes
+	int32_t m_width;
+	int32_t m_height;
+	int32_t m_nrCompletedPasses;		// Samples per pixel, or passes in progressive mode
+	int32_t m_nrPasses;
+	int32_t m_isFinished;
+	std::atomic<int32_t> m_nrWriters;
+	std::atomic<uint64_t> m_generation;
+};
+
+// Progress of a stream when its image was copied
+struct ImageStreamState {
+	uint64_t m_generation = 0;
+	int m_nrCompletedPasses = 0;
+	int m_nrPasses = 0;
+	bool m_isFinished = false;
+};
+
+/**************** Image stream ****************/
+// Memory mapped float image that the renderer publishes finished tiles to,
+// so a long render can be watched while it runs (see viewer/viewer.cpp).
+// Writers never wait for readers: a reader copies the image again if a
+// writer was active or the generation changed during the copy.
+class ImageStream {
+public:
+	static const uint32_t VERSION = 2; // 2: nr of writers
+
+	ImageStream(const std::string& path, const int width, const int height, const int nrPasses);
+
+	bool isOpen() const;
+
+	// Copy the average colour of a region of the film. Threads may publish
+	// different regions at the same time.
+	void publishRegion(const Film& film, const int x, const int y, const int width, const int height);
+	void publish(const Film& film);
+	void setProgress(const int nrCompletedPasses, const bool isFinished = false);
+
+	// Copy the image of a stream file, returns false if it is not a stream or
+	// no complete copy could be made while it was being written
+	static bool read(const std::string& path, Image& image, ImageStreamState& state);
+
+private:
+	MappedFile m_file;
+	ImageStreamHeader* m_header;
+	float* m_pixels;
+
+	void beginWrite();
+	void endWrite();
+};
+
+#endif // IMAGE_STREAM_H
@@ -0,0 +1,34 @@
+#pragma once
+
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <string>
+#include <vector>
+#include <future>
+
+/**************** Image ****************/
+// Linear RGB float image, row major with the top row first
+struct Image {
+	int m_width = 0;
+	int m_height = 0;
+	std::vector<float> m_pixels; // 3 floats per pixel
+};
+
+/**************** Image writer ****************/
+// Writes images in one call to the file. The format is chosen from the file
+// extension: .ppm is tone mapped to 8 bits, .pfm and .hdr keep the floats.
+namespace ImageWriter {
+	bool write(const std::string& path, const Image& image, const float exposure = 1.0f, const float gamma = 2.2f);
+	// Write on a background thread, the image is copied so rendering can continue
+	std::future<bool> writeAsync(const std::string& path, Image image, const float exposure = 1.0f, const float gamma = 2.2f);
+
+	bool writePPM(const std::string& path, const Image& image, const float exposure = 1.0f, const float gamma = 2.2f);
+	bool writePFM(const std::string& path, const Image& image);
+	bool writeHDR(const std::string& path, const Image& image);
+
+	// Exposure, clamping and gamma of all channels in one pass
+	void toneMap(const Image& image, std::vector<unsigned char>& bytes, const float exposure, const float gamma);
+}
+
+#endif // IMAGE_WRITER_H
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include <vector>
+#include <array>
+#include <memory>
+#include <shared_mutex>
+
+#include "../external/glm/glm/glm.hpp"
+
+/**************** Irradiance record ****************/
+// Irradiance computed with a final gather at one point, see Ward and Heckbert 1992
+struct IrradianceRecord {
+	glm::vec3 m_position;
+	glm::vec3 m_normal;
+	glm::vec3 m_irradiance;
+	float m_harmonicDistance;					// Harmonic mean distance to the gathered surfaces, R_i
+	std::array<glm::vec3, 3> m_rotGradient;		// Rotational gradient per colour channel
+	std::array<glm::vec3, 3> m_transGradient;	// Translational gradient per colour channel
+};
+
+/**************** Irradiance cache ****************/
+// Sparse irradiance records stored in an octree. A record is reused by all
+// points within its validity radius, accuracy * R_i, and records are blended
+// with the weights and gradients of Ward's method.
+class IrradianceCache {
+public:
+	explicit IrradianceCache(const float accuracy = 0.2f);
+
+	// Interpolate irradiance at a point, returns false if no record is valid there
+	bool interpolate(const glm::vec3 position, const glm::vec3 normal, glm::vec3& irradiance) const;
+	void insert(const IrradianceRecord& record);
+
+	float getAccuracy() const;
+	size_t getNrRecords() const;
+
+private:
+	struct Node {
+		glm::vec3 m_center;
+		float m_halfSize;
+		std::vector<IrradianceRecord> m_records;
+		std::array<std::unique_ptr<Node>, 8> m_children;
+	};
+
+	float m_accuracy;
+	size_t m_nrRecords;
+	std::unique_ptr<Node> m_root;
+	mutable std::shared_mutex m_mutex; // Many readers while rendering, one writer per new record
+
+	void growRoot(const glm::vec3 position);
+	void interpolate(const Node* node, const glm::vec3 position, const glm::vec3 normal,
+		glm::vec3& irradianceSum, float& weightSum) const;
+	static int childIndex(const Node* node, const glm::vec3 position);
+};
+
+#endif // IRRADIANCE_CACHE_H
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/**************** Mapped file ****************/
+// Memory mapping of a whole file, read-only unless the file is created with
+// a size. The mapping is released when the object is destroyed.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path);
+	// Create (or truncate) a file of the given size and map it for reading and writing
+	MappedFile(const std::string& path, const size_t size);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool isOpen() const;
+	const char* getData() const;
+	char* getWritableData() const; // nullptr for read-only mappings
+	size_t getSize() const;
+
+	// Page faults of this process that had to read from disk, all page faults on Windows
+	static uint64_t getPageFaultCount();
+	// Largest resident set of this process so far, in bytes
+	static uint64_t getPeakResidentSize();
+
+private:
+	const char* m_data;
+	bool m_isWritable;
+	size_t m_size;
+
+#ifdef _WIN32
+	void* m_file;		// HANDLE
+	void* m_mapping;	// HANDLE
+#else
+	int m_fileDescriptor;
+#endif
+};
+
+#endif // MAPPED_FILE_H
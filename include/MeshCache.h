@@ -0,0 +1,93 @@
+#pragma once
+
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "../external/glm/glm/glm.hpp"
+
+#include "../include/MappedFile.h"
+#include "../include/OctreeAABB.h"
+#include "../include/SharedBuffer.h"
+
+/**************** Mesh cache ****************/
+// Binary file with a mesh that has been loaded, transformed and indexed,
+// together with its octree. The file is written next to the OBJ file the
+// first time a mesh is loaded and memory mapped read-only on later runs, so
+// processes rendering the same mesh share the pages of the file. The source
+// file is only hashed when its size or modification time has changed.
+class MeshCache {
+public:
+	static const uint32_t VERSION = 4; // 2: vertices ordered by octree leaf, 3: size and time of the source, 4: weld epsilon
+
+	// Map the cache file, isValid() is false if it is missing, from an older
+	// version or made from another source file, transform or weld
+	MeshCache(const std::string& path, const std::string& sourcePath, const glm::mat4& transform, const float weldEpsilon);
+
+	bool isValid() const;
+
+	// Getters, the buffers point into the mapped file and keep it mapped
+	SharedBuffer<glm::vec3> getVertices() const;
+	SharedBuffer<glm::vec3> getNormals() const;
+	SharedBuffer<glm::vec2> getUvs() const;
+	SharedBuffer<unsigned int> getIndices() const;
+	SharedBuffer<OctreeNodeAABB> getNodes() const;
+	SharedBuffer<unsigned int> getTriangleIndices() const;
+
+	// Write a cache file, it is first written to a temporary file and then renamed
+	static bool write(const std::string& path, const std::string& sourcePath, const glm::mat4& transform, const float weldEpsilon,
+		const SharedBuffer<glm::vec3>& vertices,
+		const SharedBuffer<glm::vec3>& normals,
+		const SharedBuffer<glm::vec2>& uvs,
+		const SharedBuffer<unsigned int>& indices,
+		const SharedBuffer<OctreeNodeAABB>& nodes,
+		const SharedBuffer<unsigned int>& triangleIndices);
+
+	// Path of the cache file for a source file, transform and weld
+	static std::string getCachePath(const std::string& filePath, const glm::mat4& transform, const float weldEpsilon);
+	// Hash of the content of a file, 0 if the file can not be read
+	static uint64_t hashFile(const std::string& filePath);
+
+private:
+	enum section {
+		VERTICES,
+		NORMALS,
+		UVS,
+		INDICES,
+		NODES,
+		TRIANGLE_INDICES,
+		NR_SECTIONS,
+	};
+
+	struct Header {
+		char m_magic[8];
+		uint32_t m_version;
+		uint32_t m_nodeSize;			// sizeof(OctreeNodeAABB) of the writer
+		uint64_t m_sourceHash;
+		uint64_t m_sourceSize;
+		int64_t m_sourceTime;			// Modification time of the source file, in ticks of its clock
+		float m_transform[16];
+		float m_weldEpsilon;
+		uint32_t m_padding;
+		uint64_t m_offsets[NR_SECTIONS];	// Byte offset of each section from the start of the file
+		uint64_t m_counts[NR_SECTIONS];	// Nr of elements in each section
+	};
+
+	static const size_t SECTION_ALIGNMENT = 64;
+
+	std::shared_ptr<MappedFile> m_file;
+	const Header* m_header;
+
+	template <typename T>
+	SharedBuffer<T> getSection(const int s) const;
+	bool hasValidIndices() const; // Indices and nodes refer to elements inside their sections
+	static uint64_t hash(const char* data, const size_t size, uint64_t h);
+	// Size and modification time of a file, false if it does not exist
+	static bool getSourceStamp(const std::string& filePath, uint64_t& size, int64_t& time);
+};
+
+#endif // MESH_CACHE_H
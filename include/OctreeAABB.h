@@ -3,13 +3,17 @@
 #include <vector>
 #include <array>
 #include <memory>
+#include <atomic>
+#include <cstdint>
 
 #include "../external/glm/glm/glm.hpp"
 #include "../external/boxOverlap.h"
+#include "../include/SharedBuffer.h"
 //#include "../include/SceneObject.h"
 
 //class SceneObject;
 class Ray;
+class Material;
 class OctreeNodeAABB;
 class OctreeAABB;
 struct AABB;
@@ -24,40 +28,76 @@ struct AABB {
 };
 
 /**************** Octree Node ****************/
-// A node of the octree. Each node have eight children
+// A node of the octree. Each node have eight children. All nodes of a tree
+// are stored in one array and the children of a node are stored next to
+// each other, so a tree can be written to and read from disk as it is.
 class OctreeNodeAABB {
 public:
-	OctreeNodeAABB(	 // ERROR C2664 (caused by first argument)
-		std::shared_ptr<OctreeNodeAABB> parent = nullptr,	// Parent node
-		int depth = 0,										// Maximum depth of tree
-		std::shared_ptr<Surface::Mesh> mesh = nullptr,		// Contained object
-		glm::vec3 aabbMin = glm::vec3(0.0f),				// Min boundary for axis aligned boundary box
-		glm::vec3 aabbMax = glm::vec3(0.0f));				// Max boundary for axis aligned boundary box
-
-	bool intersect(std::shared_ptr<Ray>) const;
-
-protected:
-	std::shared_ptr<Surface::Mesh> m_mesh;
-	std::vector<unsigned int> m_triangleIndicies;
+	bool intersect(std::shared_ptr<Ray> ray, const OctreeAABB& octree) const;
+	bool isLeaf() const;
+
 	AABB m_aabb;
+	int m_firstChild;				// Index of the first child node, -1 for leaf nodes
+	unsigned int m_triangleOffset;	// First triangle index of a leaf node in the octree index array
+	unsigned int m_triangleCount;	// Nr of triangle indices (3 per triangle) contained in the node
 
-	// Child nodes
-	std::array<std::shared_ptr<OctreeNodeAABB>, 8> m_children;
 	// In order:
-	// m_children[0] = left bottom far
-	// m_children[1] = right bottom far
-	// m_children[2] = left top far
-	// m_children[3] = right top far
-	// m_children[4] = left bottom near
-	// m_children[5] = right bottom near
-	// m_children[6] = left top near
-	// m_children[7] = right top near
+	// child 0 = left bottom far
+	// child 1 = right bottom far
+	// child 2 = left top far
+	// child 3 = right top far
+	// child 4 = left bottom near
+	// child 5 = right bottom near
+	// child 6 = left top near
+	// child 7 = right top near
 };
 
 /**************** Octree ****************/
-// An octree containing axis aligned bounding boxes
-class OctreeAABB : public OctreeNodeAABB {
+// An octree containing axis aligned bounding boxes. The octree shares the
+// vertex and normal buffers of its mesh.
+class OctreeAABB {
 public:
-	OctreeAABB(std::shared_ptr<Surface::Mesh> mesh = nullptr); // ERROR C2664 (caused by first argument)
+	// Build the octree for a mesh
+	explicit OctreeAABB(const Surface::Mesh& mesh);
+	// Use an octree that has already been built
+	OctreeAABB(const Surface::Mesh& mesh, SharedBuffer<OctreeNodeAABB> nodes, SharedBuffer<unsigned int> triangleIndices);
+
+	bool intersect(std::shared_ptr<Ray> ray) const;
+
+	// Residency of the leaf nodes, the clusters of an out-of-core mesh. A
+	// cluster miss is a cluster used in a frame that was not used in the
+	// frame before, so its pages are likely not in memory.
+	struct ClusterStats {
+		uint64_t m_nrClusters = 0;
+		uint64_t m_nrUsed = 0;
+		uint64_t m_nrMisses = 0;
+	};
+	void enableClusterTracking();
+	bool isTrackingClusters() const;
+	void beginFrame(); // Resets the stats
+	ClusterStats getClusterStats() const;
+
+	// Getters
+	const SharedBuffer<OctreeNodeAABB>& getNodes() const;
+	const SharedBuffer<unsigned int>& getTriangleIndices() const;
+
 private:
+	SharedBuffer<glm::vec3> m_vertices;
+	SharedBuffer<glm::vec3> m_normals;
+	std::shared_ptr<Material> m_material;
+	SharedBuffer<OctreeNodeAABB> m_nodes;			// Root node first
+	SharedBuffer<unsigned int> m_triangleIndices;	// Triangle indices of all leaf nodes, leaf by leaf
+
+	// Cluster tracking, the frame each node was last used in
+	std::unique_ptr<std::atomic<uint32_t>[]> m_clusterFrames;
+	uint32_t m_frame;
+	uint64_t m_nrClusters;
+	mutable std::atomic<uint64_t> m_nrUsedClusters, m_nrClusterMisses;
+
+	void touchCluster(const size_t nodeIndex) const;
+
+	void buildNode(std::vector<OctreeNodeAABB>& nodes, std::vector<unsigned int>& triangleIndices,
+		const int nodeIndex, const unsigned int* indices, const size_t nrIndices, const int depth) const;
+
+	friend class OctreeNodeAABB;
 };
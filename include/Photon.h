@@ -5,28 +5,63 @@
 
 #include "../external/glm/glm/glm.hpp"
 
+#include "../include/Utility.h"
+
 const static float PHOTON_RADIUS = 0.05f;
 
 /**************** Photon ****************/
+// Packed photon, 20 bytes: float position, shared exponent (RGBE) flux and a
+// direction quantized to two bytes of spherical angles (Jensen 2001)
 struct Photon {
 	glm::vec3 m_position;
-	glm::vec3 m_direction;
-	glm::vec3 m_flux;	// Watt
-	const float RADIUS = PHOTON_RADIUS;
-
-	Photon& operator=(const Photon& p) {
-		this->m_position = p.m_position;
-		this->m_direction = p.m_direction;
-		this->m_flux = p.m_flux;
-		return *this;
+	unsigned char m_flux[4];	// Watt, RGBE
+	unsigned char m_theta;		// Inclination of direction, [0, pi] in 256 steps
+	unsigned char m_phi;		// Azimuth of direction, [0, 2 pi] in 256 steps
+
+	void setFlux(const glm::vec3 flux) {
+		Utility::PackRGBE(flux, m_flux);
+	}
+
+	glm::vec3 getFlux() const {
+		return Utility::UnpackRGBE(m_flux);
+	}
+
+	void setDirection(const glm::vec3 direction) {
+		int theta = int(glm::acos(glm::clamp(direction.z, -1.0f, 1.0f)) * (256.0f / glm::pi<float>()));
+		int phi = int(glm::floor(glm::atan(direction.y, direction.x) * (256.0f / glm::two_pi<float>())));
+		m_theta = (unsigned char)glm::min(theta, 255);
+		m_phi = (unsigned char)(phi & 255); // Negative azimuths wrap around
+	}
+
+	glm::vec3 getDirection() const {
+		// Sine and cosine of every quantized angle are computed once
+		struct AngleTable {
+			float cosTheta[256], sinTheta[256], cosPhi[256], sinPhi[256];
+			AngleTable() {
+				for (int i = 0; i < 256; ++i) {
+					float angle = (i + 0.5f) * glm::pi<float>() / 256.0f;
+					cosTheta[i] = glm::cos(angle);
+					sinTheta[i] = glm::sin(angle);
+					cosPhi[i] = glm::cos(2.0f * angle);
+					sinPhi[i] = glm::sin(2.0f * angle);
+				}
+			}
+		};
+		static const AngleTable table;
+
+		return glm::vec3(
+			table.sinTheta[m_theta] * table.cosPhi[m_phi],
+			table.sinTheta[m_theta] * table.sinPhi[m_phi],
+			table.cosTheta[m_theta]);
 	}
 };
 
+static_assert(sizeof(Photon) == 20, "Photon is expected to be packed into 20 bytes");
+
 /**************** KDtree node ****************/
 struct KDTreeNode {
 	typedef double value_type;
 	Photon p;
-	size_t index;
 
 	// Used in kdtree++ implementation
 	value_type operator[](size_t n) const {
@@ -39,4 +74,26 @@ struct KDTreeNode {
 	}
 };
 
+/**************** Gather point ****************/
+// Diffuse shading point whose caustics are gathered in a batch
+struct GatherPoint {
+	glm::vec3 m_position;
+	glm::vec3 m_brdf;		// Brdf of the surface, independent of the photon direction
+	int m_sampleIndex;		// Sample the gathered radiance belongs to
+};
+
+/**************** Visible point ****************/
+// First diffuse hit of a camera path, used by progressive photon mapping.
+// Position and weight are refreshed every pass, radius and flux are kept
+struct VisiblePoint {
+	glm::vec3 m_position = glm::vec3(0.0f);
+	glm::vec3 m_normal = glm::vec3(0.0f);
+	glm::vec3 m_weight = glm::vec3(0.0f);	// Path throughput times diffuse brdf
+	glm::vec3 m_flux = glm::vec3(0.0f);		// Accumulated (unnormalised) flux, tau
+	glm::vec3 m_emitted = glm::vec3(0.0f);	// Accumulated light seen directly by the camera
+	float m_radius = PHOTON_RADIUS;			// Current gather radius
+	float m_nrPhotons = 0.0f;				// Accumulated photon count, N
+	bool m_isValid = false;					// False if the camera path missed all diffuse surfaces
+};
+
 #endif // PHOTON_H
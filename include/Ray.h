@@ -34,6 +34,7 @@ struct Intersection {
 	float m_t = 10000.0f; // distance to ray origin
 	glm::vec3 m_intersectionPt, m_normal;
 	std::shared_ptr<Material> m_material;
+	int m_objectIndex = -1; // Object that was hit, set by Scene::findRayIntersection
 };
 
 /**************** Ray ****************/
@@ -58,7 +59,7 @@ public:
 	  *   \return An int
 	  *
 	  **/
-	std::shared_ptr<Intersection> getIntersection() const;
+	const std::shared_ptr<Intersection>& getIntersection() const;
 	float getReflectionCoefficient() const;
 	void setStartPt(const glm::vec3 startPt);
 	void setDirection(const glm::vec3 direction);
@@ -71,6 +72,7 @@ public:
 	bool hitsPerfectReflectorSurface() const;
 	bool hitsTransparentSurface() const;
 	bool hitsDiffuseSurface() const;
+	bool hitsLambertianSurface() const;
 
 	glm::vec3 getBRDFValue(std::shared_ptr<Ray> reflectedRay) const;
 	glm::vec3 getBRDFValue(const glm::vec3 direction) const;
@@ -0,0 +1,43 @@
+#pragma once
+
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <string>
+#include <memory>
+#include <iostream>
+#include <sstream>
+
+#include "../include/Scene.h"
+
+/**************** Render server ****************/
+// Keeps a built scene and its photon map and renders one job per line:
+//
+// render [eye <xyz>] [center <xyz>] [up <xyz>] [fov <degrees>] [width <int>]
+//        [height <int>] [samples <int>] [passes <int>] [seed <int>] [output <path>]
+//        [budget <seconds>]
+// quit
+//
+// Values that are not given are taken from the scene file. Every job is
+// answered with one line, "ok <output> <seconds>" or "error <message>".
+class RenderServer {
+public:
+	RenderServer(std::shared_ptr<Scene> scene, const RenderSettings& settings);
+
+	// Answer the jobs of in on out until the input ends or a quit job, false after quit
+	bool run(std::istream& in, std::ostream& out);
+	// Jobs from standard input, the render output is moved to standard error
+	void runStandardInput();
+	// Jobs from the connections to a Unix domain socket at path, one connection at a time
+	bool runSocket(const std::string& path);
+
+private:
+	std::shared_ptr<Scene> m_scene;
+	RenderSettings m_settings;		// Defaults of every job
+	int m_nrJobs;
+
+	bool parseJob(std::istringstream& line, RenderSettings& job, std::string& error) const;
+	bool render(const RenderSettings& job, double& seconds, std::string& error);
+};
+
+#endif // RENDER_SERVER_H
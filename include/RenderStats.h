@@ -0,0 +1,114 @@
+#pragma once
+
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+/**************** Render stats ****************/
+// Counters of the hot paths and timers of the render phases. Every thread
+// counts in its own slot, the slots are summed when the stats are read, so
+// counting costs one thread local add. Define MCRT_DISABLE_STATS to compile
+// the counters out, the phase timers are always kept.
+namespace RenderStats {
+	enum counter {
+		CAMERA_RAYS,
+		SECONDARY_RAYS,			// Reflected, refracted and final gather rays
+		SHADOW_RAYS,
+		PHOTON_RAYS,
+		TRACED_RAYS,			// All rays tested against the scene
+		NODE_VISITS,			// Octree nodes
+		TRIANGLE_TESTS,
+		GATHER_QUERIES,			// Photon map range queries
+		PHOTONS_GATHERED,
+		RUSSIAN_ROULETTE_TERMINATIONS,
+		DEPTH_TERMINATIONS,		// Paths cut at the maximum depth
+		NR_COUNTERS,
+	};
+
+	enum histogram {
+		CAMERA_PATH_LENGTH,		// Surface hits of each camera path
+		PHOTON_PATH_LENGTH,		// Surface hits of each photon path
+		PHOTONS_PER_QUERY,		// Bucket i holds queries with [2^(i-1), 2^i) photons, bucket 0 holds empty ones
+		NR_HISTOGRAMS,
+	};
+	static const int HISTOGRAM_SIZE = 16; // The last bucket holds all larger values
+
+	enum phase {
+		SCENE_BUILD,
+		OCTREE_BUILD,			// Summed over the threads that load meshes
+		PHOTON_EMISSION,
+		KDTREE_OPTIMIZE,
+		RENDER,
+		IMAGE_WRITE,
+		NR_PHASES,
+	};
+
+	struct ThreadStats {
+		uint64_t m_counters[NR_COUNTERS];
+		uint64_t m_histograms[NR_HISTOGRAMS][HISTOGRAM_SIZE];
+		uint64_t m_phaseNanoseconds[NR_PHASES];
+	};
+
+	// Slot of one thread, registered on first use. The counts of a thread
+	// that exits are kept.
+	class ThreadSlot {
+	public:
+		ThreadSlot();
+		~ThreadSlot();
+
+		ThreadStats m_stats;
+	};
+
+	inline ThreadStats& getThreadStats() {
+		thread_local ThreadSlot slot;
+		return slot.m_stats;
+	}
+
+#ifdef MCRT_DISABLE_STATS
+	inline void add(const counter, const uint64_t = 1) {}
+	inline void record(const histogram, const uint64_t) {}
+#else
+	inline void add(const counter c, const uint64_t n = 1) {
+		getThreadStats().m_counters[c] += n;
+	}
+	inline void record(const histogram h, const uint64_t value) {
+		getThreadStats().m_histograms[h][(value < (uint64_t)HISTOGRAM_SIZE) ? value : HISTOGRAM_SIZE - 1]++;
+	}
+#endif
+	// Bucket of the photons per query histogram
+	inline uint64_t getLog2Bucket(uint64_t value) {
+		uint64_t bucket = 0;
+		while (value > 0) {
+			value >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+
+	void addTime(const phase p, const double seconds);
+
+	// Adds the time from construction to destruction to a phase
+	class ScopedTimer {
+	public:
+		explicit ScopedTimer(const phase p);
+		~ScopedTimer();
+
+		double getSeconds() const;
+
+	private:
+		phase m_phase;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	// Sum of all threads, read when the threads are idle
+	ThreadStats getTotals();
+	double getPhaseSeconds(const phase p);
+	void reset();
+
+	bool writeReport(const std::string& path);
+}
+
+#endif // RENDER_STATS_H
@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+/**************** Sampler ****************/
+// PCG32 random numbers (O'Neill 2014) where every stream is fully given by
+// a seed, a stream id and an index, e.g. a pixel and a sample number. The
+// numbers of a sample do not depend on which thread renders it or on what
+// has been rendered before, so a render can be stopped and resumed.
+class Sampler {
+public:
+	Sampler(const uint64_t seed, const uint64_t stream, const uint64_t index)
+		: m_state(0), m_increment((mix(seed ^ mix(stream)) << 1) | 1) {
+		nextUInt();
+		m_state += mix(seed + mix(index + 0x632BE59BD9B4E019ull));
+		nextUInt();
+	}
+
+	// Uniform float in [0, 1)
+	float next() {
+		return (float)(nextUInt() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	uint32_t nextUInt() {
+		uint64_t oldState = m_state;
+		m_state = oldState * 6364136223846793005ull + m_increment;
+		uint32_t xorShifted = (uint32_t)(((oldState >> 18) ^ oldState) >> 27);
+		uint32_t rotation = (uint32_t)(oldState >> 59);
+		return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+	}
+
+private:
+	uint64_t m_state;
+	uint64_t m_increment; // Must be odd
+
+	// SplitMix64 finalizer
+	static uint64_t mix(uint64_t x) {
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+};
+
+#endif // SAMPLER_H
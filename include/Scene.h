@@ -5,8 +5,8 @@
 
 // Includes
 #include <vector>
+#include <string>
 #include <memory>
-#include <random>
 #include <iostream>
 #include <iomanip>
 #include <omp.h>
@@ -17,6 +17,14 @@
 #include "../include/SceneObject.h"
 #include "../include/Photon.h"
 #include "../include/Camera.h"
+#include "../include/IrradianceCache.h"
+#include "../include/Sampler.h"
+#include "../include/Checkpoint.h"
+#include "../include/ImageStream.h"
+#include "../include/OctreeAABB.h"
+#include "../include/AliasTable.h"
+
+struct RenderSettings;
 
 class Scene {
 public:
@@ -24,25 +32,89 @@ public:
 	~Scene();
 
 	enum renderMode {
-		CAUSTICS, MONTE_CARLO,
+		CAUSTICS, MONTE_CARLO, PROGRESSIVE,
+	};
+
+	// Diagnostic output, each pixel shows the cost of its samples instead of radiance
+	enum heatmap {
+		HEATMAP_NONE,
+		HEATMAP_NODES,		// Octree node visits
+		HEATMAP_TRIANGLES,	// Triangle intersection tests
+		HEATMAP_PHOTONS,	// Photons returned by photon map queries
+		HEATMAP_TIME,		// Nanoseconds
+	};
+
+	// Part of a render made by one of several independent workers
+	enum shardMode {
+		SHARD_NONE,
+		SHARD_TILES,		// Every nrShards-th tile, starting at the index
+		SHARD_SAMPLES,		// A contiguous range of the samples per pixel
 	};
 
 	void setNrSubsamples(const int nrSubsamples);
 	void setNrPhotonEmission(const int nrPhotonEmission);
+	void setRenderMode(const int renderMode);
+	void setNrPasses(const int nrPasses);
+	void setInitialPhotonRadius(const float radius);
+	void setIrradianceCaching(const bool useIrradianceCache, const float accuracy = 0.2f);
+	void setSeed(const uint64_t seed);
+	// Write the render state to filePath at most every interval seconds and resume from it if it exists
+	void setCheckpoint(const std::string& filePath, const int intervalSeconds = 600);
+	// Publish finished tiles and passes to a memory mapped image at filePath while rendering
+	void setImageStream(const std::string& filePath);
+	void setHeatmap(const int heatmap);
+	// Render only a shard and write its film to filePath, see merge/merge.cpp
+	void setShard(const int mode, const int index, const int nrShards, const std::string& filePath);
+	// Seconds from now for the photon map and the render, the nr of samples or passes then
+	// follows from the measured throughput. Fixed counts are used if seconds is 0.
+	void setTimeBudget(const float seconds);
 	int getNrSubsamples() const;
 	int getNrPhotonEmission() const;
+	int getRenderMode() const;
+	int getNrPasses() const;
 
 	static std::shared_ptr<Scene> generateScene();
+	// Load a scene description file, see data/scenes/cornell.scene. Settings
+	// and camera in the file are written to settings. Returns nullptr on errors.
+	static std::shared_ptr<Scene> loadScene(const std::string& filePath, RenderSettings& settings);
+	static bool parseHeatmap(const std::string& name, int& heatmap); // off, nodes, triangles, photons or time
+	static bool parseShard(const std::string& name, int& shardMode); // tiles or samples
+	void applySettings(const RenderSettings& settings);
 	void generatePhotonMap(const int NR_PHOTONS);
 	void render(std::shared_ptr<Camera> camera);
+	// Several views of the scene, the tiles of all views share the threads
+	void render(const std::vector<std::shared_ptr<Camera>>& cameras);
+
+	// Closest intersection of a ray with all objects, also used by the benchmarks
+	bool findRayIntersection(std::shared_ptr<Ray> ray);
 
 private:
 	const static int MAX_DEPTH = 3;
+	const static int TILE_SIZE = 16;	// Width and height in pixels of a render tile
 	int m_nrSubsamples, m_nrPhotonEmission;
 	int m_renderMode;
+	int m_nrPasses;					// Photon passes in progressive mode
+	float m_initialPhotonRadius;	// Start gather radius in progressive mode
+	uint64_t m_seed;				// All random numbers are given by the seed
+	std::string m_checkpointPath;	// No checkpoints if empty
+	int m_checkpointInterval;		// Seconds
+	std::string m_imageStreamPath;	// No live output if empty
+	std::unique_ptr<ImageStream> m_imageStream;
+	int m_heatmap;
+	int m_shardMode, m_shardIndex, m_nrShards;
+	std::string m_shardPath;
+	float m_timeBudget;				// Seconds, no budget if 0
+	std::chrono::steady_clock::time_point m_deadline;
 	std::vector<int> m_lightIndices;
+	AliasTable m_lightTable;		// Lights by emitted power, built before the photon map or render needs it
+	bool m_isLightTableBuilt;		// False when lights have been added since the table was built
+	std::vector<int> m_lightOfObject; // Entry of each scene object in the light table, -1 if it does not emit
 	std::vector<std::shared_ptr<Surface::Base>> m_sceneObjects;
 	KDTree::KDTree<3, KDTreeNode> m_photonMap;
+	float m_photonPower;			// Flux of one emitted photon of the photon map
+	std::shared_ptr<IrradianceCache> m_irradianceCache; // Indirect diffuse light, only used in Monte Carlo mode
+	std::vector<std::shared_ptr<OctreeAABB>> m_outOfCoreOctrees;
+	uint64_t m_pageFaultCount;		// At the start of the current frame
 
 	// Add objects to scene
 	void addHexagonWalls();
@@ -54,26 +126,114 @@ private:
 	void addMesh(const glm::mat4 transform, const char* filePath, std::shared_ptr<Material> material, bool isEmissive = false);
 
 	// Construction of photon map
-	std::shared_ptr<Ray> castLightRay(const int pickedLight = 0);
-	glm::vec3 tracePhotonRay(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance = glm::vec3(0.0f), int depth = 0);
-	glm::vec3 tracePhotonShadowRay(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance = glm::vec3(0.0f));
-	glm::vec3 traceRefractedPhotonRay(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance = glm::vec3(0.0f), int depth = 0);
+	void emitPhotons(const int nrPhotons, const int batch); // Each batch of photons uses its own random numbers
+	std::shared_ptr<Ray> castLightRay(Sampler& sampler, const int pickedLight = 0);
+	glm::vec3 tracePhotonRay(std::shared_ptr<Ray> ray, Sampler& sampler, glm::vec3 photonRadiance = glm::vec3(0.0f), int depth = 0);
+	glm::vec3 tracePhotonShadowRay(std::shared_ptr<Ray> ray, Sampler& sampler, glm::vec3 photonRadiance = glm::vec3(0.0f));
+	glm::vec3 traceRefractedPhotonRay(std::shared_ptr<Ray> ray, Sampler& sampler, glm::vec3 photonRadiance = glm::vec3(0.0f), int depth = 0);
 	void addPhotonToMap(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance, int depth);
 
 	// Trace rays
-	glm::vec3 traceRay(std::shared_ptr<Ray> ray, int depth = 0);
-	glm::vec3 traceRefractedRay(std::shared_ptr<Ray> ray, int depth); // Light through transparent objects
-	glm::vec3 traceDiffuseRay(std::shared_ptr<Ray> ray); // Direct light
-	glm::vec3 traceShadowRay(std::shared_ptr<Ray> ray, std::shared_ptr<Ray> shadowRay);	// Local illumination, diffuse
+	void renderTile(std::shared_ptr<Camera> camera, const int tileX, const int tileY, const int sample); // One sample per pixel
+	glm::vec3 traceRay(std::shared_ptr<Ray> ray, Sampler& sampler, int depth = 0);
+	glm::vec3 shadeIntersection(std::shared_ptr<Ray> ray, Sampler& sampler, int depth, bool gatherCaustics = true);
+	glm::vec3 traceRefractedRay(std::shared_ptr<Ray> ray, Sampler& sampler, int depth); // Light through transparent objects
+	glm::vec3 traceDiffuseRay(std::shared_ptr<Ray> ray, Sampler& sampler); // Direct light, light and BRDF samples combined by MIS
+	float getLightPdf(const int objectIndex, const glm::vec3 direction, const float distance, const glm::vec3 lightNormal) const; // Solid angle
 	glm::vec3 traceCausticsRay(std::shared_ptr<Ray> ray);
 
+	// Caustics for a block of diffuse shading points, one photon map traversal per block.
+	// The heatmap cost of each point is added to costs if it is given.
+	void gatherCaustics(std::vector<GatherPoint>& gatherPoints, std::vector<glm::vec3>& caustics,
+		std::vector<float>* costs = nullptr) const;
+	void gatherCausticsBlock(const std::vector<GatherPoint>& gatherPoints, int* block, const int blockSize,
+		std::vector<glm::vec3>& caustics, std::vector<float>* costs) const;
+	glm::vec3 traceIndirectDiffuseRay(std::shared_ptr<Ray> ray, Sampler& sampler); // Indirect diffuse light from the irradiance cache
+
+	// Final gather for the irradiance cache
+	IrradianceRecord computeIrradianceRecord(const glm::vec3 position, const glm::vec3 normal, Sampler& sampler);
+	glm::vec3 getPhotonDensityRadiance(std::shared_ptr<Ray> ray) const; // Outgoing radiance of a diffuse point
+
+	// Stochastic progressive photon mapping
+	int renderProgressive(std::shared_ptr<Camera> camera); // Returns the nr of passes
+	void traceVisiblePoint(std::shared_ptr<Ray> ray, VisiblePoint& visiblePoint, Sampler& sampler);
+	void gatherVisiblePoint(VisiblePoint& visiblePoint);
+	float getLightPower(const int objectIndex) const;
+	float getTotalLightPower() const;
+	void buildLightTable();
+	void updateLightTable(); // Builds the table if lights were added
+	void resolveProgressive(std::shared_ptr<Camera> camera, const std::vector<VisiblePoint>& visiblePoints,
+		const double nrEmittedPhotons, const int nrCompletedPasses); // Radiance estimate of the passes so far
+
 	// Helper functions
-	bool findRayIntersection(std::shared_ptr<Ray> ray);
-	bool russianRoulette(const int depth);
+	bool russianRoulette(const int depth, Sampler& sampler);
+	CheckpointState getCheckpointState(std::shared_ptr<Camera> camera) const; // Without progress
+	double getSecondsLeft() const; // Until the deadline of the time budget
+	int getNrBudgetedPasses(const double secondsPerPass) const; // Further passes that fit into the time budget
+
+	// Heatmap cost of the work done by the calling thread since a snapshot
+	struct CostSnapshot {
+		uint64_t m_count = 0;
+		std::chrono::steady_clock::time_point m_time;
+	};
+	CostSnapshot getCostSnapshot() const;
+	float getCostSince(const CostSnapshot& snapshot) const;
+	void resolveHeatmap(std::shared_ptr<Camera> camera) const; // Replace the average cost of each pixel by a colour
+
+	// Cluster and page fault statistics of out-of-core meshes, a frame is one sample or pass
+	void collectOutOfCoreOctrees();
+	void beginGeometryFrame();
+	void reportGeometryFrame(const int frame);
+
+	// Stream ids of the random numbers that are not used by camera samples
+	static const uint64_t PHOTON_STREAM = 1ull << 48;
+};
+
+/**************** Render settings ****************/
+// Render settings and camera, defaults can be overridden by a scene file
+struct RenderSettings {
+	int m_width = 400;
+	int m_height = 400;
+	int m_nrPhotonEmission = 1000;
+	int m_nrSubsamples = 2;
+	int m_nrPasses = 64;				// Only used in progressive mode
+	int m_renderMode = Scene::CAUSTICS;
+	bool m_irradianceCaching = false;	// Only used in Monte Carlo mode
+	float m_irradianceAccuracy = 0.2f;
+	int m_aovs = Film::AOV_NONE;		// AOV channels of the film
+	std::string m_outputPath = "data/output/test.ppm"; // .ppm, .pfm or .hdr
+	uint64_t m_seed = 0;
+	std::string m_checkpointPath;		// No checkpoints if empty
+	int m_checkpointInterval = 600;		// Seconds
+	std::string m_imageStreamPath;		// Live output, see ImageStream.h
+	bool m_outOfCore = false;			// Render meshes from their mapped cache files
+	bool m_rebuildMeshCache = false;	// Write the mesh cache files again
+	float m_weldEpsilon = 0.0f;			// Grid of the mesh vertex weld, only identical vertices if 0
+	std::string m_meshDirectory;		// Replaces the directory of the OBJ files in the scene file if not empty
+	std::string m_statsPath;			// JSON render stats, not written if empty
+	std::string m_tracePath;			// Chrome trace of the render threads, not recorded if empty
+	int m_heatmap = Scene::HEATMAP_NONE; // Render the cost of each pixel instead of radiance
+	int m_shardMode = Scene::SHARD_NONE;
+	int m_shardIndex = 0;
+	int m_nrShards = 1;
+	std::string m_shardPath;			// Film of the shard, written instead of the image
+	float m_timeBudget = 0.0f;			// Seconds for the photon map and the render, fixed counts if 0
+
+	glm::vec3 m_eye = glm::vec3(0.0f, 0.0f, 3.2f);
+	glm::vec3 m_center = glm::vec3(0.0f);
+	glm::vec3 m_up = glm::vec3(0.0f, 1.0f, 0.0f);
+	float m_fov = glm::pi<float>() / 3;	// Radians
+
+	// Extra cameras rendered in one batch, each to its own output. Size and AOVs are shared.
+	struct View {
+		std::string m_outputPath;
+		glm::vec3 m_eye, m_center, m_up;
+		float m_fov;
+	};
+	std::vector<View> m_views;
 
-	// Random number generator (should be in either scene or camera, where the render function is)
-	std::mt19937* gen;
-	std::uniform_real_distribution<float>* dis;
+	std::shared_ptr<Camera> createCamera() const;
+	std::shared_ptr<Camera> createCamera(const View& view) const;
 };
 
 #endif // SCENE_H
\ No newline at end of file
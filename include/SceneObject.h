@@ -6,6 +6,8 @@
 #include <memory>
 #include <iostream>
 #include <vector>
+#include <string>
+#include <cstdint>
 
 #include "../external/glm/glm/glm.hpp"
 #include "../external/glm/glm/gtx/vector_angle.hpp"
@@ -14,6 +16,7 @@
 
 //#include "../include/OctreeAABB.h"
 #include "../include/Material.h"
+#include "../include/SharedBuffer.h"
 
 class OctreeAABB;
 class Ray;
@@ -43,30 +46,47 @@ namespace Surface {
 	/**************** Mesh ****************/
 	class Mesh : public Base {
 	public:
-		Mesh(glm::mat4 transform, const char* filePath, std::shared_ptr<Material> material);
+		// Out-of-core meshes are always rendered from the mapped cache file, only
+		// the octree nodes are kept in memory and the use of leaves is tracked.
+		// The cache file is written again without reading it if rebuildCache is set.
+		// Vertices are welded on a grid of weldEpsilon, see indexVBO.
+		// isLoaded() is false if the OBJ file could not be loaded
+		Mesh(glm::mat4 transform, const char* filePath, std::shared_ptr<Material> material, const bool outOfCore = false,
+			const bool rebuildCache = false, const float weldEpsilon = 0.0f);
+		// Instance of a mesh with another material, the geometry and octree are shared
+		Mesh(const Mesh& mesh, std::shared_ptr<Material> material);
 		bool intersect(std::shared_ptr<Ray> ray) const override; 
 		glm::vec3 getRandomPointOnSurface(float u, float v) const override;	// Not necessary
+		bool isLoaded() const;
 
 		// Getters
 		glm::vec3 getMinPos() const;
 		glm::vec3 getMaxPos() const;
 		glm::mat4 getTransform() const;
 		int getNrOfTriangles() const;
-		std::vector<unsigned int> getIndices() const;
+		const SharedBuffer<glm::vec3>& getVertices() const;
+		const SharedBuffer<glm::vec3>& getNormals() const;
+		const SharedBuffer<glm::vec2>& getUvs() const;
+		const SharedBuffer<unsigned int>& getIndices() const;
+		std::shared_ptr<OctreeAABB> getOctree() const;
 
 		glm::vec3 getVertex(const int i) const;
 		glm::vec3 getNormal(const int i) const override;
 
 	private:
-		std::vector<glm::vec3> m_vertices; // positions
-		std::vector<glm::vec3> m_normals;
-		std::vector<glm::vec2> m_uvs;
-		std::vector<unsigned int> m_indices;
+		// Immutable geometry, shared with the octree and instances of the mesh
+		SharedBuffer<glm::vec3> m_vertices; // positions
+		SharedBuffer<glm::vec3> m_normals;
+		SharedBuffer<glm::vec2> m_uvs;
+		SharedBuffer<unsigned int> m_indices;
 
 		glm::mat4 m_transform;
 		std::shared_ptr<OctreeAABB> m_otAABB;
 
-		friend class OctTreeNodeAABB;
+		bool loadCache(const std::string& cachePath, const std::string& sourcePath, const float weldEpsilon, const bool outOfCore);
+		void clusterGeometry(); // Order the vertices by octree leaf
+
+		friend class OctreeAABB;
 	};
 
 	/**************** Sphere ****************/
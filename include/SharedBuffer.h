@@ -0,0 +1,45 @@
+#pragma once
+
+#ifndef SHARED_BUFFER_H
+#define SHARED_BUFFER_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+/**************** Shared buffer ****************/
+// Immutable, reference counted array. Copies of a buffer share the same
+// memory, which is owned either by a vector moved into the buffer or by
+// another object such as a mapped file.
+template <typename T>
+class SharedBuffer {
+public:
+	SharedBuffer()
+		: m_owner(nullptr), m_data(nullptr), m_size(0) {}
+
+	// Take ownership of the elements of a vector
+	explicit SharedBuffer(std::vector<T>&& elements) {
+		std::shared_ptr<const std::vector<T>> owner = std::make_shared<const std::vector<T>>(std::move(elements));
+		m_data = owner->data();
+		m_size = owner->size();
+		m_owner = owner;
+	}
+
+	// Elements stored in memory that is kept alive by owner
+	SharedBuffer(std::shared_ptr<const void> owner, const T* data, const size_t size)
+		: m_owner(owner), m_data(data), m_size(size) {}
+
+	const T& operator[](const size_t i) const { return m_data[i]; }
+	const T* data() const { return m_data; }
+	const T* begin() const { return m_data; }
+	const T* end() const { return m_data + m_size; }
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+private:
+	std::shared_ptr<const void> m_owner;
+	const T* m_data;
+	size_t m_size;
+};
+
+#endif // SHARED_BUFFER_H
@@ -0,0 +1,57 @@
+#pragma once
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**************** Trace ****************/
+// Timeline of scoped events per thread, written in the Chrome trace event
+// format (chrome://tracing or ui.perfetto.dev). Every thread records into
+// its own ring buffer, so recording never takes a lock. When a buffer is
+// full the oldest events are overwritten. Nothing is recorded until start()
+// is called.
+namespace Trace {
+	struct Event {
+		const char* m_name;			// String literals only, they are read when the trace is written
+		const char* m_category;
+		uint64_t m_start;			// Nanoseconds since start()
+		uint64_t m_duration;
+		const char* m_argNames[2];	// nullptr if unused
+		int64_t m_args[2];
+	};
+
+	// Enable recording, each thread keeps the last capacity events
+	void start(const std::string& path, const size_t capacity = 1 << 16);
+	// Write the trace to the path given to start() and stop recording
+	bool stop();
+
+	extern std::atomic<bool> s_isEnabled;
+	inline bool isEnabled() {
+		return s_isEnabled.load(std::memory_order_relaxed);
+	}
+
+	uint64_t now(); // Nanoseconds since start()
+	void record(const Event& event);
+
+	// Event from construction to destruction
+	class ScopedEvent {
+	public:
+		ScopedEvent(const char* name, const char* category,
+			const char* argName0 = nullptr, const int64_t arg0 = 0,
+			const char* argName1 = nullptr, const int64_t arg1 = 0);
+		~ScopedEvent();
+
+		ScopedEvent(const ScopedEvent&) = delete;
+		ScopedEvent& operator=(const ScopedEvent&) = delete;
+
+	private:
+		Event m_event;
+		bool m_isRecording;
+	};
+}
+
+#endif // TRACE_H
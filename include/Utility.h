@@ -3,6 +3,7 @@
 #include <random>
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 
 #include "../external/glm/glm/glm.hpp"
 #include "../external/glm/glm/gtc/constants.hpp"
@@ -38,12 +39,30 @@ namespace {
 			return glm::normalize(rotate(inclVector, azim, n));
 		}
 
-		glm::vec3 CosineWeightedHemisphereSampleDirection(const glm::vec3& n) {
-			// See https://pathtracing.wordpress.com/2011/03/03/cosine-weighted-hemisphere/.
-			// Samples cosine weighted positions.
-			float r1 = rand() / static_cast<float>(RAND_MAX);
-			float r2 = rand() / static_cast<float>(RAND_MAX);
+		void PackRGBE(const glm::vec3& colour, unsigned char rgbe[4]) {
+			// Shared exponent colour, see Ward, Real Pixels (Graphics Gems II)
+			float maxComponent = glm::max(glm::max(colour.r, colour.g), colour.b);
+			if (maxComponent < 1e-32f) {
+				rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+				return;
+			}
+			int exponent;
+			float scale = std::frexp(maxComponent, &exponent) * 256.0f / maxComponent;
+			rgbe[0] = (unsigned char)glm::clamp(colour.r * scale, 0.0f, 255.0f);
+			rgbe[1] = (unsigned char)glm::clamp(colour.g * scale, 0.0f, 255.0f);
+			rgbe[2] = (unsigned char)glm::clamp(colour.b * scale, 0.0f, 255.0f);
+			rgbe[3] = (unsigned char)(exponent + 128);
+		}
 
+		glm::vec3 UnpackRGBE(const unsigned char rgbe[4]) {
+			if (rgbe[3] == 0) return glm::vec3(0.0f);
+			float scale = std::ldexp(1.0f, (int)rgbe[3] - (128 + 8));
+			return glm::vec3(rgbe[0] + 0.5f, rgbe[1] + 0.5f, rgbe[2] + 0.5f) * scale;
+		}
+
+		glm::vec3 CosineWeightedHemisphereSampleDirection(const glm::vec3& n, const float r1, const float r2) {
+			// See https://pathtracing.wordpress.com/2011/03/03/cosine-weighted-hemisphere/.
+			// Samples cosine weighted positions, r1 and r2 are uniform in [0, 1).
 			float theta = acos(sqrt(1.0f - r1));
 			float phi = 2.0f * glm::pi<float>() * r2;
 
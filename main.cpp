@@ -6,75 +6,198 @@
 #include <iostream>
 #include <string>
 #include <cmath>
+#include <future>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
 
 #include "include/Scene.h"
 #include "include/Camera.h"
-
-int main() {
+#include "include/RenderStats.h"
+#include "include/Trace.h"
+#include "include/RenderServer.h"
+
+namespace {
+	std::string formatTime(const double timeElapsed) {
+		int hoursElapsed	= int(timeElapsed) / (60 * 60);
+		int minutesElapsed	= (int(timeElapsed) % (60 * 60)) / 60;
+		int secondsElapsed	= int(timeElapsed) % 60;
+
+		return std::to_string(hoursElapsed)	+ "h:" +
+			std::to_string(minutesElapsed)	+ "m:" +
+			std::to_string(secondsElapsed)	+ "s";
+	}
+
+	// Render stats and trace of the whole run, false if one of them could not be written
+	bool writeReports(const RenderSettings& settings) {
+		if (!settings.m_statsPath.empty()) {
+			if (!RenderStats::writeReport(settings.m_statsPath)) return false;
+			std::cout << "Render stats written to " << settings.m_statsPath << std::endl;
+		}
+
+		if (!settings.m_tracePath.empty()) {
+			if (!Trace::stop()) {
+				std::cout << "Could not write trace " << settings.m_tracePath << std::endl;
+				return false;
+			}
+			std::cout << "Trace written to " << settings.m_tracePath << std::endl;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char* argv[]) {
 	// Timer 
-	time_t startTime, currTime, startRenderTime;
-	time(&startTime);
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
 	std::cout << "Starting the Ray tracer" << std::endl;
 
-	// Variables
-	static const int WIDTH = 400;
-	static const int HEIGHT = 400;
-	const int NR_PHOTON_EMISSION = 1000;
-	const int NR_SUBSAMPLES = 2;
+	// Variables, a scene file given with --scene overrides these
+	RenderSettings settings;
+	settings.m_width = 400;
+	settings.m_height = 400;
+	settings.m_nrPhotonEmission = 1000;
+	settings.m_nrSubsamples = 2;
+	settings.m_nrPasses = 64;	// Only used in progressive mode
+	settings.m_renderMode = Scene::CAUSTICS; // Scene::MONTE_CARLO, Scene::PROGRESSIVE
+	settings.m_irradianceCaching = true;
+
+	std::string sceneFile, checkpointFile, streamFile, statsFile, traceFile, socketFile;
+	bool isServer = false;
+	int heatmap = -1;
+	float timeBudget = 0.0f;
+	RenderSettings shard;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--scene" && i + 1 < argc) sceneFile = argv[++i];
+		else if (arg == "--checkpoint" && i + 1 < argc) checkpointFile = argv[++i];
+		else if (arg == "--stream" && i + 1 < argc) streamFile = argv[++i];
+		else if (arg == "--outofcore") settings.m_outOfCore = true;
+		else if (arg == "--rebuildcache") settings.m_rebuildMeshCache = true;
+		else if (arg == "--stats" && i + 1 < argc) statsFile = argv[++i];
+		else if (arg == "--trace" && i + 1 < argc) traceFile = argv[++i];
+		else if (arg == "--heatmap" && i + 1 < argc && Scene::parseHeatmap(argv[i + 1], heatmap)) ++i;
+		else if (arg == "--budget" && i + 1 < argc && (timeBudget = (float)std::atof(argv[i + 1])) > 0.0f) ++i;
+		else if (arg == "--server") isServer = true;
+		else if (arg == "--socket" && i + 1 < argc) socketFile = argv[++i];
+		else if (arg == "--shard" && i + 4 < argc && Scene::parseShard(argv[i + 1], shard.m_shardMode)) {
+			shard.m_shardIndex = std::atoi(argv[i + 2]);
+			shard.m_nrShards = std::atoi(argv[i + 3]);
+			shard.m_shardPath = argv[i + 4];
+			i += 4;
+		}
+		else {
+			std::cout << "Usage: " << argv[0] << " [--scene file] [--checkpoint file] [--stream file] [--outofcore] [--rebuildcache] [--stats file] [--trace file]"
+				<< " [--heatmap off|nodes|triangles|photons|time] [--server] [--socket file]"
+				<< " [--shard tiles|samples index count file] [--budget seconds]" << std::endl;
+			return 1;
+		}
+	}
+
+	// Tracing from the command line also covers the scene build
+	if (!traceFile.empty()) Trace::start(traceFile);
 
 	// Create scene
-	std::shared_ptr<Scene> scene = Scene::generateScene();
-
-	// Build photon map
-	scene->generatePhotonMap(NR_PHOTON_EMISSION);
-
-	time(&startRenderTime);
-	double prerenderTime = difftime(startRenderTime, startTime);
-
-	// Create camera
-	std::shared_ptr<Camera> camera = std::make_shared<Camera>(
-		glm::vec3(0.0f, 0.0f, 3.2f),	// Eye (position of camera)
-		//glm::vec3(-1.0f, 0.0f, 0.0f),
-		glm::vec3(0.0f),				// Center (position to look at)
-		glm::vec3(0.0f, 1.0f, 0.0f),	// Up vector
-		M_PI / 3,						// Field of view in radians
-		WIDTH,							// Image pixel width,
-		HEIGHT);						// Image pixel height
+	std::shared_ptr<Scene> scene;
+	{
+		RenderStats::ScopedTimer timer(RenderStats::SCENE_BUILD);
+		Trace::ScopedEvent event("scene build", "build");
+		scene = (sceneFile.empty()) ? Scene::generateScene() : Scene::loadScene(sceneFile, settings);
+	}
+	if (!scene) return 1;
+	if (!checkpointFile.empty()) settings.m_checkpointPath = checkpointFile;
+	if (!streamFile.empty()) settings.m_imageStreamPath = streamFile;
+	if (!statsFile.empty()) settings.m_statsPath = statsFile;
+	if (heatmap >= 0) settings.m_heatmap = heatmap;
+	if (timeBudget > 0.0f) settings.m_timeBudget = timeBudget;
+	if (!traceFile.empty()) settings.m_tracePath = traceFile;
+	else if (!settings.m_tracePath.empty()) Trace::start(settings.m_tracePath);
+	if (shard.m_shardMode != Scene::SHARD_NONE) {
+		settings.m_shardMode = shard.m_shardMode;
+		settings.m_shardIndex = shard.m_shardIndex;
+		settings.m_nrShards = shard.m_nrShards;
+		settings.m_shardPath = shard.m_shardPath;
+	}
+
+	// A shard is a part of one radiance image that is added to the other parts
+	bool isShard = settings.m_shardMode != Scene::SHARD_NONE;
+	if (isShard && (settings.m_nrShards <= 0 || settings.m_shardIndex < 0 || settings.m_shardIndex >= settings.m_nrShards)) {
+		std::cout << "Shard " << settings.m_shardIndex << " is not one of " << settings.m_nrShards << " shards" << std::endl;
+		return 1;
+	}
+	if (isShard && (!settings.m_views.empty() || settings.m_heatmap != Scene::HEATMAP_NONE || settings.m_timeBudget > 0.0f ||
+		settings.m_renderMode == Scene::PROGRESSIVE || isServer || !socketFile.empty())) {
+		std::cout << "Shards are only used for a single view in caustics or Monte Carlo mode without a time budget" << std::endl;
+		return 1;
+	}
+
+	// A checkpoint or stream belongs to one image
+	if (!settings.m_views.empty() && (!settings.m_checkpointPath.empty() || !settings.m_imageStreamPath.empty())) {
+		std::cout << "Checkpoints and the image stream are not used when rendering several views" << std::endl;
+		settings.m_checkpointPath.clear();
+		settings.m_imageStreamPath.clear();
+	}
 
 	// Set nr of rays used
-	scene->setNrPhotonEmission(NR_PHOTON_EMISSION);
-	scene->setNrSubsamples(NR_SUBSAMPLES);
+	scene->applySettings(settings);
+
+	// Build photon map (progressive mode emits a new batch of photons every pass)
+	if (settings.m_renderMode != Scene::PROGRESSIVE) {
+		scene->generatePhotonMap(settings.m_nrPhotonEmission);
+	}
+
+	double prerenderTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	// Keep the scene and photon map and render jobs until the input ends, see RenderServer.h
+	if (isServer || !socketFile.empty()) {
+		std::cout << "Prerendering time: " << formatTime(prerenderTime) << std::endl;
+		RenderServer server(scene, settings);
+		if (socketFile.empty()) server.runStandardInput();
+		else if (!server.runSocket(socketFile)) return 1;
+		return (writeReports(settings)) ? 0 : 1;
+	}
+
+	// Create cameras, the views of a batch replace the single camera
+	std::vector<std::shared_ptr<Camera>> cameras;
+	std::vector<std::string> outputPaths;
+	if (settings.m_views.empty()) {
+		cameras.emplace_back(settings.createCamera());
+		outputPaths.emplace_back(settings.m_outputPath);
+	}
+	for (const RenderSettings::View& view : settings.m_views) {
+		cameras.emplace_back(settings.createCamera(view));
+		outputPaths.emplace_back(view.m_outputPath);
+	}
 
 	// Render scene
-	scene->render(camera);
+	if (isShard) std::remove(settings.m_shardPath.c_str());
+	scene->render(cameras);
+
+	// Workers only write their shard, the image is made by merge/merge.cpp
+	if (isShard) {
+		std::ifstream shardFile(settings.m_shardPath);
+		if (!shardFile) return 1;
+		cameras.clear();
+	}
+
+	// Create images while the times are reported
+	std::vector<std::future<bool>> imagesWritten;
+	for (size_t i = 0; i < cameras.size(); ++i) {
+		imagesWritten.emplace_back(cameras[i]->generateImageAsync(outputPaths[i]));
+	}
 
-	time(&currTime);
 	// Time for rendering final image
-	double timeElapsed	= difftime(currTime, startTime);
-	int hoursElapsed	= int(timeElapsed) / (60 * 60);
-	int minutesElapsed	= (int(timeElapsed) % (60 * 60)) / 60;
-	int secondsElapsed	= int(timeElapsed) % 60;
-
-	std::string renderingTime =
-		std::to_string(hoursElapsed)	+ "h:" +
-		std::to_string(minutesElapsed)	+ "m:" +
-		std::to_string(secondsElapsed)	+ "s";
-	std::cout << "Rendering time: " << renderingTime << std::endl;
-
-	///* Time for creation of photon map
-	int preRenderHoursElapsed	= int(prerenderTime) / (60 * 60);
-	int preRenderMinutesElapsed = (int(prerenderTime) % (60 * 60)) / 60;
-	int preRenderSecondsElapsed = int(prerenderTime) % 60;
-
-	std::string prerenderingTime =
-		std::to_string(preRenderHoursElapsed)	+ "h:" +
-		std::to_string(preRenderMinutesElapsed) + "m:" +
-		std::to_string(preRenderSecondsElapsed) + "s";
-	std::cout << "Prerendering time: " << prerenderingTime << std::endl;
-	//*/
-
-	// Create image
-	camera->generateImage();
-
-	return 0;
+	double timeElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	std::cout << "Rendering time: " << formatTime(timeElapsed) << std::endl;
+
+	// Time for creation of photon map
+	std::cout << "Prerendering time: " << formatTime(prerenderTime) << std::endl;
+
+	bool isWritten = true;
+	for (size_t i = 0; i < imagesWritten.size(); ++i) {
+		if (imagesWritten[i].get()) std::cout << "Image written to " << outputPaths[i] << std::endl;
+		else isWritten = false;
+	}
+	if (!isWritten) return 1;
+
+	return (writeReports(settings)) ? 0 : 1;
 }
\ No newline at end of file
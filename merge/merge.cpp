@@ -0,0 +1,82 @@
+// Combines the shards of a render into one image. Every worker renders a
+// shard of the same scene file with --shard and writes the summed samples of
+// its film. The films are added, so every pixel is the average over all the
+// samples it received, and the image is written like a normal render.
+//
+// Usage: merge [--output image] shard...
+//
+// Workers only share the files, a shard can be rendered again if one fails.
+
+// Includes
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/Film.h"
+#include "../include/Checkpoint.h"
+
+int main(int argc, char* argv[]) {
+	std::string outputPath = "data/output/test.ppm";
+	std::vector<std::string> shardPaths;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--output" && i + 1 < argc) outputPath = argv[++i];
+		else if (arg.compare(0, 2, "--") != 0) shardPaths.emplace_back(arg);
+		else {
+			shardPaths.clear();
+			break;
+		}
+	}
+	if (shardPaths.empty()) {
+		std::cout << "Usage: " << argv[0] << " [--output image] shard..." << std::endl;
+		return 1;
+	}
+
+	// The first shard gives the settings all others must match
+	CheckpointState first;
+	if (!Checkpoint::readState(shardPaths[0], first)) {
+		std::cout << "Could not read " << shardPaths[0] << std::endl;
+		return 1;
+	}
+	Film film(first.m_width, first.m_height, first.m_aovs);
+	Film shardFilm(first.m_width, first.m_height, first.m_aovs);
+
+	std::vector<bool> isMerged(first.m_nrShards, false);
+	for (const std::string& path : shardPaths) {
+		CheckpointState state;
+		if (!Checkpoint::read(path, state, shardFilm)) {
+			std::cout << "Could not read " << path << std::endl;
+			return 1;
+		}
+		if (!state.isSameRender(first)) {
+			std::cout << path << " is a shard of another render than " << shardPaths[0] << std::endl;
+			return 1;
+		}
+		if (isMerged[state.m_shardIndex]) {
+			std::cout << path << " is shard " << state.m_shardIndex << " again" << std::endl;
+			return 1;
+		}
+		isMerged[state.m_shardIndex] = true;
+
+		// Sums and sample counts of all channels add up
+		float* data = film.getData();
+		const float* shardData = shardFilm.getData();
+		for (size_t i = 0; i < film.getDataSize(); ++i) data[i] += shardData[i];
+	}
+
+	// A missing shard leaves tiles black or pixels with fewer samples, the image is still written
+	int nrMissing = 0;
+	for (int i = 0; i < first.m_nrShards; ++i) {
+		if (!isMerged[i]) {
+			std::cout << "Shard " << i << " of " << first.m_nrShards << " is missing" << std::endl;
+			nrMissing++;
+		}
+	}
+
+	if (!film.writeImages(outputPath)) {
+		std::cout << "Could not write " << outputPath << std::endl;
+		return 1;
+	}
+	std::cout << "Merged " << first.m_nrShards - nrMissing << " of " << first.m_nrShards << " shards into " << outputPath << std::endl;
+	return (nrMissing > 0) ? 1 : 0;
+}
@@ -0,0 +1,440 @@
+// Performance and image regression runs. A fixed set of scenes is rendered
+// through Scene::render with fixed seeds, thread counts and sample budgets.
+// Wall time, throughput and peak memory are recorded, and the images are
+// compared with references rendered at many more samples per pixel. A run
+// fails if a case is slower than the baseline by more than the tolerance, or
+// if its error at equal time (relMSE times seconds) is higher.
+//
+// Usage: regression [--update] [--directory path] [--output file] [--repeats n]
+//                   [--tolerance fraction] [--error-tolerance fraction] [--verbose]
+//
+// --update renders the references and writes the baseline of this machine,
+// the timings of one machine can not be compared with another. Every render
+// runs in a child process of this program, so that the peak memory of a case
+// does not include the cases and references rendered before it.
+
+// Defines
+#define _USE_MATH_DEFINES // for C++
+
+// Includes
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <omp.h>
+
+#include "../include/Scene.h"
+#include "../include/Camera.h"
+#include "../include/ImageWriter.h"
+#include "../include/RenderStats.h"
+#include "../include/MappedFile.h"
+
+namespace {
+	const uint64_t SEED = 1;			// Same samples in every run
+	const uint64_t REFERENCE_SEED = 2;	// Photon map and samples of the references are independent of the cases
+	const int VERSION = 1;				// Of the JSON report
+	const int REFERENCE_SCALE = 16;		// Samples per pixel of a reference, relative to the case
+
+	struct Case {
+		const char* m_name;
+		const char* m_scenePath;
+		const char* m_meshPath;			// Needed by the scene, the case is skipped without it
+		int m_renderMode;
+		int m_size;						// Width and height in pixels
+		int m_nrSubsamples;
+		int m_nrPhotons;				// Per batch of the photon map
+		int m_nrThreads;
+	};
+
+	// Both tile render paths of Scene::render, the irradiance cache is off so
+	// that the images do not depend on the order of the threads
+	const Case CASES[] = {
+		{ "cornell-caustics", "data/scenes/cornell.scene", "data/meshes/cube.obj", Scene::CAUSTICS, 128, 4, 1000, 4 },
+		{ "cornell-caustics-1t", "data/scenes/cornell.scene", "data/meshes/cube.obj", Scene::CAUSTICS, 64, 2, 1000, 1 },
+		{ "cornell-montecarlo", "data/scenes/cornell.scene", "data/meshes/cube.obj", Scene::MONTE_CARLO, 48, 1, 1000, 4 },
+		{ "suzanne-caustics", "data/scenes/suzanne.scene", "data/meshes/suzanne.obj", Scene::CAUSTICS, 128, 2, 1000, 4 },
+	};
+
+	struct Options {
+		bool m_update = false;
+		bool m_isVerbose = false;
+		int m_nrRepeats = 3;			// The fastest repeat is kept
+		double m_tolerance = 0.1;		// Allowed increase of the wall time
+		double m_errorTolerance = 0.1;	// Allowed increase of relMSE times seconds
+		std::string m_directory = "data/regression";
+		std::string m_outputPath = "data/output/regression.json";
+		std::string m_programPath;		// Started again for every render
+	};
+
+	struct Measurement {
+		double m_seconds = 0.0;			// Photon map and render
+		uint64_t m_nrRays = 0;			// Zero if the counters are compiled out
+		uint64_t m_nrSamples = 0;
+		uint64_t m_peakResidentSize = 0; // Of the child process that rendered the case
+		double m_rmse = 0.0;
+		double m_relMSE = 0.0;
+
+		double getSamplesPerSecond() const { return m_nrSamples / glm::max(m_seconds, 1e-9); }
+		double getRaysPerSecond() const { return m_nrRays / glm::max(m_seconds, 1e-9); }
+		double getErrorTime() const { return m_relMSE * m_seconds; }
+	};
+
+	struct Result {
+		std::string m_name;
+		std::string m_status;			// passed, failed, updated or skipped
+		std::string m_reason;
+		Measurement m_measurement;
+		Measurement m_baseline;
+		bool m_hasBaseline = false;
+	};
+
+	// Discards the progress output of the renderer
+	class NullBuffer : public std::streambuf {
+	protected:
+		int overflow(int c) override { return c; }
+	};
+
+	bool fileExists(const std::string& path) {
+		std::ifstream file(path);
+		return (bool)file;
+	}
+
+	bool readPFM(const std::string& path, Image& image) {
+		std::ifstream file(path, std::ios::binary);
+		std::string magic;
+		float scale;
+		if (!(file >> magic >> image.m_width >> image.m_height >> scale) || magic != "PF" ||
+			image.m_width <= 0 || image.m_height <= 0) return false;
+		file.get(); // Single whitespace before the data
+
+		// The bottom row is stored first, references are written on this machine so the byte order matches
+		size_t rowSize = (size_t)image.m_width * 3;
+		std::vector<float> rows(rowSize * image.m_height);
+		if (!file.read((char*)rows.data(), rows.size() * sizeof(float))) return false;
+		image.m_pixels.resize(rows.size());
+		for (int y = 0; y < image.m_height; ++y) {
+			std::memcpy(&image.m_pixels[y * rowSize], &rows[(image.m_height - 1 - y) * rowSize], rowSize * sizeof(float));
+		}
+		return true;
+	}
+
+	// Root mean squared error and relative mean squared error over all channels
+	bool compareImages(const Image& image, const Image& reference, double& rmse, double& relMSE) {
+		if (image.m_width != reference.m_width || image.m_height != reference.m_height) return false;
+		double squaredError = 0.0, relativeError = 0.0;
+		for (size_t i = 0; i < image.m_pixels.size(); ++i) {
+			double difference = (double)image.m_pixels[i] - reference.m_pixels[i];
+			squaredError += difference * difference;
+			relativeError += difference * difference / ((double)reference.m_pixels[i] * reference.m_pixels[i] + 0.01);
+		}
+		double nrValues = (double)glm::max(image.m_pixels.size(), (size_t)1);
+		rmse = glm::sqrt(squaredError / nrValues);
+		relMSE = relativeError / nrValues;
+		return true;
+	}
+
+	bool render(const Case& regressionCase, const int sampleScale, const uint64_t seed, const Options& options,
+		Image& image, Measurement& measurement) {
+		NullBuffer nullBuffer;
+		std::streambuf* coutBuffer = std::cout.rdbuf();
+		if (!options.m_isVerbose) std::cout.rdbuf(&nullBuffer);
+
+		RenderSettings settings;
+		std::shared_ptr<Scene> scene = Scene::loadScene(regressionCase.m_scenePath, settings);
+		if (scene) {
+			settings.m_width = regressionCase.m_size;
+			settings.m_height = regressionCase.m_size;
+			settings.m_renderMode = regressionCase.m_renderMode;
+			settings.m_nrSubsamples = regressionCase.m_nrSubsamples * sampleScale;
+			settings.m_nrPhotonEmission = regressionCase.m_nrPhotons;
+			settings.m_irradianceCaching = false;
+			settings.m_aovs = Film::AOV_NONE;
+			settings.m_seed = seed;
+			settings.m_checkpointPath.clear();
+			settings.m_imageStreamPath.clear();
+			settings.m_heatmap = Scene::HEATMAP_NONE;
+			scene->applySettings(settings);
+			omp_set_num_threads(regressionCase.m_nrThreads);
+
+			std::shared_ptr<Camera> camera = settings.createCamera();
+			RenderStats::reset();
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			scene->generatePhotonMap(settings.m_nrPhotonEmission);
+			scene->render(camera);
+			measurement.m_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			measurement.m_nrRays = RenderStats::getTotals().m_counters[RenderStats::TRACED_RAYS];
+			measurement.m_nrSamples = (uint64_t)settings.m_width * settings.m_height * settings.m_nrSubsamples;
+			measurement.m_peakResidentSize = MappedFile::getPeakResidentSize();
+			camera->getFilm().resolve(image);
+		}
+
+		std::cout.rdbuf(coutBuffer);
+		return scene != nullptr;
+	}
+
+	// Render in a child process that writes the image and the measurement to temporary files
+	bool renderInChild(const Case& regressionCase, const int sampleScale, const uint64_t seed, const Options& options,
+		Image& image, Measurement& measurement) {
+		std::filesystem::path directory = std::filesystem::temp_directory_path();
+		std::string stem = std::string("regression-") + regressionCase.m_name;
+		std::string imagePath = (directory / (stem + ".pfm")).string();
+		std::string measurementPath = (directory / (stem + ".txt")).string();
+		std::remove(imagePath.c_str());
+		std::remove(measurementPath.c_str());
+
+		std::ostringstream command;
+		command << "\"" << options.m_programPath << "\" --child " << regressionCase.m_name << " " << sampleScale << " "
+			<< seed << " \"" << imagePath << "\" \"" << measurementPath << "\"" << ((options.m_isVerbose) ? " --verbose" : "");
+		std::cout.flush();
+		int status = std::system(command.str().c_str());
+
+		std::ifstream file(measurementPath);
+		bool isRendered = status == 0 && readPFM(imagePath, image) &&
+			(file >> measurement.m_seconds >> measurement.m_nrSamples >> measurement.m_nrRays >> measurement.m_peakResidentSize);
+		file.close();
+		std::remove(imagePath.c_str());
+		std::remove(measurementPath.c_str());
+		return isRendered;
+	}
+
+	// Entry of the child process, see renderInChild
+	int runChild(const std::string& name, const int sampleScale, const uint64_t seed, const std::string& imagePath,
+		const std::string& measurementPath, const Options& options) {
+		for (const Case& regressionCase : CASES) {
+			if (name != regressionCase.m_name) continue;
+			Image image;
+			Measurement measurement;
+			if (!render(regressionCase, sampleScale, seed, options, image, measurement) || !ImageWriter::write(imagePath, image)) return 1;
+			std::ofstream file(measurementPath, std::ios::trunc);
+			file << std::setprecision(17) << measurement.m_seconds << " " << measurement.m_nrSamples << " "
+				<< measurement.m_nrRays << " " << measurement.m_peakResidentSize << "\n";
+			return (file) ? 0 : 1;
+		}
+		return 1;
+	}
+
+	// One line per case: name seconds samples rays peakResidentBytes rmse relMSE
+	std::map<std::string, Measurement> readBaseline(const std::string& path) {
+		std::map<std::string, Measurement> baseline;
+		std::ifstream file(path);
+		std::string text;
+		while (std::getline(file, text)) {
+			if (text.empty() || text[0] == '#') continue;
+			std::istringstream line(text);
+			std::string name;
+			Measurement measurement;
+			if (line >> name >> measurement.m_seconds >> measurement.m_nrSamples >> measurement.m_nrRays >>
+				measurement.m_peakResidentSize >> measurement.m_rmse >> measurement.m_relMSE) {
+				baseline[name] = measurement;
+			}
+		}
+		return baseline;
+	}
+
+	bool writeBaseline(const std::string& path, const std::map<std::string, Measurement>& baseline) {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			std::cout << "Could not write " << path << std::endl;
+			return false;
+		}
+		// Full precision, so that an unchanged image has exactly the same error
+		file << std::setprecision(17);
+		file << "# name seconds samples rays peakResidentBytes rmse relMSE, written by regression --update\n";
+		for (const auto& entry : baseline) {
+			const Measurement& measurement = entry.second;
+			file << entry.first << " " << measurement.m_seconds << " " << measurement.m_nrSamples << " "
+				<< measurement.m_nrRays << " " << measurement.m_peakResidentSize << " "
+				<< measurement.m_rmse << " " << measurement.m_relMSE << "\n";
+		}
+		return (bool)file;
+	}
+
+	void writeMeasurement(std::ostream& file, const Measurement& measurement) {
+		file << "{ \"seconds\": " << measurement.m_seconds
+			<< ", \"raysPerSecond\": " << measurement.getRaysPerSecond()
+			<< ", \"samplesPerSecond\": " << measurement.getSamplesPerSecond()
+			<< ", \"peakResidentBytes\": " << measurement.m_peakResidentSize
+			<< ", \"rmse\": " << measurement.m_rmse
+			<< ", \"relMSE\": " << measurement.m_relMSE << " }";
+	}
+
+	bool writeReport(const std::string& path, const Options& options, const std::vector<Result>& results) {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			std::cout << "Could not write " << path << std::endl;
+			return false;
+		}
+
+		file << std::setprecision(9);
+		file << "{\n";
+		file << "\t\"version\": " << VERSION << ",\n";
+		file << "\t\"seed\": " << SEED << ",\n";
+		file << "\t\"repeats\": " << options.m_nrRepeats << ",\n";
+		file << "\t\"tolerance\": " << options.m_tolerance << ",\n";
+		file << "\t\"errorTolerance\": " << options.m_errorTolerance << ",\n";
+		file << "\t\"results\": [";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const Result& result = results[i];
+			file << ((i == 0) ? "\n" : ",\n");
+			file << "\t\t{ \"case\": \"" << result.m_name << "\", \"status\": \"" << result.m_status
+				<< "\", \"reason\": \"" << result.m_reason << "\", \"measurement\": ";
+			writeMeasurement(file, result.m_measurement);
+			if (result.m_hasBaseline) {
+				file << ", \"baseline\": ";
+				writeMeasurement(file, result.m_baseline);
+			}
+			file << " }";
+		}
+		file << "\n\t]\n}\n";
+		return (bool)file;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	options.m_programPath = argv[0];
+
+	// --child name scale seed image measurement [--verbose], one render for the parent process
+	if (argc >= 7 && std::string(argv[1]) == "--child") {
+		options.m_isVerbose = argc > 7 && std::string(argv[7]) == "--verbose";
+		return runChild(argv[2], std::atoi(argv[3]), std::strtoull(argv[4], nullptr, 10), argv[5], argv[6], options);
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--update") options.m_update = true;
+		else if (arg == "--verbose") options.m_isVerbose = true;
+		else if (arg == "--directory" && i + 1 < argc) options.m_directory = argv[++i];
+		else if (arg == "--output" && i + 1 < argc) options.m_outputPath = argv[++i];
+		else if (arg == "--repeats" && i + 1 < argc) options.m_nrRepeats = glm::max(std::atoi(argv[++i]), 1);
+		else if (arg == "--tolerance" && i + 1 < argc) options.m_tolerance = std::atof(argv[++i]);
+		else if (arg == "--error-tolerance" && i + 1 < argc) options.m_errorTolerance = std::atof(argv[++i]);
+		else {
+			std::cout << "Usage: " << argv[0] << " [--update] [--directory path] [--output file] [--repeats n]"
+				<< " [--tolerance fraction] [--error-tolerance fraction] [--verbose]" << std::endl;
+			return 1;
+		}
+	}
+
+	std::string baselinePath = options.m_directory + "/baseline.txt";
+	if (options.m_update) {
+		std::error_code error;
+		std::filesystem::create_directories(options.m_directory, error);
+	}
+	std::map<std::string, Measurement> baseline = readBaseline(baselinePath);
+	std::vector<Result> results;
+	int nrFailed = 0;
+
+	for (const Case& regressionCase : CASES) {
+		Result result;
+		result.m_name = regressionCase.m_name;
+		std::string referencePath = options.m_directory + "/" + regressionCase.m_name + ".pfm";
+
+		if (!fileExists(regressionCase.m_scenePath) || !fileExists(regressionCase.m_meshPath)) {
+			std::cout << "Skipping " << result.m_name << ", " << regressionCase.m_scenePath << " or "
+				<< regressionCase.m_meshPath << " does not exist" << std::endl;
+			result.m_status = "skipped";
+			result.m_reason = "missing scene";
+			results.emplace_back(result);
+			continue;
+		}
+
+		// References converge much further than the case, so their own noise hardly adds to the error.
+		// Their own seed keeps the photon map noise of the case out of the reference.
+		Image reference;
+		if (options.m_update) {
+			std::cout << "Rendering the reference of " << result.m_name << std::endl;
+			Measurement referenceMeasurement;
+			if (!renderInChild(regressionCase, REFERENCE_SCALE, REFERENCE_SEED, options, reference, referenceMeasurement) ||
+				!ImageWriter::write(referencePath, reference)) {
+				std::cout << "Could not render " << referencePath << std::endl;
+				return 1;
+			}
+		}
+		else if (!readPFM(referencePath, reference)) {
+			std::cout << "Could not read " << referencePath << ", run with --update first" << std::endl;
+			result.m_status = "failed";
+			result.m_reason = "missing reference";
+			results.emplace_back(result);
+			nrFailed++;
+			continue;
+		}
+
+		// The fastest repeat is the least disturbed by the rest of the machine
+		Image image;
+		bool isRendered = true;
+		for (int repeat = 0; repeat < options.m_nrRepeats && isRendered; ++repeat) {
+			Measurement measurement;
+			isRendered = renderInChild(regressionCase, 1, SEED, options, image, measurement);
+			if (repeat == 0 || measurement.m_seconds < result.m_measurement.m_seconds) result.m_measurement = measurement;
+		}
+		Measurement& measurement = result.m_measurement;
+		if (!isRendered || !compareImages(image, reference, measurement.m_rmse, measurement.m_relMSE)) {
+			std::cout << "Could not render " << result.m_name << " at the size of its reference" << std::endl;
+			result.m_status = "failed";
+			result.m_reason = "render";
+			results.emplace_back(result);
+			nrFailed++;
+			continue;
+		}
+
+		std::map<std::string, Measurement>::const_iterator entry = baseline.find(result.m_name);
+		result.m_hasBaseline = !options.m_update && entry != baseline.end();
+		if (options.m_update) {
+			baseline[result.m_name] = measurement;
+			result.m_status = "updated";
+		}
+		else if (!result.m_hasBaseline) {
+			result.m_status = "failed";
+			result.m_reason = "missing baseline";
+		}
+		else {
+			result.m_baseline = entry->second;
+			const Measurement& expected = result.m_baseline;
+			if (measurement.m_seconds > expected.m_seconds * (1.0 + options.m_tolerance)) {
+				result.m_reason = "slower";
+			}
+			else if (measurement.getErrorTime() > expected.getErrorTime() * (1.0 + options.m_errorTolerance)) {
+				result.m_reason = "higher error at equal time";
+			}
+			result.m_status = (result.m_reason.empty()) ? "passed" : "failed";
+		}
+		if (result.m_status == "failed") nrFailed++;
+
+		std::cout << std::left << std::setw(24) << result.m_name << std::setw(8) << result.m_status
+			<< std::right << std::fixed << std::setprecision(3) << std::setw(9) << measurement.m_seconds << " s"
+			<< std::setw(10) << measurement.getRaysPerSecond() / 1e6 << " Mrays/s"
+			<< std::setw(9) << measurement.m_peakResidentSize / (1024.0 * 1024.0) << " MB"
+			<< std::scientific << std::setprecision(3) << "  relMSE " << measurement.m_relMSE
+			<< "  rmse " << measurement.m_rmse << std::defaultfloat;
+		if (result.m_hasBaseline) {
+			std::cout << std::fixed << std::setprecision(1) << "  time "
+				<< 100.0 * (measurement.m_seconds / glm::max(result.m_baseline.m_seconds, 1e-9) - 1.0) << "%"
+				<< std::defaultfloat;
+			if (measurement.m_relMSE != result.m_baseline.m_relMSE) std::cout << "  image changed";
+		}
+		if (!result.m_reason.empty()) std::cout << "  (" << result.m_reason << ")";
+		std::cout << std::endl;
+		results.emplace_back(result);
+	}
+
+	if (options.m_update && !writeBaseline(baselinePath, baseline)) return 1;
+	if (!writeReport(options.m_outputPath, options, results)) return 1;
+	std::cout << "Results written to " << options.m_outputPath << std::endl;
+
+	if (nrFailed > 0) {
+		std::cout << nrFailed << " of " << results.size() << " cases failed" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include "../include/AliasTable.h"
+
+#include <cmath>
+
+/**************** Alias table ****************/
+AliasTable::AliasTable() {}
+
+void AliasTable::build(const std::vector<float>& weights) {
+	int size = (int)weights.size();
+	m_cells.assign(size, Cell{ 1.0f, 0 });
+	m_pdfs.assign(size, 0.0f);
+	if (size == 0) return;
+
+	double totalWeight = 0.0;
+	for (float weight : weights) {
+		if (std::isfinite(weight) && weight > 0.0f) totalWeight += weight;
+	}
+	for (int i = 0; i < size; ++i) {
+		bool isValid = totalWeight > 0.0 && std::isfinite(weights[i]) && weights[i] > 0.0f;
+		m_pdfs[i] = (totalWeight > 0.0) ? ((isValid) ? (float)(weights[i] / totalWeight) : 0.0f) : 1.0f / size;
+	}
+
+	// Cells below the average are filled up by cells above it
+	std::vector<double> scaled(size);
+	std::vector<int> small, large;
+	for (int i = 0; i < size; ++i) {
+		scaled[i] = (double)m_pdfs[i] * size;
+		if (scaled[i] < 1.0) small.emplace_back(i);
+		else large.emplace_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		int less = small.back(), more = large.back();
+		small.pop_back();
+		m_cells[less] = Cell{ (float)scaled[less], more };
+		scaled[more] -= 1.0 - scaled[less];
+		if (scaled[more] < 1.0) {
+			large.pop_back();
+			small.emplace_back(more);
+		}
+	}
+
+	// Cells left over differ from 1 by rounding only
+	for (int i : small) m_cells[i] = Cell{ 1.0f, i };
+	for (int i : large) m_cells[i] = Cell{ 1.0f, i };
+}
+
+int AliasTable::sample(const float u, float& pdf) const {
+	int size = (int)m_cells.size();
+	if (size == 0) {
+		pdf = 0.0f;
+		return -1;
+	}
+	float x = u * size;
+	int cell = (int)x;
+	if (cell >= size) cell = size - 1;
+	if (cell < 0) cell = 0;
+
+	// The fraction of u inside the cell decides between the cell and its alias
+	int index = (x - cell < m_cells[cell].m_threshold) ? cell : m_cells[cell].m_alias;
+	pdf = m_pdfs[index];
+	return index;
+}
+
+float AliasTable::getPdf(const int index) const {
+	return m_pdfs[index];
+}
+
+int AliasTable::getSize() const {
+	return (int)m_cells.size();
+}
+
+bool AliasTable::isEmpty() const {
+	return m_cells.empty();
+}
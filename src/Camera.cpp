@@ -1,19 +1,16 @@
 #include "../include/Camera.h"
 
 Camera::Camera(glm::vec3 eye, glm::vec3 center, glm::vec3 up, float fov,
-	const int pixelWidht, const int pixelHeight // ImageResolution imageResolution)
+	const int pixelWidht, const int pixelHeight, // ImageResolution imageResolution)
+	const int aovs
 ) : m_eye(eye), m_center(center), m_up(up), m_fov(fov), 
-	m_pixelWidth(pixelWidht), m_pixelHeight(pixelHeight) {
+	m_pixelWidth(pixelWidht), m_pixelHeight(pixelHeight), m_film(pixelWidht, pixelHeight, aovs) {
 
 	// View and perspective matrices
 	glm::mat4 V = glm::lookAt(eye, center, up);
 	float aspect = (float)m_pixelWidth / (float)m_pixelHeight;
 	glm::mat4 P = glm::perspective(fov, aspect, 0.1f, 100.0f);
 	m_invVP = glm::inverse(V * P);
-
-	// Setup pixel data
-	m_pixels.resize(m_pixelHeight);
-	for (int i = 0; i < m_pixelHeight; i++) m_pixels[i].resize(m_pixelWidth);
 }
 
 int Camera::getPixelHeight() const {
@@ -24,6 +21,10 @@ int Camera::getPixelWidth() const {
 	return m_pixelWidth;
 }
 
+Film& Camera::getFilm() {
+	return m_film;
+}
+
 std::shared_ptr<Ray> Camera::castCameraRay(const int x, const int y, const float randX, const float randY) {
 	// Check if input is valid
 	if (x < 0 || x > m_pixelWidth - 1 ||
@@ -56,111 +57,32 @@ std::shared_ptr<Ray> Camera::castCameraRay(const int x, const int y, const float
 }
 
 void Camera::setPixelValues(const int x, const int y, const glm::vec3 pixelValue) {
-	// Check that input value is valid
-	if (x < 0 || x >= m_pixelWidth ||
-		y < 0 || y >= m_pixelHeight) return;
-
-	m_pixels[x][y] = pixelValue;
+	m_film.setPixel(x, y, pixelValue);
 }
 
 void Camera::generateImage() {
-	std::cout << "------- Generating image -------" << std::endl;
-	// Create .ppm image from values in m_pixels
-	std::cout << "Writing to PPM..." << std::endl;
-
-	// Check dimension of image
-	if (m_pixelHeight == 0 || m_pixelWidth == 0) {
-		fprintf(stderr, "Can't save an empty image\n");
-		exit(1);
-	}
-
-	FILE* fp;
-	fopen_s(&fp, "data/output/test.ppm", "wb"); // b = binary mode
-	//fopen_s(&fp, path.c_str(), "wb"); // b = binary mode
-	std::cout << "Opened file" << std::endl;
-
-	// Check if file was loaded
-	if (!fp) {
-		fprintf(stderr, "Failed to load ppm-file\n");
-		exit(1);
-	}
-
-	// Write ppm-header
-	std::fprintf(fp, "P6\n%d %d\n255\n", m_pixelWidth, m_pixelHeight);
-
-	// Gamma correction
-	// Write pixel info to ppm-file
-	for (int j = 0; j < m_pixelWidth; j++) {
-		for (int i = 0; i < m_pixelHeight; i++) {
-			glm::vec3 pixel = m_pixels[i][j] * glm::vec3(255.0f);
-
-			std::fputc((int)pixel.r, fp);
-			std::fputc((int)pixel.g, fp);
-			std::fputc((int)pixel.b, fp);
-		}
-	}
-	std::cout << "Finished writing to file" << std::endl;
-
-	// Close file
-	std::fclose(fp);
+	generateImage("data/output/test.ppm");
 }
 
-void Camera::generateImage(const std::string fileName, bool createTGA) {
-	const std::string path = "output/" + path + ".ppm";
-	createPPMImage(path);
-	/*
-	//const std::string path = "output/" + path + ".tga";
-	if (createTGA) {
-		const std::string path = "output/" + path + ".tga";
-		//createTGAImage(path);
-	}
-	else {
-		const std::string path = "output/" + path + ".ppm";
-		createPPMImage(path);
+void Camera::generateImage(const std::string fileName) {
+	std::cout << "------- Generating image -------" << std::endl;
+	for (const std::pair<std::string, Image>& image : m_film.resolveImages(fileName)) {
+		if (!ImageWriter::write(image.first, image.second)) exit(1);
+		std::cout << "Wrote " << image.first << std::endl;
 	}
-	*/
 }
 
-void Camera::createPPMImage(const std::string path) {
-	// Create .ppm image from values in m_pixels
-	std::cout << "Writing to PPM..." << std::endl;
-
-	// Check dimension of image
-	if (m_pixelHeight == 0 || m_pixelWidth == 0) {
-		fprintf(stderr, "Can't save an empty image\n");
-		exit(1);
-	}
-
-	FILE* fp;
-	//fopen_s(&fp, "test.ppm", "wb"); // b = binary mode
-	fopen_s(&fp, path.c_str(), "wb"); // b = binary mode
-	std::cout << "Opened file" << std::endl;
-
-	// Check if file was loaded
-	if (!fp) {
-		fprintf(stderr, "Failed to load ppm-file\n");
-		exit(1);
-	}
-
-	// Write ppm-header
-	std::fprintf(fp, "P6\n%d %d\n255\n", m_pixelWidth, m_pixelHeight);
-
-	// Gamma correction
-	// Write pixel info to ppm-file
-	for (int j = 0; j < m_pixelWidth; j++) {
-		for (int i = 0; i < m_pixelHeight; i++) {
-			glm::vec3 pixel = m_pixels[i][j] * glm::vec3(255.0f);
-
-			std::fputc((int)pixel.r, fp);
-			std::fputc((int)pixel.g, fp);
-			std::fputc((int)pixel.b, fp);
+std::future<bool> Camera::generateImageAsync(const std::string fileName) {
+	std::vector<std::pair<std::string, Image>> images = m_film.resolveImages(fileName);
+	return std::async(std::launch::async, [images = std::move(images)]() {
+		bool isWritten = true;
+		for (const std::pair<std::string, Image>& image : images) {
+			isWritten = ImageWriter::write(image.first, image.second) && isWritten;
 		}
-	}
-	std::cout << "Finished writing to file" << std::endl;
-
-	// Close file
-	std::fclose(fp);
+		return isWritten;
+	});
 }
+
 /*
 void Camera::createTGAImage(const std::string path) {
 	std::cout << "Writing to TGA..." << std::endl;
@@ -184,7 +106,7 @@ void Camera::createTGAImage(const std::string path) {
 	// Write data to image
 	for (int y = 0; y < m_pixelHeight; ++y) {
 		for (int x = 0; x < m_pixelWidth; ++x) {
-			glm::vec3 pixel = m_pixels[x][y] * glm::vec3(255.0f);
+			glm::vec3 pixel = m_film.getPixel(x, y) * glm::vec3(255.0f);
 			auto& cp = pixel;
 			o.put(cp.b);
 			o.put(cp.g);
@@ -0,0 +1,145 @@
+#include "../include/Checkpoint.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+	const char MAGIC[8] = { 'M', 'C', 'R', 'T', 'C', 'K', 'P', '\0' };
+
+	struct Header {
+		char m_magic[8];
+		uint32_t m_version;
+		uint32_t m_visiblePointSize;	// sizeof(VisiblePoint) of the writer
+		CheckpointState m_state;
+		uint64_t m_filmSize;			// Nr of floats
+		uint64_t m_nrVisiblePoints;
+	};
+
+	// Largest film a checkpoint may describe, 16384 x 16384 pixels
+	const int64_t MAX_PIXELS = (int64_t)1 << 28;
+	const int32_t MAX_SHARDS = 1 << 16;
+
+	// Fields that size the film of the reader come from the file, they are checked first
+	bool isValidState(const CheckpointState& state) {
+		return state.m_width > 0 && state.m_height > 0 &&
+			(int64_t)state.m_width * state.m_height <= MAX_PIXELS &&
+			(state.m_aovs & ~(Film::AOV_ALBEDO | Film::AOV_NORMAL | Film::AOV_DEPTH)) == 0 &&
+			state.m_nrShards > 0 && state.m_nrShards <= MAX_SHARDS &&
+			state.m_shardIndex >= 0 && state.m_shardIndex < state.m_nrShards;
+	}
+}
+
+/**************** Checkpoint state ****************/
+bool CheckpointState::isSameRender(const CheckpointState& other) const {
+	return m_seed == other.m_seed &&
+		m_renderMode == other.m_renderMode &&
+		m_width == other.m_width &&
+		m_height == other.m_height &&
+		m_aovs == other.m_aovs &&
+		m_nrPasses == other.m_nrPasses &&
+		m_nrPhotonEmission == other.m_nrPhotonEmission &&
+		m_shardMode == other.m_shardMode &&
+		m_nrShards == other.m_nrShards;
+}
+
+bool CheckpointState::isCompatible(const CheckpointState& other) const {
+	return isSameRender(other) && m_shardIndex == other.m_shardIndex;
+}
+
+/**************** Checkpoint ****************/
+namespace Checkpoint {
+	bool write(const std::string& path, const CheckpointState& state, const Film& film,
+		const std::vector<VisiblePoint>* visiblePoints) {
+		Header header = {};
+		std::memcpy(header.m_magic, MAGIC, sizeof(MAGIC));
+		header.m_version = VERSION;
+		header.m_visiblePointSize = sizeof(VisiblePoint);
+		header.m_state = state;
+		header.m_filmSize = film.getDataSize();
+		header.m_nrVisiblePoints = (visiblePoints) ? visiblePoints->size() : 0;
+
+		std::string tmpPath = path + ".tmp";
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			std::cout << "Could not write checkpoint " << tmpPath << std::endl;
+			return false;
+		}
+		file.write((const char*)&header, sizeof(Header));
+		file.write((const char*)film.getData(), film.getDataSize() * sizeof(float));
+		if (visiblePoints) {
+			file.write((const char*)visiblePoints->data(), visiblePoints->size() * sizeof(VisiblePoint));
+		}
+		file.close();
+		if (!file) {
+			std::cout << "Could not write checkpoint " << tmpPath << std::endl;
+			std::remove(tmpPath.c_str());
+			return false;
+		}
+
+#ifdef _WIN32
+		// rename does not replace existing files on Windows
+		std::remove(path.c_str());
+#endif
+		if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+			std::cout << "Could not rename checkpoint " << tmpPath << " to " << path << std::endl;
+			std::remove(tmpPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	bool read(const std::string& path, CheckpointState& state, Film& film,
+		std::vector<VisiblePoint>* visiblePoints) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return false;
+
+		Header header;
+		if (!file.read((char*)&header, sizeof(Header)) ||
+			std::memcmp(header.m_magic, MAGIC, sizeof(MAGIC)) != 0 ||
+			header.m_version != VERSION ||
+			header.m_visiblePointSize != sizeof(VisiblePoint) ||
+			!isValidState(header.m_state) ||
+			header.m_filmSize != film.getDataSize()) {
+			std::cout << "Checkpoint " << path << " is invalid or from another version" << std::endl;
+			return false;
+		}
+
+		// Progressive checkpoints have one visible point per pixel, others none.
+		// The count is checked before it sizes anything.
+		uint64_t expectedPoints = (visiblePoints) ? (uint64_t)header.m_state.m_width * (uint64_t)header.m_state.m_height : 0;
+		if (header.m_state.m_width < 0 || header.m_state.m_height < 0 || header.m_nrVisiblePoints != expectedPoints) {
+			std::cout << "Checkpoint " << path << " has " << header.m_nrVisiblePoints << " visible points instead of " << expectedPoints << std::endl;
+			return false;
+		}
+
+		std::vector<VisiblePoint> points(header.m_nrVisiblePoints);
+		if (!file.read((char*)film.getData(), film.getDataSize() * sizeof(float)) ||
+			!file.read((char*)points.data(), points.size() * sizeof(VisiblePoint))) {
+			std::cout << "Checkpoint " << path << " is truncated" << std::endl;
+			film.clear();
+			return false;
+		}
+
+		state = header.m_state;
+		if (visiblePoints) *visiblePoints = std::move(points);
+		return true;
+	}
+
+	bool readState(const std::string& path, CheckpointState& state) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return false;
+
+		Header header;
+		if (!file.read((char*)&header, sizeof(Header)) ||
+			std::memcmp(header.m_magic, MAGIC, sizeof(MAGIC)) != 0 ||
+			header.m_version != VERSION ||
+			!isValidState(header.m_state)) {
+			std::cout << "Checkpoint " << path << " is invalid or from another version" << std::endl;
+			return false;
+		}
+		state = header.m_state;
+		return true;
+	}
+}
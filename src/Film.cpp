@@ -0,0 +1,210 @@
+#include "../include/Film.h"
+
+#include <cstring>
+
+/**************** Film buffer ****************/
+FilmBuffer::FilmBuffer(const int width, const int height, const int aovs)
+	: m_width(width), m_height(height), m_aovs(aovs), m_data(nullptr), m_size(0) {
+	// Planes start on a cache line
+	const size_t floatsPerLine = 64 / sizeof(float);
+	size_t nrPixels = (size_t)width * (size_t)height;
+	for (int c = 0; c < NR_CHANNELS; ++c) {
+		m_channelOffsets[c] = m_size;
+		if (hasChannel(c)) {
+			m_size += (nrPixels * getChannelSize(c) + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+		}
+	}
+	m_data.reset(new (std::align_val_t(64)) float[glm::max(m_size, (size_t)1)]);
+	clear();
+}
+
+int FilmBuffer::getWidth() const {
+	return m_width;
+}
+
+int FilmBuffer::getHeight() const {
+	return m_height;
+}
+
+int FilmBuffer::getAOVs() const {
+	return m_aovs;
+}
+
+void FilmBuffer::clear() {
+	std::memset(m_data.get(), 0, m_size * sizeof(float));
+}
+
+float* FilmBuffer::getData() {
+	return m_data.get();
+}
+
+const float* FilmBuffer::getData() const {
+	return m_data.get();
+}
+
+size_t FilmBuffer::getDataSize() const {
+	return m_size;
+}
+
+float* FilmBuffer::getChannel(const int c) {
+	return m_data.get() + m_channelOffsets[c];
+}
+
+const float* FilmBuffer::getChannel(const int c) const {
+	return m_data.get() + m_channelOffsets[c];
+}
+
+bool FilmBuffer::hasChannel(const int c) const {
+	switch (c) {
+	case ALBEDO:	return (m_aovs & AOV_ALBEDO) != 0;
+	case NORMAL:	return (m_aovs & AOV_NORMAL) != 0;
+	case DEPTH:		return (m_aovs & AOV_DEPTH) != 0;
+	default:		return true;
+	}
+}
+
+int FilmBuffer::getChannelSize(const int c) {
+	return (c == COUNT || c == DEPTH) ? 1 : 3;
+}
+
+void FilmBuffer::addSample(const int i, const FilmSample& sample) {
+	float* sum = getChannel(SUM) + 3 * i;
+	sum[0] += sample.m_radiance.r;
+	sum[1] += sample.m_radiance.g;
+	sum[2] += sample.m_radiance.b;
+	getChannel(COUNT)[i] += 1.0f;
+
+	if (m_aovs & AOV_ALBEDO) {
+		float* albedo = getChannel(ALBEDO) + 3 * i;
+		albedo[0] += sample.m_albedo.r;
+		albedo[1] += sample.m_albedo.g;
+		albedo[2] += sample.m_albedo.b;
+	}
+	if (m_aovs & AOV_NORMAL) {
+		float* normal = getChannel(NORMAL) + 3 * i;
+		normal[0] += sample.m_normal.x;
+		normal[1] += sample.m_normal.y;
+		normal[2] += sample.m_normal.z;
+	}
+	if (m_aovs & AOV_DEPTH) {
+		getChannel(DEPTH)[i] += sample.m_depth;
+	}
+}
+
+/**************** Film tile ****************/
+FilmTile::FilmTile(const int tileX, const int tileY, const int width, const int height, const int aovs)
+	: FilmBuffer(width, height, aovs), m_tileX(tileX), m_tileY(tileY) {}
+
+void FilmTile::addSample(const int x, const int y, const FilmSample& sample) {
+	FilmBuffer::addSample((y - m_tileY) * m_width + (x - m_tileX), sample);
+}
+
+/**************** Film ****************/
+Film::Film(const int width, const int height, const int aovs)
+	: FilmBuffer(width, height, aovs) {}
+
+FilmTile Film::createTile(const int tileX, const int tileY, const int tileWidth, const int tileHeight) const {
+	return FilmTile(tileX, tileY, tileWidth, tileHeight, m_aovs);
+}
+
+void Film::mergeTile(const FilmTile& tile) {
+	for (int c = 0; c < NR_CHANNELS; ++c) {
+		if (!hasChannel(c)) continue;
+		int size = getChannelSize(c);
+		for (int y = 0; y < tile.m_height; ++y) {
+			// One row of a tile is contiguous in both buffers
+			const float* src = tile.getChannel(c) + (size_t)y * tile.m_width * size;
+			float* dst = getChannel(c) + ((size_t)(tile.m_tileY + y) * m_width + tile.m_tileX) * size;
+			for (int i = 0; i < tile.m_width * size; ++i) {
+				dst[i] += src[i];
+			}
+		}
+	}
+}
+
+void Film::setPixel(const int x, const int y, const glm::vec3 value) {
+	// Check that input value is valid
+	if (x < 0 || x >= m_width || y < 0 || y >= m_height) return;
+
+	int i = y * m_width + x;
+	float* sum = getChannel(SUM) + 3 * i;
+	sum[0] = value.r;
+	sum[1] = value.g;
+	sum[2] = value.b;
+	getChannel(COUNT)[i] = 1.0f;
+}
+
+glm::vec3 Film::getPixel(const int x, const int y) const {
+	return getAverage(SUM, x, y);
+}
+
+glm::vec3 Film::getAlbedo(const int x, const int y) const {
+	return (m_aovs & AOV_ALBEDO) ? getAverage(ALBEDO, x, y) : glm::vec3(0.0f);
+}
+
+glm::vec3 Film::getNormal(const int x, const int y) const {
+	return (m_aovs & AOV_NORMAL) ? getAverage(NORMAL, x, y) : glm::vec3(0.0f);
+}
+
+float Film::getDepth(const int x, const int y) const {
+	float count = getSampleCount(x, y);
+	return (m_aovs & AOV_DEPTH && count > 0.0f) ? getChannel(DEPTH)[y * m_width + x] / count : 0.0f;
+}
+
+float Film::getSampleCount(const int x, const int y) const {
+	return getChannel(COUNT)[y * m_width + x];
+}
+
+void Film::resolve(Image& image, const int aov) const {
+	int c = (aov == AOV_ALBEDO) ? ALBEDO : (aov == AOV_NORMAL) ? NORMAL : (aov == AOV_DEPTH) ? DEPTH : SUM;
+	image.m_width = m_width;
+	image.m_height = m_height;
+	image.m_pixels.assign((size_t)m_width * m_height * 3, 0.0f);
+	if (!hasChannel(c)) return;
+
+	const int nrPixels = m_width * m_height;
+	const int size = getChannelSize(c);
+	const float* value = getChannel(c);
+	const float* count = getChannel(COUNT);
+	float* pixels = image.m_pixels.data();
+
+	#pragma omp simd
+	for (int i = 0; i < nrPixels; ++i) {
+		float invCount = (count[i] > 0.0f) ? 1.0f / count[i] : 0.0f;
+		pixels[3 * i + 0] = value[size * i + 0] * invCount;
+		pixels[3 * i + 1] = value[size * i + (size - 1) / 2] * invCount;
+		pixels[3 * i + 2] = value[size * i + (size - 1)] * invCount;
+	}
+}
+
+glm::vec3 Film::getAverage(const int c, const int x, const int y) const {
+	float count = getSampleCount(x, y);
+	if (count <= 0.0f) return glm::vec3(0.0f);
+	const float* value = getChannel(c) + 3 * (y * m_width + x);
+	return glm::vec3(value[0], value[1], value[2]) / count;
+}
+
+std::vector<std::pair<std::string, Image>> Film::resolveImages(const std::string& fileName) const {
+	std::vector<std::pair<std::string, Image>> images(1);
+	images[0].first = fileName;
+	resolve(images[0].second);
+
+	// AOVs are stored as floats
+	std::string baseName = fileName.substr(0, fileName.find_last_of('.'));
+	const std::pair<int, const char*> aovs[] = {
+		{ AOV_ALBEDO, "_albedo.pfm" }, { AOV_NORMAL, "_normal.pfm" }, { AOV_DEPTH, "_depth.pfm" } };
+	for (const std::pair<int, const char*>& aov : aovs) {
+		if (!(getAOVs() & aov.first)) continue;
+		images.emplace_back(baseName + aov.second, Image());
+		resolve(images.back().second, aov.first);
+	}
+	return images;
+}
+
+bool Film::writeImages(const std::string& fileName) const {
+	bool isWritten = true;
+	for (const std::pair<std::string, Image>& image : resolveImages(fileName)) {
+		isWritten = ImageWriter::write(image.first, image.second) && isWritten;
+	}
+	return isWritten;
+}
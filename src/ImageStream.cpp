@@ -0,0 +1,122 @@
+#include "../include/ImageStream.h"
+
+#include <iostream>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+namespace {
+	const char MAGIC[8] = { 'M', 'C', 'R', 'T', 'I', 'M', 'G', '\0' };
+	const size_t HEADER_SIZE = 64; // Pixels start on their own cache line
+	const int MAX_READ_ATTEMPTS = 1000;
+
+	static_assert(sizeof(ImageStreamHeader) <= HEADER_SIZE, "Image stream header does not fit");
+	static_assert(std::is_standard_layout<ImageStreamHeader>::value, "Image stream header is read by other processes");
+
+	size_t getFileSize(const int width, const int height) {
+		return HEADER_SIZE + (size_t)width * height * 3 * sizeof(float);
+	}
+}
+
+/**************** Image stream ****************/
+ImageStream::ImageStream(const std::string& path, const int width, const int height, const int nrPasses)
+	: m_file(path, getFileSize(width, height)), m_header(nullptr), m_pixels(nullptr) {
+	if (!m_file.isOpen()) {
+		std::cout << "Could not create image stream " << path << std::endl;
+		return;
+	}
+
+	// A new file is zero filled, so the image starts black at generation 0
+	char* data = m_file.getWritableData();
+	m_header = new (data) ImageStreamHeader();
+	m_pixels = (float*)(data + HEADER_SIZE);
+	std::memcpy(m_header->m_magic, MAGIC, sizeof(MAGIC));
+	m_header->m_version = VERSION;
+	m_header->m_headerSize = (uint32_t)HEADER_SIZE;
+	m_header->m_width = width;
+	m_header->m_height = height;
+	m_header->m_nrCompletedPasses = 0;
+	m_header->m_nrPasses = nrPasses;
+	m_header->m_isFinished = 0;
+	m_header->m_nrWriters.store(0, std::memory_order_relaxed);
+	m_header->m_generation.store(0, std::memory_order_release);
+}
+
+bool ImageStream::isOpen() const {
+	return m_header != nullptr;
+}
+
+void ImageStream::publishRegion(const Film& film, const int x, const int y, const int width, const int height) {
+	if (!m_header) return;
+
+	beginWrite();
+	for (int j = y; j < y + height; ++j) {
+		float* row = m_pixels + ((size_t)j * m_header->m_width + x) * 3;
+		for (int i = 0; i < width; ++i) {
+			glm::vec3 colour = film.getPixel(x + i, j);
+			row[3 * i + 0] = colour.r;
+			row[3 * i + 1] = colour.g;
+			row[3 * i + 2] = colour.b;
+		}
+	}
+	endWrite();
+}
+
+void ImageStream::publish(const Film& film) {
+	if (m_header) publishRegion(film, 0, 0, m_header->m_width, m_header->m_height);
+}
+
+void ImageStream::setProgress(const int nrCompletedPasses, const bool isFinished) {
+	if (!m_header) return;
+	beginWrite();
+	m_header->m_nrCompletedPasses = nrCompletedPasses;
+	m_header->m_isFinished = (isFinished) ? 1 : 0;
+	endWrite();
+}
+
+void ImageStream::beginWrite() {
+	// Readers that see no writers copy nothing this writer changes
+	m_header->m_nrWriters.fetch_add(1);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ImageStream::endWrite() {
+	m_header->m_generation.fetch_add(1, std::memory_order_release);
+	m_header->m_nrWriters.fetch_sub(1, std::memory_order_release);
+}
+
+bool ImageStream::read(const std::string& path, Image& image, ImageStreamState& state) {
+	MappedFile file(path);
+	if (!file.isOpen() || file.getSize() < HEADER_SIZE) return false;
+
+	// The file is written by another process, check everything that sizes the copy
+	const ImageStreamHeader* header = (const ImageStreamHeader*)file.getData();
+	if (std::memcmp(header->m_magic, MAGIC, sizeof(MAGIC)) != 0 || header->m_version != VERSION ||
+		header->m_headerSize != HEADER_SIZE || header->m_width <= 0 || header->m_height <= 0 ||
+		(uint64_t)header->m_width * (uint64_t)header->m_height > (file.getSize() - HEADER_SIZE) / (3 * sizeof(float))) return false;
+
+	image.m_width = header->m_width;
+	image.m_height = header->m_height;
+	image.m_pixels.resize((size_t)image.m_width * image.m_height * 3);
+
+	// Sequence lock: the copy is complete if no writer was active and the generation is the same after it
+	for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+		uint64_t generation = header->m_generation.load(std::memory_order_acquire);
+		if (header->m_nrWriters.load(std::memory_order_acquire) != 0) {
+			std::this_thread::yield();
+			continue;
+		}
+		std::memcpy(image.m_pixels.data(), file.getData() + HEADER_SIZE, image.m_pixels.size() * sizeof(float));
+		state.m_nrCompletedPasses = header->m_nrCompletedPasses;
+		state.m_nrPasses = header->m_nrPasses;
+		state.m_isFinished = header->m_isFinished != 0;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (header->m_nrWriters.load(std::memory_order_relaxed) == 0 &&
+			header->m_generation.load(std::memory_order_relaxed) == generation) {
+			state.m_generation = generation;
+			return true;
+		}
+	}
+	return false;
+}
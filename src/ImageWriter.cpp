@@ -0,0 +1,110 @@
+#include "../include/ImageWriter.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+
+#include "../include/Utility.h"
+#include "../include/RenderStats.h"
+#include "../include/Trace.h"
+
+namespace {
+	bool hasExtension(const std::string& path, const std::string& extension) {
+		return path.size() >= extension.size() &&
+			path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+	}
+
+	bool writeFile(const std::string& path, const std::string& header, const char* data, const size_t size) {
+		// Header and pixels are written as one block
+		std::vector<char> buffer(header.size() + size);
+		std::memcpy(buffer.data(), header.data(), header.size());
+		std::memcpy(buffer.data() + header.size(), data, size);
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			std::cout << "Could not open " << path << " for writing" << std::endl;
+			return false;
+		}
+		file.write(buffer.data(), buffer.size());
+		file.close();
+		if (!file) {
+			std::cout << "Could not write " << path << std::endl;
+			return false;
+		}
+		return true;
+	}
+}
+
+/**************** Image writer ****************/
+namespace ImageWriter {
+	bool write(const std::string& path, const Image& image, const float exposure, const float gamma) {
+		RenderStats::ScopedTimer timer(RenderStats::IMAGE_WRITE);
+		Trace::ScopedEvent event("image write", "io");
+		if (image.m_width <= 0 || image.m_height <= 0) {
+			std::cout << "Can't save an empty image" << std::endl;
+			return false;
+		}
+
+		if (hasExtension(path, ".pfm")) return writePFM(path, image);
+		else if (hasExtension(path, ".hdr")) return writeHDR(path, image);
+		else return writePPM(path, image, exposure, gamma);
+	}
+
+	std::future<bool> writeAsync(const std::string& path, Image image, const float exposure, const float gamma) {
+		return std::async(std::launch::async, [path, image = std::move(image), exposure, gamma]() {
+			return write(path, image, exposure, gamma);
+		});
+	}
+
+	bool writePPM(const std::string& path, const Image& image, const float exposure, const float gamma) {
+		std::vector<unsigned char> bytes;
+		toneMap(image, bytes, exposure, gamma);
+
+		std::string header = "P6\n" + std::to_string(image.m_width) + " " + std::to_string(image.m_height) + "\n255\n";
+		return writeFile(path, header, (const char*)bytes.data(), bytes.size());
+	}
+
+	bool writePFM(const std::string& path, const Image& image) {
+		// PFM stores the bottom row first, a negative scale means little endian
+		size_t rowSize = (size_t)image.m_width * 3;
+		std::vector<float> rows(image.m_pixels.size());
+		for (int y = 0; y < image.m_height; ++y) {
+			std::memcpy(&rows[(image.m_height - 1 - y) * rowSize], &image.m_pixels[y * rowSize], rowSize * sizeof(float));
+		}
+
+		const uint16_t endianTest = 1;
+		bool isLittleEndian = *(const unsigned char*)&endianTest == 1;
+		std::string header = "PF\n" + std::to_string(image.m_width) + " " + std::to_string(image.m_height) +
+			(isLittleEndian ? "\n-1.0\n" : "\n1.0\n");
+		return writeFile(path, header, (const char*)rows.data(), rows.size() * sizeof(float));
+	}
+
+	bool writeHDR(const std::string& path, const Image& image) {
+		// Radiance RGBE without run length encoding
+		size_t nrPixels = (size_t)image.m_width * image.m_height;
+		std::vector<unsigned char> rgbe(nrPixels * 4);
+		for (size_t i = 0; i < nrPixels; ++i) {
+			glm::vec3 colour = glm::max(glm::vec3(image.m_pixels[3 * i + 0], image.m_pixels[3 * i + 1], image.m_pixels[3 * i + 2]), glm::vec3(0.0f));
+			Utility::PackRGBE(colour, &rgbe[4 * i]);
+		}
+
+		std::string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " +
+			std::to_string(image.m_height) + " +X " + std::to_string(image.m_width) + "\n";
+		return writeFile(path, header, (const char*)rgbe.data(), rgbe.size());
+	}
+
+	void toneMap(const Image& image, std::vector<unsigned char>& bytes, const float exposure, const float gamma) {
+		const int size = (int)image.m_pixels.size();
+		const float* pixels = image.m_pixels.data();
+		const float invGamma = 1.0f / gamma;
+		bytes.resize(size);
+		unsigned char* out = bytes.data();
+
+		#pragma omp simd
+		for (int i = 0; i < size; ++i) {
+			float value = glm::clamp(pixels[i] * exposure, 0.0f, 1.0f);
+			out[i] = (unsigned char)(std::pow(value, invGamma) * 255.0f + 0.5f);
+		}
+	}
+}
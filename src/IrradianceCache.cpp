@@ -0,0 +1,116 @@
+#include "../include/IrradianceCache.h"
+
+#include <mutex>
+
+/**************** Irradiance cache ****************/
+IrradianceCache::IrradianceCache(const float accuracy)
+	: m_accuracy(accuracy), m_nrRecords(0), m_root(nullptr) {}
+
+bool IrradianceCache::interpolate(const glm::vec3 position, const glm::vec3 normal, glm::vec3& irradiance) const {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	if (!m_root) return false;
+
+	glm::vec3 irradianceSum = glm::vec3(0.0f);
+	float weightSum = 0.0f;
+	interpolate(m_root.get(), position, normal, irradianceSum, weightSum);
+
+	if (weightSum <= 0.0f) return false;
+	irradiance = glm::max(irradianceSum / weightSum, glm::vec3(0.0f));
+	return true;
+}
+
+void IrradianceCache::insert(const IrradianceRecord& record) {
+	std::unique_lock<std::shared_mutex> lock(m_mutex);
+	float validRadius = m_accuracy * record.m_harmonicDistance;
+
+	if (!m_root) {
+		m_root = std::make_unique<Node>();
+		m_root->m_center = record.m_position;
+		m_root->m_halfSize = glm::max(4.0f * validRadius, 1.0f);
+	}
+	growRoot(record.m_position);
+
+	// Store the record in the smallest node that is still larger than its validity radius
+	Node* node = m_root.get();
+	while (node->m_halfSize * 0.5f >= validRadius) {
+		int i = childIndex(node, record.m_position);
+		if (!node->m_children[i]) {
+			float childHalfSize = node->m_halfSize * 0.5f;
+			node->m_children[i] = std::make_unique<Node>();
+			node->m_children[i]->m_halfSize = childHalfSize;
+			node->m_children[i]->m_center = node->m_center + glm::vec3(
+				(i & 1) ? childHalfSize : -childHalfSize,
+				(i & 2) ? childHalfSize : -childHalfSize,
+				(i & 4) ? childHalfSize : -childHalfSize);
+		}
+		node = node->m_children[i].get();
+	}
+	node->m_records.emplace_back(record);
+	m_nrRecords++;
+}
+
+float IrradianceCache::getAccuracy() const {
+	return m_accuracy;
+}
+
+size_t IrradianceCache::getNrRecords() const {
+	std::shared_lock<std::shared_mutex> lock(m_mutex);
+	return m_nrRecords;
+}
+
+void IrradianceCache::growRoot(const glm::vec3 position) {
+	// Double the root towards the position until it is contained
+	while (glm::any(glm::greaterThan(glm::abs(position - m_root->m_center), glm::vec3(m_root->m_halfSize)))) {
+		float halfSize = m_root->m_halfSize;
+		glm::vec3 direction = glm::vec3(
+			(position.x < m_root->m_center.x) ? -1.0f : 1.0f,
+			(position.y < m_root->m_center.y) ? -1.0f : 1.0f,
+			(position.z < m_root->m_center.z) ? -1.0f : 1.0f);
+
+		std::unique_ptr<Node> newRoot = std::make_unique<Node>();
+		newRoot->m_center = m_root->m_center + direction * halfSize;
+		newRoot->m_halfSize = 2.0f * halfSize;
+
+		int i = childIndex(newRoot.get(), m_root->m_center);
+		newRoot->m_children[i] = std::move(m_root);
+		m_root = std::move(newRoot);
+	}
+}
+
+void IrradianceCache::interpolate(const Node* node, const glm::vec3 position, const glm::vec3 normal,
+	glm::vec3& irradianceSum, float& weightSum) const {
+	// Records have a validity radius smaller than the node they are stored in
+	if (glm::any(glm::greaterThan(glm::abs(position - node->m_center), glm::vec3(2.0f * node->m_halfSize)))) return;
+
+	for (const IrradianceRecord& record : node->m_records) {
+		glm::vec3 offset = position - record.m_position;
+
+		// Skip records in front of the point
+		float depth = glm::dot(offset, 0.5f * (normal + record.m_normal));
+		if (depth < -0.01f * record.m_harmonicDistance) continue;
+
+		float weight = 1.0f / (glm::length(offset) / record.m_harmonicDistance +
+			glm::sqrt(glm::max(0.0f, 1.0f - glm::dot(normal, record.m_normal))) + 1e-6f);
+		if (weight <= 1.0f / m_accuracy) continue;
+
+		// First order extrapolation with the rotational and translational gradients
+		glm::vec3 rotation = glm::cross(record.m_normal, normal);
+		glm::vec3 irradiance = record.m_irradiance + glm::vec3(
+			glm::dot(rotation, record.m_rotGradient[0]) + glm::dot(offset, record.m_transGradient[0]),
+			glm::dot(rotation, record.m_rotGradient[1]) + glm::dot(offset, record.m_transGradient[1]),
+			glm::dot(rotation, record.m_rotGradient[2]) + glm::dot(offset, record.m_transGradient[2]));
+
+		irradianceSum += weight * irradiance;
+		weightSum += weight;
+	}
+
+	for (const std::unique_ptr<Node>& child : node->m_children) {
+		if (child) interpolate(child.get(), position, normal, irradianceSum, weightSum);
+	}
+}
+
+int IrradianceCache::childIndex(const Node* node, const glm::vec3 position) {
+	return ((position.x >= node->m_center.x) ? 1 : 0) |
+		((position.y >= node->m_center.y) ? 2 : 0) |
+		((position.z >= node->m_center.z) ? 4 : 0);
+}
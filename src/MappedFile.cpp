@@ -0,0 +1,123 @@
+#include "../include/MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#endif
+
+/**************** Mapped file ****************/
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path)
+	: m_data(nullptr), m_isWritable(false), m_size(0), m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr) {
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) return;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) return;
+	m_size = (size_t)size.QuadPart;
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping) return;
+	m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+}
+
+MappedFile::MappedFile(const std::string& path, const size_t size)
+	: m_data(nullptr), m_isWritable(true), m_size(size), m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr) {
+	m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE || size == 0) return;
+
+	// The mapping extends the file to its size
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)(size & 0xFFFFFFFF), nullptr);
+	if (!m_mapping) return;
+	m_data = (const char*)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, 0);
+}
+
+MappedFile::~MappedFile() {
+	if (m_data) UnmapViewOfFile(m_data);
+	if (m_mapping) CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+}
+
+uint64_t MappedFile::getPageFaultCount() {
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PageFaultCount;
+}
+
+uint64_t MappedFile::getPeakResidentSize() {
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+}
+#else
+MappedFile::MappedFile(const std::string& path)
+	: m_data(nullptr), m_isWritable(false), m_size(0), m_fileDescriptor(-1) {
+	m_fileDescriptor = open(path.c_str(), O_RDONLY);
+	if (m_fileDescriptor < 0) return;
+
+	struct stat fileStatus;
+	if (fstat(m_fileDescriptor, &fileStatus) != 0 || fileStatus.st_size == 0) return;
+	m_size = (size_t)fileStatus.st_size;
+
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fileDescriptor, 0);
+	if (data == MAP_FAILED) return;
+	m_data = (const char*)data;
+}
+
+MappedFile::MappedFile(const std::string& path, const size_t size)
+	: m_data(nullptr), m_isWritable(true), m_size(size), m_fileDescriptor(-1) {
+	m_fileDescriptor = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_fileDescriptor < 0 || size == 0) return;
+	if (ftruncate(m_fileDescriptor, (off_t)size) != 0) return;
+
+	void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fileDescriptor, 0);
+	if (data == MAP_FAILED) return;
+	m_data = (const char*)data;
+}
+
+MappedFile::~MappedFile() {
+	if (m_data) munmap((void*)m_data, m_size);
+	if (m_fileDescriptor >= 0) close(m_fileDescriptor);
+}
+
+uint64_t MappedFile::getPageFaultCount() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return (uint64_t)usage.ru_majflt;
+}
+
+uint64_t MappedFile::getPeakResidentSize() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return (uint64_t)usage.ru_maxrss;
+#else
+	return (uint64_t)usage.ru_maxrss * 1024; // Kilobytes
+#endif
+}
+#endif
+
+bool MappedFile::isOpen() const {
+	return m_data != nullptr;
+}
+
+const char* MappedFile::getData() const {
+	return m_data;
+}
+
+char* MappedFile::getWritableData() const {
+	return (m_isWritable) ? (char*)m_data : nullptr;
+}
+
+size_t MappedFile::getSize() const {
+	return m_size;
+}
@@ -0,0 +1,240 @@
+#include "../include/MeshCache.h"
+
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <random>
+#include <iostream>
+
+namespace {
+	const char MAGIC[8] = { 'M', 'C', 'R', 'T', 'M', 'S', 'H', '\0' };
+
+	size_t alignOffset(const size_t offset, const size_t alignment) {
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+}
+
+/**************** Mesh cache ****************/
+MeshCache::MeshCache(const std::string& path, const std::string& sourcePath, const glm::mat4& transform, const float weldEpsilon)
+	: m_file(nullptr), m_header(nullptr) {
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	if (!getSourceStamp(sourcePath, sourceSize, sourceTime)) return;
+
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+	if (!file->isOpen() || file->getSize() < sizeof(Header)) return;
+
+	const Header* header = (const Header*)file->getData();
+	if (std::memcmp(header->m_magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		header->m_version != VERSION ||
+		header->m_nodeSize != sizeof(OctreeNodeAABB) ||
+		std::memcmp(header->m_transform, &transform[0][0], sizeof(header->m_transform)) != 0 ||
+		header->m_weldEpsilon != weldEpsilon) return;
+
+	// Check that all sections are inside the file
+	const size_t elementSizes[NR_SECTIONS] = {
+		sizeof(glm::vec3), sizeof(glm::vec3), sizeof(glm::vec2),
+		sizeof(unsigned int), sizeof(OctreeNodeAABB), sizeof(unsigned int) };
+	for (int s = 0; s < NR_SECTIONS; ++s) {
+		if (header->m_offsets[s] % SECTION_ALIGNMENT != 0 || header->m_offsets[s] > file->getSize() ||
+			header->m_counts[s] > (file->getSize() - header->m_offsets[s]) / elementSizes[s]) return;
+	}
+	if (header->m_counts[NORMALS] != header->m_counts[VERTICES] ||
+		header->m_counts[UVS] != header->m_counts[VERTICES] ||
+		header->m_counts[NODES] == 0) return;
+
+	// A touched or copied source with the same content keeps the cache, the
+	// new stamp is stored so the next load does not hash the source again
+	if (header->m_sourceSize != sourceSize || header->m_sourceTime != sourceTime) {
+		if (header->m_sourceSize != sourceSize || header->m_sourceHash != hashFile(sourcePath)) return;
+		std::fstream stampFile(path, std::ios::binary | std::ios::in | std::ios::out);
+		stampFile.seekp(offsetof(Header, m_sourceTime));
+		stampFile.write((const char*)&sourceTime, sizeof(sourceTime));
+	}
+
+	m_file = file;
+	m_header = header;
+	if (!hasValidIndices()) {
+		std::cout << "Mesh cache " << path << " has indices outside of its sections" << std::endl;
+		m_file = nullptr;
+		m_header = nullptr;
+	}
+}
+
+bool MeshCache::isValid() const {
+	return m_header != nullptr;
+}
+
+SharedBuffer<glm::vec3> MeshCache::getVertices() const {
+	return getSection<glm::vec3>(VERTICES);
+}
+
+SharedBuffer<glm::vec3> MeshCache::getNormals() const {
+	return getSection<glm::vec3>(NORMALS);
+}
+
+SharedBuffer<glm::vec2> MeshCache::getUvs() const {
+	return getSection<glm::vec2>(UVS);
+}
+
+SharedBuffer<unsigned int> MeshCache::getIndices() const {
+	return getSection<unsigned int>(INDICES);
+}
+
+SharedBuffer<OctreeNodeAABB> MeshCache::getNodes() const {
+	return getSection<OctreeNodeAABB>(NODES);
+}
+
+SharedBuffer<unsigned int> MeshCache::getTriangleIndices() const {
+	return getSection<unsigned int>(TRIANGLE_INDICES);
+}
+
+bool MeshCache::write(const std::string& path, const std::string& sourcePath, const glm::mat4& transform, const float weldEpsilon,
+	const SharedBuffer<glm::vec3>& vertices,
+	const SharedBuffer<glm::vec3>& normals,
+	const SharedBuffer<glm::vec2>& uvs,
+	const SharedBuffer<unsigned int>& indices,
+	const SharedBuffer<OctreeNodeAABB>& nodes,
+	const SharedBuffer<unsigned int>& triangleIndices) {
+	Header header = {};
+	std::memcpy(header.m_magic, MAGIC, sizeof(MAGIC));
+	header.m_version = VERSION;
+	header.m_nodeSize = sizeof(OctreeNodeAABB);
+	// The stamp is taken first, a source changed while hashing is hashed again on the next load
+	if (!getSourceStamp(sourcePath, header.m_sourceSize, header.m_sourceTime)) return false;
+	header.m_sourceHash = hashFile(sourcePath);
+	if (header.m_sourceHash == 0) return false;
+	std::memcpy(header.m_transform, &transform[0][0], sizeof(header.m_transform));
+	header.m_weldEpsilon = weldEpsilon;
+
+	const char* data[NR_SECTIONS] = {
+		(const char*)vertices.data(), (const char*)normals.data(), (const char*)uvs.data(),
+		(const char*)indices.data(), (const char*)nodes.data(), (const char*)triangleIndices.data() };
+	const size_t sizes[NR_SECTIONS] = {
+		vertices.size() * sizeof(glm::vec3), normals.size() * sizeof(glm::vec3), uvs.size() * sizeof(glm::vec2),
+		indices.size() * sizeof(unsigned int), nodes.size() * sizeof(OctreeNodeAABB), triangleIndices.size() * sizeof(unsigned int) };
+	const size_t counts[NR_SECTIONS] = {
+		vertices.size(), normals.size(), uvs.size(), indices.size(), nodes.size(), triangleIndices.size() };
+
+	size_t offset = sizeof(Header);
+	for (int s = 0; s < NR_SECTIONS; ++s) {
+		offset = alignOffset(offset, SECTION_ALIGNMENT);
+		header.m_offsets[s] = offset;
+		header.m_counts[s] = counts[s];
+		offset += sizes[s];
+	}
+
+	// Other processes may load the same mesh, so write to a unique temporary file
+	std::random_device rd;
+	std::string tmpPath = path + "." + std::to_string(rd()) + ".tmp";
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cout << "Could not write mesh cache " << tmpPath << std::endl;
+		return false;
+	}
+
+	const char padding[SECTION_ALIGNMENT] = {};
+	file.write((const char*)&header, sizeof(Header));
+	size_t position = sizeof(Header);
+	for (int s = 0; s < NR_SECTIONS; ++s) {
+		file.write(padding, header.m_offsets[s] - position);
+		file.write(data[s], sizes[s]);
+		position = header.m_offsets[s] + sizes[s];
+	}
+	file.close();
+	if (!file) {
+		std::cout << "Could not write mesh cache " << tmpPath << std::endl;
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	// rename does not replace existing files on Windows
+	std::remove(path.c_str());
+#endif
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+std::string MeshCache::getCachePath(const std::string& filePath, const glm::mat4& transform, const float weldEpsilon) {
+	char name[32];
+	uint64_t h = hash((const char*)&transform[0][0], sizeof(glm::mat4), VERSION);
+	if (weldEpsilon > 0.0f) h = hash((const char*)&weldEpsilon, sizeof(float), h);
+	std::snprintf(name, sizeof(name), ".%016llx.meshcache", (unsigned long long)h);
+	return filePath + name;
+}
+
+uint64_t MeshCache::hashFile(const std::string& filePath) {
+	MappedFile file(filePath);
+	if (!file.isOpen()) return 0;
+	return hash(file.getData(), file.getSize(), file.getSize());
+}
+
+bool MeshCache::getSourceStamp(const std::string& filePath, uint64_t& size, int64_t& time) {
+	std::error_code error;
+	size = (uint64_t)std::filesystem::file_size(filePath, error);
+	if (error) return false;
+	time = (int64_t)std::filesystem::last_write_time(filePath, error).time_since_epoch().count();
+	return !error;
+}
+
+bool MeshCache::hasValidIndices() const {
+	// Traversal trusts the file, so a stale or damaged cache is checked once here
+	const uint64_t nrVertices = m_header->m_counts[VERTICES];
+	const uint64_t nrTriangleIndices = m_header->m_counts[TRIANGLE_INDICES];
+	const uint64_t nrNodes = m_header->m_counts[NODES];
+	if (m_header->m_counts[INDICES] % 3 != 0 || nrTriangleIndices % 3 != 0) return false;
+
+	const SharedBuffer<unsigned int> indices = getIndices();
+	for (size_t i = 0; i < indices.size(); ++i) {
+		if (indices[i] >= nrVertices) return false;
+	}
+	const SharedBuffer<unsigned int> triangleIndices = getTriangleIndices();
+	for (size_t i = 0; i < triangleIndices.size(); ++i) {
+		if (triangleIndices[i] >= nrVertices) return false;
+	}
+
+	// Children come after their parent, so the traversal can not loop
+	const SharedBuffer<OctreeNodeAABB> nodes = getNodes();
+	for (size_t i = 0; i < nodes.size(); ++i) {
+		const OctreeNodeAABB& node = nodes[i];
+		if (node.isLeaf()) {
+			if (node.m_triangleCount % 3 != 0 ||
+				(uint64_t)node.m_triangleOffset + node.m_triangleCount > nrTriangleIndices) return false;
+		}
+		else if ((uint64_t)node.m_firstChild <= i || (uint64_t)node.m_firstChild + 8 > nrNodes) return false;
+	}
+	return true;
+}
+
+template <typename T>
+SharedBuffer<T> MeshCache::getSection(const int s) const {
+	return SharedBuffer<T>(m_file, (const T*)(m_file->getData() + m_header->m_offsets[s]), (size_t)m_header->m_counts[s]);
+}
+
+uint64_t MeshCache::hash(const char* data, const size_t size, uint64_t h) {
+	// 64 bits at a time, multiply and xor-shift mixing of each word
+	const uint64_t PRIME = 0x9E3779B97F4A7C15ull;
+	h ^= 0xCBF29CE484222325ull;
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+		h = (h ^ (word * PRIME)) * 0x100000001B3ull;
+		h ^= h >> 29;
+	}
+	for (; i < size; ++i) {
+		h = (h ^ (unsigned char)data[i]) * 0x100000001B3ull;
+	}
+
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	return h;
+}
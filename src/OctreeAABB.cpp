@@ -4,6 +4,7 @@
 
 #include "../include/SceneObject.h"
 #include "../include/Ray.h"
+#include "../include/RenderStats.h"
 
 /**************** AABB ****************/
 bool AABB::intersect(std::shared_ptr<Ray> ray) const {
@@ -52,65 +53,12 @@ bool AABB::intersectTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) const {
 }
 
 /**************** Octree Node ****************/
-OctreeNodeAABB::OctreeNodeAABB(
-	std::shared_ptr<OctreeNodeAABB> parent,		// Parent node
-	int depth,									// Maximum depth of tree
-	std::shared_ptr<Surface::Mesh> mesh,		// Contained object
-	glm::vec3 aabbMin,							// Min boundary for axis aligned boundary box
-	glm::vec3 aabbMax) : m_mesh(mesh) {			// Max boundary for axis aligned boundary box
-	//m_mesh = mesh;
-	m_aabb.m_min = aabbMin;
-	m_aabb.m_max = aabbMax;
-
-	// Find which triangles that are contained in this AABB
-	// If the node has no parent then this is the root
-	std::vector<unsigned int> indices = (!parent) ? mesh->getIndices() : parent->m_triangleIndicies;
-
-	// Check which triangles are contained in the node
-	for (int i = 0; i < (int)indices.size(); i = i + 3) {
-		if (m_aabb.intersectTriangle(
-			mesh->getVertex(indices[i + 0]),
-			mesh->getVertex(indices[i + 1]),
-			mesh->getVertex(indices[i + 2]))) {
-			// Insert triangle in node
-			m_triangleIndicies.emplace_back(indices[i + 0]);
-			m_triangleIndicies.emplace_back(indices[i + 1]);
-			m_triangleIndicies.emplace_back(indices[i + 2]);
-		}
-	}
-
-	if (depth == 0 || m_triangleIndicies.size() <= 3 * 16) {
-		// Base case
-		for (int i = 0; i < 8; ++i) {
-			m_children[i] = nullptr;
-		}
-	}
-	else {
-		// Recursion to create all 8 child nodes
-		glm::vec3 childAABBMin, childAABBMax;
-		for (int i = 0; i < 8; ++i) {
-			// Bounding box min
-			childAABBMin = glm::vec3(
-				(i % 2 == 0)		? m_aabb.m_min.x : (m_aabb.m_min.x + m_aabb.m_max.x) / 2,
-				((i / 2) % 2 == 0)	? m_aabb.m_min.y : (m_aabb.m_min.y + m_aabb.m_max.y) / 2,
-				((i / 4) % 2 == 0)	? m_aabb.m_min.z : (m_aabb.m_min.z + m_aabb.m_max.z) / 2);
-			// Bounding box max
-			childAABBMax = glm::vec3(
-				(i % 2 == 0)		? (m_aabb.m_min.x + m_aabb.m_max.x) / 2 : m_aabb.m_max.x,
-				((i / 2) % 2 == 0)	? (m_aabb.m_min.y + m_aabb.m_max.y) / 2 : m_aabb.m_max.y,
-				((i / 4) % 2 == 0)	? (m_aabb.m_min.z + m_aabb.m_max.z) / 2 : m_aabb.m_max.z);
-			// Create child node
-			m_children[i] = std::make_shared<OctreeNodeAABB>(
-				std::make_shared<OctreeNodeAABB>(*this), depth - 1, mesh,
-				childAABBMin, childAABBMax);
-		}
-	}
-}
+bool OctreeNodeAABB::intersect(std::shared_ptr<Ray> ray, const OctreeAABB& octree) const {
+	RenderStats::add(RenderStats::NODE_VISITS);
 
-bool OctreeNodeAABB::intersect(std::shared_ptr<Ray> ray) const {
 	// Check if node contains any triangles
-	if (m_triangleIndicies.size() == 0) return false;
-	else if (m_children[0] == nullptr) {
+	if (m_triangleCount == 0) return false;
+	else if (isLeaf()) {
 		// Reached a leaf node in the octree
 		bool hasIntersected = false;
 		glm::vec3 n0, n1, n2;	// Normals
@@ -124,11 +72,16 @@ bool OctreeNodeAABB::intersect(std::shared_ptr<Ray> ray) const {
 
 		//int triangleNr = 1;
 		// Check intersection for all triangles in this node
-		for (int i = 0; i < (int)m_triangleIndicies.size(); i = i + 3) {
+		const SharedBuffer<glm::vec3>& vertices = octree.m_vertices;
+		const SharedBuffer<glm::vec3>& normals = octree.m_normals;
+		const unsigned int* triangleIndices = octree.m_triangleIndices.data() + m_triangleOffset;
+		if (octree.m_clusterFrames) octree.touchCluster(this - octree.m_nodes.data());
+		RenderStats::add(RenderStats::TRIANGLE_TESTS, m_triangleCount / 3);
+		for (int i = 0; i < (int)m_triangleCount; i = i + 3) {
  			// MllerTrumbore intersection algorithm for triangle
-			v0 = m_mesh->getVertex(m_triangleIndicies[i + 0]);
-			v1 = m_mesh->getVertex(m_triangleIndicies[i + 1]);
-			v2 = m_mesh->getVertex(m_triangleIndicies[i + 2]);
+			v0 = vertices[triangleIndices[i + 0]];
+			v1 = vertices[triangleIndices[i + 1]];
+			v2 = vertices[triangleIndices[i + 2]];
 
 			// Find edges for triangle
 			e1 = v1 - v0;
@@ -176,9 +129,9 @@ bool OctreeNodeAABB::intersect(std::shared_ptr<Ray> ray) const {
 				tMin = t;
 
 				// Calculate the normal of the triangle
-				n0 = m_mesh->getNormal(m_triangleIndicies[i + 0]);
-				n1 = m_mesh->getNormal(m_triangleIndicies[i + 1]);
-				n2 = m_mesh->getNormal(m_triangleIndicies[i + 2]);
+				n0 = normals[triangleIndices[i + 0]];
+				n1 = normals[triangleIndices[i + 1]];
+				n2 = normals[triangleIndices[i + 2]];
 
 				// Interpolate to find the normal
 				glm::vec3 normal = (1.0f - u - v) * n0 + u * n1 + v * n2;
@@ -187,7 +140,7 @@ bool OctreeNodeAABB::intersect(std::shared_ptr<Ray> ray) const {
 				glm::vec3 intersectionPt = ray->getStartPt() + t * ray->getDirection();
 
 				std::shared_ptr<Intersection> newIntersection = std::make_shared<Intersection>(
-					intersectionPt, normal, t, m_mesh->getMaterial());
+					intersectionPt, normal, t, octree.m_material);
 
 				ray->setRayIntersection(newIntersection);
 				hasIntersected = true;
@@ -202,10 +155,11 @@ bool OctreeNodeAABB::intersect(std::shared_ptr<Ray> ray) const {
 		// Check intersection with child nodes
 		bool hasIntersected = false;
 		for (int i = 0; i < 8; ++i) {
+			const OctreeNodeAABB& child = octree.m_nodes[m_firstChild + i];
 			// Check if ray intersects the bounding box of child node
-			if (m_children[i]->m_aabb.intersect(ray)) {
+			if (child.m_aabb.intersect(ray)) {
 				// Check if ray intersects an object in child node
-				if (m_children[i]->intersect(ray)) {
+				if (child.intersect(ray, octree)) {
 					hasIntersected = true;
 				}
 			}
@@ -215,6 +169,130 @@ bool OctreeNodeAABB::intersect(std::shared_ptr<Ray> ray) const {
 	return false;
 }
 
+bool OctreeNodeAABB::isLeaf() const {
+	return m_firstChild < 0;
+}
+
 /**************** Octtree ****************/
-OctreeAABB::OctreeAABB(std::shared_ptr<Surface::Mesh> mesh)
-	: OctreeNodeAABB(nullptr, 8, mesh, mesh->getMinPos(), mesh->getMaxPos()) {}
\ No newline at end of file
+OctreeAABB::OctreeAABB(const Surface::Mesh& mesh)
+	: m_vertices(mesh.getVertices()), m_normals(mesh.getNormals()), m_material(mesh.getMaterial()),
+	m_frame(1), m_nrClusters(0), m_nrUsedClusters(0), m_nrClusterMisses(0) {
+	// Root node
+	std::vector<OctreeNodeAABB> nodes(1);
+	std::vector<unsigned int> triangleIndices;
+	nodes[0].m_aabb.m_min = mesh.getMinPos();
+	nodes[0].m_aabb.m_max = mesh.getMaxPos();
+
+	const SharedBuffer<unsigned int>& indices = mesh.getIndices();
+	buildNode(nodes, triangleIndices, 0, indices.data(), indices.size(), 8);
+
+	m_nodes = SharedBuffer<OctreeNodeAABB>(std::move(nodes));
+	m_triangleIndices = SharedBuffer<unsigned int>(std::move(triangleIndices));
+}
+
+OctreeAABB::OctreeAABB(const Surface::Mesh& mesh, SharedBuffer<OctreeNodeAABB> nodes, SharedBuffer<unsigned int> triangleIndices)
+	: m_vertices(mesh.getVertices()), m_normals(mesh.getNormals()), m_material(mesh.getMaterial()),
+	m_nodes(nodes), m_triangleIndices(triangleIndices),
+	m_frame(1), m_nrClusters(0), m_nrUsedClusters(0), m_nrClusterMisses(0) {}
+
+bool OctreeAABB::intersect(std::shared_ptr<Ray> ray) const {
+	return m_nodes[0].intersect(ray, *this);
+}
+
+void OctreeAABB::enableClusterTracking() {
+	m_clusterFrames = std::make_unique<std::atomic<uint32_t>[]>(m_nodes.size());
+	m_nrClusters = 0;
+	for (size_t i = 0; i < m_nodes.size(); ++i) {
+		m_clusterFrames[i].store(0, std::memory_order_relaxed);
+		if (m_nodes[i].isLeaf() && m_nodes[i].m_triangleCount > 0) m_nrClusters++;
+	}
+}
+
+bool OctreeAABB::isTrackingClusters() const {
+	return m_clusterFrames != nullptr;
+}
+
+void OctreeAABB::beginFrame() {
+	// Frames start at 2, so a cluster that has never been used is a miss in the first frame
+	m_frame++;
+	m_nrUsedClusters.store(0, std::memory_order_relaxed);
+	m_nrClusterMisses.store(0, std::memory_order_relaxed);
+}
+
+OctreeAABB::ClusterStats OctreeAABB::getClusterStats() const {
+	ClusterStats stats;
+	stats.m_nrClusters = m_nrClusters;
+	stats.m_nrUsed = m_nrUsedClusters.load(std::memory_order_relaxed);
+	stats.m_nrMisses = m_nrClusterMisses.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void OctreeAABB::touchCluster(const size_t nodeIndex) const {
+	// Only the first use of a cluster in a frame writes to shared memory
+	std::atomic<uint32_t>& lastFrame = m_clusterFrames[nodeIndex];
+	if (lastFrame.load(std::memory_order_relaxed) == m_frame) return;
+	uint32_t previousFrame = lastFrame.exchange(m_frame, std::memory_order_relaxed);
+	if (previousFrame == m_frame) return;
+
+	m_nrUsedClusters.fetch_add(1, std::memory_order_relaxed);
+	if (previousFrame + 1 != m_frame) m_nrClusterMisses.fetch_add(1, std::memory_order_relaxed);
+}
+
+const SharedBuffer<OctreeNodeAABB>& OctreeAABB::getNodes() const {
+	return m_nodes;
+}
+
+const SharedBuffer<unsigned int>& OctreeAABB::getTriangleIndices() const {
+	return m_triangleIndices;
+}
+
+void OctreeAABB::buildNode(std::vector<OctreeNodeAABB>& nodes, std::vector<unsigned int>& triangleIndices,
+	const int nodeIndex, const unsigned int* indices, const size_t nrIndices, const int depth) const {
+	AABB aabb = nodes[nodeIndex].m_aabb;
+
+	// Find which triangles of the parent that are contained in this AABB
+	std::vector<unsigned int> nodeIndices;
+	for (size_t i = 0; i < nrIndices; i = i + 3) {
+		if (aabb.intersectTriangle(
+			m_vertices[indices[i + 0]],
+			m_vertices[indices[i + 1]],
+			m_vertices[indices[i + 2]])) {
+			// Insert triangle in node
+			nodeIndices.emplace_back(indices[i + 0]);
+			nodeIndices.emplace_back(indices[i + 1]);
+			nodeIndices.emplace_back(indices[i + 2]);
+		}
+	}
+	nodes[nodeIndex].m_triangleCount = (unsigned int)nodeIndices.size();
+
+	if (depth == 0 || nodeIndices.size() <= 3 * 16) {
+		// Base case, the triangles of leaf nodes are stored in the octree
+		nodes[nodeIndex].m_firstChild = -1;
+		nodes[nodeIndex].m_triangleOffset = (unsigned int)triangleIndices.size();
+		triangleIndices.insert(triangleIndices.end(), nodeIndices.begin(), nodeIndices.end());
+	}
+	else {
+		// Recursion to create all 8 child nodes
+		int firstChild = (int)nodes.size();
+		nodes[nodeIndex].m_firstChild = firstChild;
+		nodes[nodeIndex].m_triangleOffset = 0;
+		nodes.resize(nodes.size() + 8);
+
+		for (int i = 0; i < 8; ++i) {
+			// Bounding box min
+			nodes[firstChild + i].m_aabb.m_min = glm::vec3(
+				(i % 2 == 0)		? aabb.m_min.x : (aabb.m_min.x + aabb.m_max.x) / 2,
+				((i / 2) % 2 == 0)	? aabb.m_min.y : (aabb.m_min.y + aabb.m_max.y) / 2,
+				((i / 4) % 2 == 0)	? aabb.m_min.z : (aabb.m_min.z + aabb.m_max.z) / 2);
+			// Bounding box max
+			nodes[firstChild + i].m_aabb.m_max = glm::vec3(
+				(i % 2 == 0)		? (aabb.m_min.x + aabb.m_max.x) / 2 : aabb.m_max.x,
+				((i / 2) % 2 == 0)	? (aabb.m_min.y + aabb.m_max.y) / 2 : aabb.m_max.y,
+				((i / 4) % 2 == 0)	? (aabb.m_min.z + aabb.m_max.z) / 2 : aabb.m_max.z);
+		}
+		for (int i = 0; i < 8; ++i) {
+			// Create child node
+			buildNode(nodes, triangleIndices, firstChild + i, nodeIndices.data(), nodeIndices.size(), depth - 1);
+		}
+	}
+}
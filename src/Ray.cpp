@@ -13,7 +13,7 @@ glm::vec3 Ray::getDirection() const {
 	return m_direction;
 }
 
-std::shared_ptr<Intersection> Ray::getIntersection() const {
+const std::shared_ptr<Intersection>& Ray::getIntersection() const {
 	return m_intersection;
 }
 
@@ -65,6 +65,10 @@ bool Ray::hitsDiffuseSurface() const {
 	//	|| std::dynamic_pointer_cast<PerfectReflectorMaterial>(m_intersection->m_material));
 }
 
+bool Ray::hitsLambertianSurface() const {
+	return (std::dynamic_pointer_cast<LambertianMaterial>(m_intersection->m_material)) ? true : false;
+}
+
 glm::vec3 Ray::getBRDFValue(std::shared_ptr<Ray> reflectedRay) const {
 	// wIn = incoming direction of ray, wOut = outgoing direction of ray
 	glm::vec3 outDirection = reflectedRay->getDirection();
@@ -149,7 +153,7 @@ std::shared_ptr<Ray> Ray::createReflectedRay(const float rand1, const float rand
 		glm::vec3 surfaceNormal = m_intersection->m_normal;
 
 		// Checkout this function
-		glm::vec3 randomHemisphereDirection = Utility::CosineWeightedHemisphereSampleDirection(surfaceNormal);
+		glm::vec3 randomHemisphereDirection = Utility::CosineWeightedHemisphereSampleDirection(surfaceNormal, rand1, rand2);
 		reflectedRayDirection = randomHemisphereDirection;
 	}
 
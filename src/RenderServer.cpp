@@ -0,0 +1,220 @@
+#include "../include/RenderServer.h"
+
+#include <sstream>
+#include <chrono>
+#include <new>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace {
+	// Largest image side of a job, a client can not ask for more memory than this
+	const int MAX_JOB_SIZE = 16384;
+
+	bool readVec3(std::istringstream& line, glm::vec3& v) {
+		return (bool)(line >> v.x >> v.y >> v.z);
+	}
+
+#ifndef _WIN32
+	// Stream over a connected socket, reads are buffered and writes are not
+	class SocketBuffer : public std::streambuf {
+	public:
+		explicit SocketBuffer(const int socket) : m_socket(socket) {
+			setg(m_input, m_input, m_input);
+		}
+
+	protected:
+		int underflow() override {
+			ssize_t size = ::read(m_socket, m_input, sizeof(m_input));
+			if (size <= 0) return traits_type::eof();
+			setg(m_input, m_input, m_input + size);
+			return traits_type::to_int_type(*gptr());
+		}
+
+		int overflow(int c) override {
+			if (c == traits_type::eof()) return traits_type::not_eof(c);
+			char character = (char)c;
+			return (xsputn(&character, 1) == 1) ? c : traits_type::eof();
+		}
+
+		std::streamsize xsputn(const char* data, std::streamsize size) override {
+			std::streamsize written = 0;
+			while (written < size) {
+				ssize_t n = ::write(m_socket, data + written, (size_t)(size - written));
+				if (n <= 0) break;
+				written += n;
+			}
+			return written;
+		}
+
+	private:
+		int m_socket;
+		char m_input[4096];
+	};
+#endif
+}
+
+/**************** Render server ****************/
+RenderServer::RenderServer(std::shared_ptr<Scene> scene, const RenderSettings& settings)
+	: m_scene(scene), m_settings(settings), m_nrJobs(0) {
+	// A job is not resumed and has no live output
+	m_settings.m_checkpointPath.clear();
+	m_settings.m_imageStreamPath.clear();
+	m_scene->setCheckpoint("");
+	m_scene->setImageStream("");
+}
+
+bool RenderServer::run(std::istream& in, std::ostream& out) {
+	std::string text;
+	while (std::getline(in, text)) {
+		std::istringstream line(text);
+		std::string keyword;
+		if (!(line >> keyword)) continue;
+
+		if (keyword == "quit") {
+			out << "ok quit" << std::endl;
+			return false;
+		}
+		else if (keyword == "render") {
+			RenderSettings job = m_settings;
+			std::string error;
+			double seconds = 0.0;
+			if (parseJob(line, job, error) && render(job, seconds, error)) {
+				out << "ok " << job.m_outputPath << " " << seconds << std::endl;
+			}
+			else {
+				out << "error " << error << std::endl;
+			}
+		}
+		else {
+			out << "error unknown job '" << keyword << "'" << std::endl;
+		}
+	}
+	return true;
+}
+
+void RenderServer::runStandardInput() {
+	// Answers go to standard output, everything the renderer prints goes to standard error
+	std::ostream out(std::cout.rdbuf());
+	std::streambuf* coutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+	out << "ready" << std::endl;
+	run(std::cin, out);
+	std::cout.rdbuf(coutBuffer);
+}
+
+#ifdef _WIN32
+bool RenderServer::runSocket(const std::string& path) {
+	std::cout << "Unix domain sockets are not supported on this platform, use standard input" << std::endl;
+	return false;
+}
+#else
+bool RenderServer::runSocket(const std::string& path) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		std::cout << "Socket path " << path << " is too long" << std::endl;
+		return false;
+	}
+	path.copy(address.sun_path, path.size());
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server < 0) {
+		std::cout << "Could not create a socket" << std::endl;
+		return false;
+	}
+	signal(SIGPIPE, SIG_IGN); // A client that disconnects early must not stop the server
+	unlink(path.c_str()); // Left behind by a server that was killed
+	if (bind(server, (const sockaddr*)&address, sizeof(address)) != 0 || listen(server, 4) != 0) {
+		std::cout << "Could not listen on " << path << std::endl;
+		close(server);
+		return false;
+	}
+	std::cout << "Listening on " << path << std::endl;
+
+	bool isRunning = true;
+	while (isRunning) {
+		int connection = accept(server, nullptr, nullptr);
+		if (connection < 0) break;
+
+		SocketBuffer buffer(connection);
+		std::istream in(&buffer);
+		std::ostream out(&buffer);
+		isRunning = run(in, out);
+		close(connection);
+	}
+
+	close(server);
+	unlink(path.c_str());
+	return true;
+}
+#endif
+
+bool RenderServer::parseJob(std::istringstream& line, RenderSettings& job, std::string& error) const {
+	std::string key;
+	while (line >> key) {
+		bool isValid;
+		if (key == "eye")				isValid = readVec3(line, job.m_eye);
+		else if (key == "center")		isValid = readVec3(line, job.m_center);
+		else if (key == "up")			isValid = readVec3(line, job.m_up);
+		else if (key == "fov") {
+			float degrees;
+			isValid = (bool)(line >> degrees);
+			job.m_fov = glm::radians(degrees);
+		}
+		else if (key == "width")		isValid = (line >> job.m_width) && job.m_width > 0 && job.m_width <= MAX_JOB_SIZE;
+		else if (key == "height")		isValid = (line >> job.m_height) && job.m_height > 0 && job.m_height <= MAX_JOB_SIZE;
+		else if (key == "samples")		isValid = (line >> job.m_nrSubsamples) && job.m_nrSubsamples > 0;
+		else if (key == "passes")		isValid = (line >> job.m_nrPasses) && job.m_nrPasses > 0;
+		else if (key == "output")		isValid = (bool)(line >> job.m_outputPath);
+		else if (key == "budget")		isValid = (line >> job.m_timeBudget) && job.m_timeBudget > 0.0f;
+		else if (key == "seed") {
+			unsigned long long seed;
+			isValid = (bool)(line >> seed);
+			job.m_seed = seed;
+		}
+		else {
+			error = "unknown key '" + key + "'";
+			return false;
+		}
+
+		if (!isValid) {
+			error = "invalid value of '" + key + "'";
+			return false;
+		}
+	}
+	return true;
+}
+
+bool RenderServer::render(const RenderSettings& job, double& seconds, std::string& error) {
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	// Only the settings of the render itself, the photon map and irradiance cache are kept
+	m_scene->setNrSubsamples(job.m_nrSubsamples);
+	m_scene->setNrPasses(job.m_nrPasses);
+	m_scene->setSeed(job.m_seed);
+	m_scene->setTimeBudget(job.m_timeBudget); // The clock of a job starts now, the photon map is already built
+
+	// A failed job must not end the server, large films may still not fit in memory
+	std::shared_ptr<Camera> camera;
+	try {
+		camera = job.createCamera();
+		m_scene->render(camera);
+	}
+	catch (const std::bad_alloc&) {
+		error = "not enough memory for a " + std::to_string(job.m_width) + "x" + std::to_string(job.m_height) + " image";
+		return false;
+	}
+	if (!camera->getFilm().writeImages(job.m_outputPath)) {
+		error = "could not write " + job.m_outputPath;
+		return false;
+	}
+
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	m_nrJobs++;
+	std::cout << "Job " << m_nrJobs << " written to " << job.m_outputPath << " in " << seconds << "s" << std::endl;
+	return true;
+}
@@ -0,0 +1,156 @@
+#include "../include/RenderStats.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <mutex>
+#include <cstring>
+#include <omp.h>
+
+namespace {
+	// Live slots and the counts of threads that have exited
+	struct Registry {
+		std::mutex m_mutex;
+		std::vector<RenderStats::ThreadStats*> m_slots;
+		RenderStats::ThreadStats m_retired = {};
+	};
+
+	Registry& getRegistry() {
+		// Never destroyed, threads may exit after main returns
+		static Registry* registry = new Registry();
+		return *registry;
+	}
+
+	void addStats(RenderStats::ThreadStats& total, const RenderStats::ThreadStats& stats) {
+		for (int c = 0; c < RenderStats::NR_COUNTERS; ++c) total.m_counters[c] += stats.m_counters[c];
+		for (int h = 0; h < RenderStats::NR_HISTOGRAMS; ++h) {
+			for (int i = 0; i < RenderStats::HISTOGRAM_SIZE; ++i) total.m_histograms[h][i] += stats.m_histograms[h][i];
+		}
+		for (int p = 0; p < RenderStats::NR_PHASES; ++p) total.m_phaseNanoseconds[p] += stats.m_phaseNanoseconds[p];
+	}
+
+	const char* COUNTER_NAMES[RenderStats::NR_COUNTERS] = {
+		"cameraRays", "secondaryRays", "shadowRays", "photonRays", "tracedRays", "nodeVisits",
+		"triangleTests", "gatherQueries", "photonsGathered", "russianRouletteTerminations", "depthTerminations" };
+	const char* HISTOGRAM_NAMES[RenderStats::NR_HISTOGRAMS] = {
+		"cameraPathLength", "photonPathLength", "photonsPerQueryLog2" };
+	const char* PHASE_NAMES[RenderStats::NR_PHASES] = {
+		"sceneBuild", "octreeBuild", "photonEmission", "kdTreeOptimize", "render", "imageWrite" };
+}
+
+namespace RenderStats {
+	/**************** Thread slot ****************/
+	ThreadSlot::ThreadSlot() {
+		std::memset(&m_stats, 0, sizeof(ThreadStats));
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.m_mutex);
+		registry.m_slots.emplace_back(&m_stats);
+	}
+
+	ThreadSlot::~ThreadSlot() {
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.m_mutex);
+		addStats(registry.m_retired, m_stats);
+		for (size_t i = 0; i < registry.m_slots.size(); ++i) {
+			if (registry.m_slots[i] == &m_stats) {
+				registry.m_slots[i] = registry.m_slots.back();
+				registry.m_slots.pop_back();
+				break;
+			}
+		}
+	}
+
+	/**************** Timers ****************/
+	void addTime(const phase p, const double seconds) {
+		getThreadStats().m_phaseNanoseconds[p] += (uint64_t)(seconds * 1e9);
+	}
+
+	ScopedTimer::ScopedTimer(const phase p)
+		: m_phase(p), m_start(std::chrono::steady_clock::now()) {}
+
+	ScopedTimer::~ScopedTimer() {
+		addTime(m_phase, getSeconds());
+	}
+
+	double ScopedTimer::getSeconds() const {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+	}
+
+	/**************** Totals ****************/
+	ThreadStats getTotals() {
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.m_mutex);
+		ThreadStats total = registry.m_retired;
+		for (const ThreadStats* stats : registry.m_slots) {
+			addStats(total, *stats);
+		}
+		return total;
+	}
+
+	double getPhaseSeconds(const phase p) {
+		return getTotals().m_phaseNanoseconds[p] * 1e-9;
+	}
+
+	void reset() {
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.m_mutex);
+		std::memset(&registry.m_retired, 0, sizeof(ThreadStats));
+		for (ThreadStats* stats : registry.m_slots) {
+			std::memset(stats, 0, sizeof(ThreadStats));
+		}
+	}
+
+	bool writeReport(const std::string& path) {
+		ThreadStats total = getTotals();
+		const uint64_t* counters = total.m_counters;
+		double tracedRays = (double)((counters[TRACED_RAYS] > 0) ? counters[TRACED_RAYS] : 1);
+		double gatherQueries = (double)((counters[GATHER_QUERIES] > 0) ? counters[GATHER_QUERIES] : 1);
+
+		std::ofstream file(path, std::ios::trunc);
+		if (!file) {
+			std::cout << "Could not write render stats " << path << std::endl;
+			return false;
+		}
+
+		file << std::setprecision(9);
+		file << "{\n";
+		file << "\t\"version\": 1,\n";
+#ifdef MCRT_DISABLE_STATS
+		file << "\t\"countersEnabled\": false,\n";
+#else
+		file << "\t\"countersEnabled\": true,\n";
+#endif
+		file << "\t\"threads\": " << omp_get_max_threads() << ",\n";
+
+		file << "\t\"phaseSeconds\": {";
+		for (int p = 0; p < NR_PHASES; ++p) {
+			file << ((p == 0) ? "\n" : ",\n") << "\t\t\"" << PHASE_NAMES[p] << "\": " << total.m_phaseNanoseconds[p] * 1e-9;
+		}
+		file << "\n\t},\n";
+
+		file << "\t\"counters\": {";
+		for (int c = 0; c < NR_COUNTERS; ++c) {
+			file << ((c == 0) ? "\n" : ",\n") << "\t\t\"" << COUNTER_NAMES[c] << "\": " << counters[c];
+		}
+		file << "\n\t},\n";
+
+		file << "\t\"perTracedRay\": {\n";
+		file << "\t\t\"nodeVisits\": " << counters[NODE_VISITS] / tracedRays << ",\n";
+		file << "\t\t\"triangleTests\": " << counters[TRIANGLE_TESTS] / tracedRays << "\n";
+		file << "\t},\n";
+		file << "\t\"photonsPerGatherQuery\": " << counters[PHOTONS_GATHERED] / gatherQueries << ",\n";
+
+		file << "\t\"histograms\": {";
+		for (int h = 0; h < NR_HISTOGRAMS; ++h) {
+			file << ((h == 0) ? "\n" : ",\n") << "\t\t\"" << HISTOGRAM_NAMES[h] << "\": [";
+			for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+				file << ((i == 0) ? "" : ", ") << total.m_histograms[h][i];
+			}
+			file << "]";
+		}
+		file << "\n\t}\n";
+		file << "}\n";
+		return (bool)file;
+	}
+}
@@ -1,16 +1,31 @@
 #include "../include/Scene.h"
 #include "../include/Utility.h"
+#include "../include/RenderStats.h"
+#include "../include/Trace.h"
+
+#include <limits>
+
+namespace {
+	// Black, blue, cyan, green, yellow, red and white for t from 0 to 1
+	glm::vec3 getHeatColour(const float t) {
+		static const glm::vec3 RAMP[] = {
+			glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+			glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f) };
+		float x = glm::clamp(t, 0.0f, 1.0f) * 6.0f;
+		int i = glm::min((int)x, 5);
+		return glm::mix(RAMP[i], RAMP[i + 1], x - i);
+	}
 
-Scene::Scene() {
-	std::random_device rd;
-	gen = new std::mt19937(rd());
-	dis = new std::uniform_real_distribution<float>(0, 1);
+	// Largest part of a time budget spent on photons, the rest goes to camera samples
+	const float PHOTON_BUDGET_SHARE = 0.25f;
 }
 
-Scene::~Scene() {
-	delete gen;
-	delete dis;
-}
+Scene::Scene()
+	: m_nrSubsamples(1), m_nrPhotonEmission(0), m_renderMode(CAUSTICS),
+	m_nrPasses(1), m_initialPhotonRadius(PHOTON_RADIUS), m_seed(0), m_checkpointInterval(600), m_heatmap(HEATMAP_NONE),
+	m_shardMode(SHARD_NONE), m_shardIndex(0), m_nrShards(1), m_timeBudget(0.0f), m_isLightTableBuilt(false), m_photonPower(0.0f), m_pageFaultCount(0) {}
+
+Scene::~Scene() {}
 
 void Scene::setNrSubsamples(const int nrSubsamples) {
 	m_nrSubsamples = nrSubsamples;
@@ -20,6 +35,76 @@ void Scene::setNrPhotonEmission(const int nrPhotonEmission) {
 	m_nrPhotonEmission = nrPhotonEmission;
 }
 
+void Scene::setIrradianceCaching(const bool useIrradianceCache, const float accuracy) {
+	m_irradianceCache = (useIrradianceCache) ? std::make_shared<IrradianceCache>(accuracy) : nullptr;
+}
+
+void Scene::setSeed(const uint64_t seed) {
+	m_seed = seed;
+}
+
+void Scene::setCheckpoint(const std::string& filePath, const int intervalSeconds) {
+	m_checkpointPath = filePath;
+	m_checkpointInterval = intervalSeconds;
+}
+
+void Scene::setImageStream(const std::string& filePath) {
+	m_imageStreamPath = filePath;
+}
+
+void Scene::setHeatmap(const int heatmap) {
+	m_heatmap = heatmap;
+#ifdef MCRT_DISABLE_STATS
+	if (m_heatmap != HEATMAP_NONE && m_heatmap != HEATMAP_TIME) {
+		std::cout << "The render counters are compiled out, the heatmap only shows batched photon gathers" << std::endl;
+	}
+#endif
+}
+
+void Scene::setShard(const int mode, const int index, const int nrShards, const std::string& filePath) {
+	m_shardMode = (nrShards > 0 && index >= 0 && index < nrShards) ? mode : SHARD_NONE;
+	m_shardIndex = (m_shardMode != SHARD_NONE) ? index : 0;
+	m_nrShards = (m_shardMode != SHARD_NONE) ? nrShards : 1;
+	m_shardPath = filePath;
+}
+
+void Scene::setTimeBudget(const float seconds) {
+	m_timeBudget = glm::max(seconds, 0.0f);
+	m_deadline = std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(m_timeBudget));
+}
+
+void Scene::setRenderMode(const int renderMode) {
+	m_renderMode = renderMode;
+}
+
+void Scene::setNrPasses(const int nrPasses) {
+	m_nrPasses = nrPasses;
+}
+
+void Scene::setInitialPhotonRadius(const float radius) {
+	m_initialPhotonRadius = radius;
+}
+
+void Scene::applySettings(const RenderSettings& settings) {
+	setRenderMode(settings.m_renderMode);
+	setNrPhotonEmission(settings.m_nrPhotonEmission);
+	setNrSubsamples(settings.m_nrSubsamples);
+	setNrPasses(settings.m_nrPasses);
+	setIrradianceCaching(settings.m_irradianceCaching && settings.m_renderMode == MONTE_CARLO, settings.m_irradianceAccuracy);
+	setSeed(settings.m_seed);
+	setHeatmap(settings.m_heatmap);
+	// A heatmap is not a render that should be resumed, and the samples of a time budget depend on the machine
+	bool isResumable = m_heatmap == HEATMAP_NONE && settings.m_timeBudget <= 0.0f;
+	if (!isResumable && !settings.m_checkpointPath.empty()) {
+		std::cout << "Checkpoints are not written for heatmaps or renders with a time budget" << std::endl;
+	}
+	setCheckpoint((isResumable) ? settings.m_checkpointPath : "", settings.m_checkpointInterval);
+	setImageStream(settings.m_imageStreamPath);
+	setShard(settings.m_shardMode, settings.m_shardIndex, settings.m_nrShards, settings.m_shardPath);
+	setTimeBudget(settings.m_timeBudget); // Last, the photon map is built next
+}
+
 int Scene::getNrSubsamples() const {
 	return m_nrSubsamples;
 }
@@ -28,6 +113,14 @@ int Scene::getNrPhotonEmission() const {
 	return m_nrPhotonEmission;
 }
 
+int Scene::getRenderMode() const {
+	return m_renderMode;
+}
+
+int Scene::getNrPasses() const {
+	return m_nrPasses;
+}
+
 void Scene::addHexagonWalls() {
 	// Material for scene room
 	std::shared_ptr<LambertianMaterial> diffuseWhite	= std::make_shared<LambertianMaterial>(glm::vec3(1.0f));
@@ -114,6 +207,7 @@ void Scene::addTriangle(const glm::vec3 v0, const glm::vec3 v1, const glm::vec3
 	m_sceneObjects.emplace_back(triangle);
 	if (isEmissive) {
 		m_lightIndices.emplace_back(m_sceneObjects.size() - 1);
+		m_isLightTableBuilt = false;
 	}
 }
 
@@ -129,6 +223,7 @@ void Scene::addPlane(const glm::vec3 v0, const glm::vec3 v1, const glm::vec3 v2,
 	if (isEmissive) {
 		m_lightIndices.emplace_back(m_sceneObjects.size() - 1);
 		m_lightIndices.emplace_back(m_sceneObjects.size() - 2);
+		m_isLightTableBuilt = false;
 	}
 }
 
@@ -162,25 +257,29 @@ void Scene::addSphere(const float radius, const glm::vec3 origin, std::shared_pt
 	m_sceneObjects.emplace_back(sphere);
 	if (isEmissive) {
 		m_lightIndices.emplace_back(m_sceneObjects.size() - 1);
+		m_isLightTableBuilt = false;
 	}
 }
 
 void Scene::addMesh(const glm::mat4 transform, const char* filePath, std::shared_ptr<Material> material, bool isEmissive) {
 	std::shared_ptr<Surface::Mesh> mesh = std::make_shared<Surface::Mesh>(transform, filePath, material);
+	if (!mesh->isLoaded()) exit(EXIT_FAILURE);
 	m_sceneObjects.emplace_back(mesh);
 	if (isEmissive) {
 		m_lightIndices.emplace_back(m_sceneObjects.size() - 1);
+		m_isLightTableBuilt = false;
 	}
 }
 
-std::shared_ptr<Ray> Scene::castLightRay(const int pickedLight) {
+std::shared_ptr<Ray> Scene::castLightRay(Sampler& sampler, const int pickedLight) {
 	// Shoot ray from random point on the picked light source
-	glm::vec3 randomPtOnSurface = m_sceneObjects[m_lightIndices[pickedLight]]->getRandomPointOnSurface((*dis)(*gen), (*dis)(*gen));
+	float u = sampler.next(), v = sampler.next();
+	glm::vec3 randomPtOnSurface = m_sceneObjects[m_lightIndices[pickedLight]]->getRandomPointOnSurface(u, v);
 	glm::vec3 surfaceNormal = m_sceneObjects[m_lightIndices[pickedLight]]->getNormal();
 	glm::vec3 rayOrigin = randomPtOnSurface + surfaceNormal * FLT_EPSILON;
 
 	/*
-	float rand1 = (*dis)(*gen), rand2 = (*dis)(*gen);
+	float rand1 = sampler.next(), rand2 = sampler.next();
 
 	// Uniform distribution over hemisphere
 	//float inclination = glm::acos(1.0f - 2.0f * rand1);
@@ -202,7 +301,8 @@ std::shared_ptr<Ray> Scene::castLightRay(const int pickedLight) {
 	*/
 
 	// Checkout this function
-	glm::vec3 randomHemisphereDirection = Utility::CosineWeightedHemisphereSampleDirection(surfaceNormal);
+	float rand1 = sampler.next(), rand2 = sampler.next();
+	glm::vec3 randomHemisphereDirection = Utility::CosineWeightedHemisphereSampleDirection(surfaceNormal, rand1, rand2);
 
 	//return std::make_shared<Ray>(rayOrigin, randomDirection);
 	return std::make_shared<Ray>(rayOrigin, randomHemisphereDirection);
@@ -284,126 +384,391 @@ void Scene::generatePhotonMap(const int nrPhotons) {
 		std::cout << "No lights sources in scene. Could not build photon map :(" << std::endl;
 		return;
 	}
-
-	// Variables
-	glm::vec3 totalFlux = glm::vec3(0.0f);
-	float totalFluxNormalised = 0.0f;
-
-	int nrLights = (int)m_lightIndices.size();
-	glm::vec3 lColour;
-	float lArea; 
-	// Calculate total flux from light sources
-	for (int i = 0; i < nrLights; ++i) {
-		// Should be colour or material (or radiance, not sure)
-		// TODO: Test if Colour or (emitted) Radiance should be used
-		lColour = m_sceneObjects[m_lightIndices[i]]->getMaterial()->getColour();
-		lArea = m_sceneObjects[m_lightIndices[i]]->getArea();
-		totalFluxNormalised += ((lColour.r + lColour.g + lColour.b) / 3) * lArea; // Might not be needed
-		totalFlux += lColour * lArea;
-	}
-
-	// Estimate photon map
-	for (int k = 0; k < 100; k++) {
-		// TODO: Add OpenMP (will need all variables declared inside then...)
-		//#pragma omp parallel for
-		for (int i = 0; i < nrPhotons; i++) {
-		//for (int i = 0; i < nrPhotons/100; i++) {
-			float rand = (*dis)(*gen);
-			float lightArea, interval, accumulatingChange = 0.0f;
-			int pickedLight = 0;
-			glm::vec3 lightColour = glm::vec3(0.0f);
-
-			// Pick a light source in the scene
-			// Bigger flux => Bigger chance to be picked
-			for (int j = 0; j < nrLights; ++j) {
-				// TODO: Test if Colour or (emitted) Radiance should be used
-				lightColour = m_sceneObjects[m_lightIndices[j]]->getMaterial()->getColour();
-				lightArea = m_sceneObjects[m_lightIndices[j]]->getArea();
-				interval = ((lightColour.r + lightColour.g + lightColour.b) / 3) * lightArea / totalFluxNormalised;
-
-				if (rand > accumulatingChange && rand < accumulatingChange + interval) {
-					// Lamp got picked
-					pickedLight = j;
-					break;
-				}
-				else {
-					accumulatingChange += interval;
-				}
-			}
-			// Ray origin is at the light source and direction is from the light into the scene
-			std::shared_ptr<Ray> ray = castLightRay(pickedLight);
-			glm::vec3 surfaceNormal = m_sceneObjects[m_lightIndices[pickedLight]]->getNormal();
-			glm::vec3 radiance = glm::dot(ray->getDirection(), surfaceNormal) * m_sceneObjects[m_lightIndices[pickedLight]]->getMaterial()->getColour(); // lightColour;
-
-			tracePhotonRay(ray, radiance);
+	updateLightTable();
+
+	// Estimate photon map. With a time budget batches are emitted while the next one fits into its share.
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	double photonSeconds = PHOTON_BUDGET_SHARE * getSecondsLeft();
+	int nrBatches = 100;
+	for (int k = 0; k < nrBatches; k++) {
+		emitPhotons(nrPhotons, k);
+
+		if (m_timeBudget > 0.0f) {
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+			if (seconds * (k + 2) / (k + 1) > photonSeconds) nrBatches = k + 1;
 		}
 	}
+	if (m_timeBudget > 0.0f) {
+		std::cout << "Emitted " << nrBatches << " of 100 photon batches within the time budget" << std::endl;
+	}
+
+	m_photonPower = getTotalLightPower() / ((float)nrBatches * glm::max(nrPhotons, 1));
 
 	// Optimize KD-tree
+	RenderStats::ScopedTimer timer(RenderStats::KDTREE_OPTIMIZE);
+	Trace::ScopedEvent event("kd-tree optimize", "build", "photons", (int64_t)m_photonMap.size());
 	m_photonMap.optimize();
 }
 
+void Scene::emitPhotons(const int nrPhotons, const int batch) {
+	RenderStats::ScopedTimer timer(RenderStats::PHOTON_EMISSION);
+	Trace::ScopedEvent event("photon batch", "photons", "batch", batch, "photons", nrPhotons);
+
+	float totalLightPower = getTotalLightPower();
+
+	// TODO: Add OpenMP (will need all variables declared inside then...)
+	//#pragma omp parallel for
+	for (int i = 0; i < nrPhotons; i++) {
+		Sampler sampler(m_seed, PHOTON_STREAM + batch, i);
+
+		// Pick a light source in the scene, bigger power => bigger chance to be picked.
+		// The table weighs lights by their colour, the weight gives every light its own share of the power.
+		float pickPdf;
+		int pickedLight = m_lightTable.sample(sampler.next(), pickPdf);
+		float lightWeight = getLightPower(m_lightIndices[pickedLight]) / (pickPdf * totalLightPower);
+
+		// Ray origin is at the light source and direction is from the light into the scene
+		std::shared_ptr<Ray> ray = castLightRay(sampler, pickedLight);
+		glm::vec3 surfaceNormal = m_sceneObjects[m_lightIndices[pickedLight]]->getNormal();
+		glm::vec3 lightColour = lightWeight * m_sceneObjects[m_lightIndices[pickedLight]]->getMaterial()->getColour();
+		// The directions are already cosine weighted. Density estimates normalise by the light power, so
+		// their photons carry the colour only, the caustics estimate keeps its original cosine weighted flux.
+		glm::vec3 radiance = (m_renderMode != CAUSTICS) ? lightColour : glm::dot(ray->getDirection(), surfaceNormal) * lightColour;
+
+		tracePhotonRay(ray, sampler, radiance);
+	}
+}
+
 void Scene::render(std::shared_ptr<Camera> camera) {
-	time_t currTime, startRenderTime;
+	RenderStats::ScopedTimer renderTimer(RenderStats::RENDER);
+	updateLightTable();
 
 	float renderedPercent = 0.0f;
 	std::cout << "------- Rendering started -------" << std::endl;
 	std::cout << renderedPercent << "% finished" << std::endl;
 
-	time(&startRenderTime);
-
 	// Variables
 	int width = camera->getPixelWidth();
 	int height = camera->getPixelHeight();
 
-	//m_renderMode = MONTE_CARLO;
-	m_renderMode = CAUSTICS;
+	collectOutOfCoreOctrees();
+
+	if (!m_imageStreamPath.empty()) {
+		int nrPasses = (m_renderMode == PROGRESSIVE) ? glm::max(m_nrPasses, 1) : m_nrSubsamples;
+		m_imageStream = std::make_unique<ImageStream>(m_imageStreamPath, width, height, nrPasses);
+		if (!m_imageStream->isOpen()) m_imageStream.reset();
+	}
 
-	// Randomizer
-	std::random_device rd;
-	std::mt19937 genHalf(rd());
-	std::uniform_real_distribution<float> disHalf(-0.5, 0.5f);
+	if (m_renderMode == PROGRESSIVE) {
+		int nrPasses = renderProgressive(camera);
+		if (m_heatmap != HEATMAP_NONE) resolveHeatmap(camera);
+		if (m_imageStream) {
+			if (m_heatmap != HEATMAP_NONE) m_imageStream->publish(camera->getFilm());
+			m_imageStream->setProgress(nrPasses, true);
+		}
+		m_imageStream.reset();
+		return;
+	}
 
 	std::cout << "Nr emissive objects = " << m_lightIndices.size() << std::endl;
 
-	// Loop over all pixels
-	for (int x = 0; x < width; ++x) {
-		#pragma omp parallel for
-		for (int y = 0; y < height; ++y) {
-			glm::vec3 totalColour = glm::vec3(0.0f);
-			glm::vec3 pixelColour = glm::vec3(0.0f);
-			for (int subsample = 0; subsample < m_nrSubsamples; ++subsample) {
-				std::shared_ptr<Ray> ray = camera->castCameraRay(
-					x,						// Pixel x
-					(height - y - 1),		// Pixel y
-					disHalf(genHalf),		// Parameter x (>= -0.5, < 0.5), for subsampling
-					disHalf(genHalf));		// Parameter y (>= -0.5, < 0.5), for subsampling
-				pixelColour += traceRay(ray, 0);
+	// Samples and tiles of this shard, all of them without shards
+	int sampleBegin = 0, sampleEnd = m_nrSubsamples;
+	if (m_timeBudget > 0.0f) sampleEnd = 1; // The first sample gives the throughput
+	if (m_shardMode == SHARD_SAMPLES) {
+		sampleBegin = m_nrSubsamples * m_shardIndex / m_nrShards;
+		sampleEnd = m_nrSubsamples * (m_shardIndex + 1) / m_nrShards;
+	}
+	if (m_shardMode != SHARD_NONE) {
+		std::cout << "Rendering shard " << m_shardIndex + 1 << "/" << m_nrShards << " of the "
+			<< ((m_shardMode == SHARD_TILES) ? "tiles" : "samples") << std::endl;
+	}
+
+	// Continue from the last checkpoint of the same render
+	Film& film = camera->getFilm();
+	CheckpointState state = getCheckpointState(camera);
+	int firstSample = sampleBegin;
+	if (!m_checkpointPath.empty()) {
+		CheckpointState checkpoint;
+		if (Checkpoint::read(m_checkpointPath, checkpoint, film) && checkpoint.isCompatible(state)) {
+			firstSample = checkpoint.m_nrCompletedPasses;
+			std::cout << "Resuming from " << m_checkpointPath << " after " << firstSample << " samples per pixel" << std::endl;
+		}
+		else {
+			film.clear();
+		}
+		if (m_irradianceCache) {
+			std::cout << "The irradiance cache is not saved, a resumed render will not be identical" << std::endl;
+		}
+	}
+	if (m_imageStream && firstSample > 0) {
+		m_imageStream->publish(film);
+		m_imageStream->setProgress(firstSample);
+	}
+	double lastCheckpointTime = 0.0;
+
+	// Split the image into tiles that are rendered in parallel, one sample per pixel at a time.
+	// Interleaved tiles give every shard a similar share of the expensive parts of the image.
+	int nrTilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int nrTilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<int> shardTiles;
+	for (int tile = 0; tile < nrTilesX * nrTilesY; ++tile) {
+		if (m_shardMode != SHARD_TILES || tile % m_nrShards == m_shardIndex) shardTiles.emplace_back(tile);
+	}
+	int nrTiles = (int)shardTiles.size();
+	int nrTilesToRender = nrTiles * (sampleEnd - firstSample);
+	int nrRenderedTiles = 0;
+	double startTime = renderTimer.getSeconds();
+
+	for (int sample = firstSample; sample < sampleEnd; ++sample) {
+		beginGeometryFrame();
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (int i = 0; i < nrTiles; ++i) {
+			int tile = shardTiles[i];
+			{
+				Trace::ScopedEvent event("tile", "render", "tile", tile, "sample", sample);
+				renderTile(camera, (tile % nrTilesX) * TILE_SIZE, (tile / nrTilesX) * TILE_SIZE, sample);
+			}
+
+			#pragma omp critical
+			{
+				nrRenderedTiles++;
+				renderedPercent = nrRenderedTiles * 100 / float(nrTilesToRender);
+				double renderTimeElapsed = renderTimer.getSeconds();
+				double renderTimeLeft = (renderTimeElapsed / renderedPercent) * (100 - renderedPercent);
+
+				int hours = (int)renderTimeLeft / (60 * 60);
+				int minutes = (int(renderTimeLeft) % (60 * 60) / 60);
+				int seconds = int(renderTimeLeft) % 60;
+
+				std::cout << renderedPercent << "% of rendering finished" << std::setw(30);
+				std::cout << "Estimated time left: " << hours << "h:" << minutes << "m:" << seconds << "s" << std::endl;
+			}
+		}
+
+		// Continue while another sample at the average time per sample fits into the budget
+		double currTime = renderTimer.getSeconds();
+		if (m_timeBudget > 0.0f) {
+			sampleEnd = sample + 1 + getNrBudgetedPasses((currTime - startTime) / (sample + 1 - firstSample));
+			nrTilesToRender = nrTiles * (sampleEnd - firstSample);
+		}
+
+		reportGeometryFrame(sample);
+		if (m_imageStream) m_imageStream->setProgress(sample + 1, sample + 1 == sampleEnd);
+
+		// Checkpoints are only written between samples, when the film is consistent
+		if (!m_checkpointPath.empty() && sample + 1 < sampleEnd &&
+			currTime - lastCheckpointTime >= m_checkpointInterval) {
+			state.m_nrCompletedPasses = sample + 1;
+			if (Checkpoint::write(m_checkpointPath, state, film)) {
+				std::cout << "Checkpoint written after " << sample + 1 << " samples per pixel" << std::endl;
+			}
+			lastCheckpointTime = currTime;
+		}
+	}
+
+	// The shard is written before the checkpoint is removed, so a worker that is killed can still resume
+	if (m_shardMode != SHARD_NONE && !m_shardPath.empty()) {
+		state.m_nrCompletedPasses = sampleEnd;
+		if (Checkpoint::write(m_shardPath, state, film)) std::cout << "Shard written to " << m_shardPath << std::endl;
+	}
+
+	if (m_timeBudget > 0.0f) {
+		std::cout << "Time budget: " << sampleEnd << " samples per pixel, " << getSecondsLeft() << "s left" << std::endl;
+	}
+
+	// The render is finished, a later run should not resume from it
+	if (!m_checkpointPath.empty()) std::remove(m_checkpointPath.c_str());
+	if (m_heatmap != HEATMAP_NONE) {
+		resolveHeatmap(camera);
+		if (m_imageStream) m_imageStream->publish(film);
+	}
+	m_imageStream.reset();
+
+	if (m_irradianceCache) {
+		std::cout << "Irradiance cache records: " << m_irradianceCache->getNrRecords() << std::endl;
+	}
+}
+
+void Scene::render(const std::vector<std::shared_ptr<Camera>>& cameras) {
+	updateLightTable();
+	// Progressive passes alternate between all pixels and all photons, views are rendered one after another
+	if (cameras.size() == 1 || m_renderMode == PROGRESSIVE) {
+		for (const std::shared_ptr<Camera>& camera : cameras) render(camera);
+		return;
+	}
+
+	RenderStats::ScopedTimer renderTimer(RenderStats::RENDER);
+	std::cout << "------- Rendering " << cameras.size() << " views -------" << std::endl;
+	collectOutOfCoreOctrees();
+
+	// Tiles of all views in one list, so that threads that finish a small view continue with the next
+	struct ViewTile {
+		int m_view;
+		int m_tileX, m_tileY;
+	};
+	std::vector<ViewTile> tiles;
+	for (int view = 0; view < (int)cameras.size(); ++view) {
+		int width = cameras[view]->getPixelWidth();
+		int height = cameras[view]->getPixelHeight();
+		for (int tileY = 0; tileY < height; tileY += TILE_SIZE) {
+			for (int tileX = 0; tileX < width; tileX += TILE_SIZE) {
+				tiles.emplace_back(ViewTile{ view, tileX, tileY });
+			}
+		}
+	}
+
+	int nrTiles = (int)tiles.size();
+	int nrSamples = (m_timeBudget > 0.0f) ? 1 : m_nrSubsamples; // With a time budget the first sample gives the throughput
+	int nrTilesToRender = nrTiles * nrSamples;
+	int nrRenderedTiles = 0;
+	for (int sample = 0; sample < nrSamples; ++sample) {
+		beginGeometryFrame();
+		#pragma omp parallel for schedule(dynamic, 1)
+		for (int tile = 0; tile < nrTiles; ++tile) {
+			const ViewTile& viewTile = tiles[tile];
+			{
+				Trace::ScopedEvent event("tile", "render", "view", viewTile.m_view, "sample", sample);
+				renderTile(cameras[viewTile.m_view], viewTile.m_tileX, viewTile.m_tileY, sample);
+			}
+
+			#pragma omp critical
+			{
+				nrRenderedTiles++;
+				float renderedPercent = nrRenderedTiles * 100 / float(nrTilesToRender);
+				double renderTimeLeft = (renderTimer.getSeconds() / renderedPercent) * (100 - renderedPercent);
+
+				int hours = (int)renderTimeLeft / (60 * 60);
+				int minutes = (int(renderTimeLeft) % (60 * 60) / 60);
+				int seconds = int(renderTimeLeft) % 60;
+
+				std::cout << renderedPercent << "% of rendering finished" << std::setw(30);
+				std::cout << "Estimated time left: " << hours << "h:" << minutes << "m:" << seconds << "s" << std::endl;
 			}
-			totalColour += pixelColour / (float)m_nrSubsamples;
-			camera->setPixelValues(x, y, totalColour);
 		}
-		renderedPercent = (x + 1) * 100 / float(width);
-		time(&currTime);
-		double renderTimeElapsed = difftime(currTime, startRenderTime);
-		double renderTimeLeft = (renderTimeElapsed / renderedPercent) * (100 - renderedPercent);
+		reportGeometryFrame(sample);
 
-		int hours = (int)renderTimeLeft / (60 * 60);
-		int minutes = (int(renderTimeLeft) % (60 * 60) / 60);
-		int seconds = int(renderTimeLeft) % 60;
+		if (m_timeBudget > 0.0f) {
+			nrSamples = sample + 1 + getNrBudgetedPasses(renderTimer.getSeconds() / (sample + 1));
+			nrTilesToRender = nrTiles * nrSamples;
+		}
+	}
+	if (m_timeBudget > 0.0f) {
+		std::cout << "Time budget: " << nrSamples << " samples per pixel, " << getSecondsLeft() << "s left" << std::endl;
+	}
 
-		std::cout << renderedPercent << "% of rendering finished" << std::setw(30);
-		std::cout << "Estimated time left: " << hours << "h:" << minutes << "m:" << seconds << "s" << std::endl;
+	if (m_heatmap != HEATMAP_NONE) {
+		for (const std::shared_ptr<Camera>& camera : cameras) resolveHeatmap(camera);
+	}
+	if (m_irradianceCache) {
+		std::cout << "Irradiance cache records: " << m_irradianceCache->getNrRecords() << std::endl;
 	}
 }
 
+void Scene::renderTile(std::shared_ptr<Camera> camera, const int tileX, const int tileY, const int sample) {
+	int width = camera->getPixelWidth();
+	int height = camera->getPixelHeight();
+	int tileWidth = glm::min(TILE_SIZE, width - tileX);
+	int tileHeight = glm::min(TILE_SIZE, height - tileY);
+
+	std::vector<FilmSample> samples(tileWidth * tileHeight);
+	std::vector<GatherPoint> gatherPoints;
+	std::vector<float> costs((m_heatmap != HEATMAP_NONE) ? tileWidth * tileHeight : 0);
+	std::vector<float> gatherCosts;
+
+	int i = 0;
+	for (int y = tileY; y < tileY + tileHeight; ++y) {
+		for (int x = tileX; x < tileX + tileWidth; ++x, ++i) {
+			CostSnapshot snapshot;
+			if (m_heatmap != HEATMAP_NONE) snapshot = getCostSnapshot();
+
+			// The random numbers of a sample only depend on the seed, the pixel and the sample number
+			Sampler sampler(m_seed, (uint64_t)y * width + x, sample);
+			float randX = sampler.next() - 0.5f, randY = sampler.next() - 0.5f;
+			RenderStats::add(RenderStats::CAMERA_RAYS);
+			std::shared_ptr<Ray> ray = camera->castCameraRay(
+				x,							// Pixel x
+				(height - y - 1),			// Pixel y
+				randX,						// Parameter x (>= -0.5, < 0.5), for subsampling
+				randY);						// Parameter y (>= -0.5, < 0.5), for subsampling
+			if (!findRayIntersection(ray)) {
+				RenderStats::record(RenderStats::CAMERA_PATH_LENGTH, 0);
+				if (m_heatmap != HEATMAP_NONE) costs[i] = getCostSince(snapshot);
+				continue;
+			}
+
+			// AOVs of the first hit
+			std::shared_ptr<Intersection> intersection = ray->getIntersection();
+			samples[i].m_albedo = intersection->m_material->getColour();
+			samples[i].m_normal = glm::normalize(intersection->m_normal);
+			samples[i].m_depth = intersection->m_t;
+
+			if (m_renderMode == CAUSTICS && ray->hitsLambertianSurface()) {
+				// Caustics of diffuse primary hits are gathered for the whole tile at once
+				GatherPoint gatherPoint;
+				gatherPoint.m_position = intersection->m_intersectionPt + intersection->m_normal * FLT_EPSILON;
+				gatherPoint.m_brdf = intersection->m_material->getColour();
+				gatherPoint.m_sampleIndex = i;
+				gatherPoints.emplace_back(gatherPoint);
+
+				samples[i].m_radiance = shadeIntersection(ray, sampler, 0, false);
+			}
+			else {
+				samples[i].m_radiance = shadeIntersection(ray, sampler, 0);
+			}
+			if (m_heatmap != HEATMAP_NONE) costs[i] = getCostSince(snapshot);
+		}
+	}
+
+	std::vector<glm::vec3> caustics;
+	gatherCaustics(gatherPoints, caustics, (m_heatmap != HEATMAP_NONE) ? &gatherCosts : nullptr);
+	for (int j = 0; j < (int)gatherPoints.size(); ++j) {
+		glm::vec3& colour = samples[gatherPoints[j].m_sampleIndex].m_radiance;
+		colour = glm::clamp(colour + caustics[j], 0.0f, 1.0f);
+	}
+
+	// The heatmap is accumulated like radiance and coloured when the render is done
+	if (m_heatmap != HEATMAP_NONE) {
+		for (int j = 0; j < (int)gatherPoints.size(); ++j) {
+			costs[gatherPoints[j].m_sampleIndex] += gatherCosts[j];
+		}
+		for (int j = 0; j < (int)samples.size(); ++j) {
+			samples[j].m_radiance = glm::vec3(costs[j]);
+		}
+	}
+
+	// Accumulate the samples in a private tile and merge it into the film
+	Film& film = camera->getFilm();
+	FilmTile filmTile = film.createTile(tileX, tileY, tileWidth, tileHeight);
+	i = 0;
+	for (int y = tileY; y < tileY + tileHeight; ++y) {
+		for (int x = tileX; x < tileX + tileWidth; ++x, ++i) {
+			filmTile.addSample(x, y, samples[i]);
+		}
+	}
+	film.mergeTile(filmTile);
+
+	// Only this thread writes to the pixels of the tile during this sample
+	if (m_imageStream) m_imageStream->publishRegion(film, tileX, tileY, tileWidth, tileHeight);
+}
+
 // Path tracer that returns the colour of the hit surface
-glm::vec3 Scene::traceRay(std::shared_ptr<Ray> ray, int depth) {
+glm::vec3 Scene::traceRay(std::shared_ptr<Ray> ray, Sampler& sampler, int depth) {
+	if (depth > 0) RenderStats::add(RenderStats::SECONDARY_RAYS);
+
 	// Check if ray intersects an objects surface
-	if (!findRayIntersection(ray)) return glm::vec3(0.0f);
+	if (!findRayIntersection(ray)) {
+		RenderStats::record(RenderStats::CAMERA_PATH_LENGTH, depth);
+		return glm::vec3(0.0f);
+	}
+
+	return shadeIntersection(ray, sampler, depth);
+}
 
+// Colour of the surface that was hit by the ray
+glm::vec3 Scene::shadeIntersection(std::shared_ptr<Ray> ray, Sampler& sampler, int depth, bool gatherCaustics) {
 	// Russian roulette
-	bool terminateRay = russianRoulette(depth);
+	bool terminateRay = russianRoulette(depth, sampler);
 
 	// Variables
 	glm::vec3 indirectLight = glm::vec3(0.0f);	// Diffuse light (local and global)
@@ -412,7 +777,8 @@ glm::vec3 Scene::traceRay(std::shared_ptr<Ray> ray, int depth) {
 	glm::vec3 brdf = glm::vec3(0.0f);
 
 	// Create reflected ray
-	std::shared_ptr<Ray> reflectedRay = ray->createReflectedRay((*dis)(*gen), (*dis)(*gen));
+	float rand1 = sampler.next(), rand2 = sampler.next();
+	std::shared_ptr<Ray> reflectedRay = ray->createReflectedRay(rand1, rand2);
 	brdf = ray->getBRDFValue(reflectedRay);
 
 	// Check if a light source is hit
@@ -420,104 +786,115 @@ glm::vec3 Scene::traceRay(std::shared_ptr<Ray> ray, int depth) {
 		indirectLight = brdf;
 	}
 	else if (ray->hitsTransparentSurface() && !terminateRay) {
-		indirectLight += traceRefractedRay(ray, depth);
+		indirectLight += traceRefractedRay(ray, sampler, depth);
 	}
 	else if (ray->hitsPerfectReflectorSurface() && !terminateRay) {
-		indirectLight += traceRay(reflectedRay, depth + 1) * 0.98f;
+		indirectLight += traceRay(reflectedRay, sampler, depth + 1) * 0.98f;
 	}
-	/*
-	else if (!terminateRay) { // Note: || for MC and && for PM
-		indirectLight += traceRay(reflectedRay, depth + 1) * brdf * glm::pi<float>();
+	else if (m_irradianceCache && m_renderMode == MONTE_CARLO && ray->hitsDiffuseSurface()) {
+		// Brute force path tracing of the indirect light is too slow, reuse cached final gathers instead
+		indirectLight += traceIndirectDiffuseRay(ray, sampler);
 	}
-	*/
+
+	// Paths end here unless they continue through a transparent or mirror surface
+	bool continuesPath = !terminateRay && !ray->hitsEmissiveSurface() &&
+		(ray->hitsTransparentSurface() || ray->hitsPerfectReflectorSurface());
+	if (!continuesPath) RenderStats::record(RenderStats::CAMERA_PATH_LENGTH, depth + 1);
 
 	// Compute direct lightning
 	if (ray->hitsDiffuseSurface()) {
-		if(m_renderMode == MONTE_CARLO) directLight = traceDiffuseRay(ray); // Direct lightning
-		if(m_renderMode == CAUSTICS) caustics = traceCausticsRay(ray); // Caustics
+		if(m_renderMode == MONTE_CARLO) directLight = traceDiffuseRay(ray, sampler); // Direct lightning
+		if(m_renderMode == CAUSTICS && gatherCaustics) caustics = traceCausticsRay(ray); // Caustics
 	}
 
 	return glm::clamp(directLight + indirectLight + caustics, 0.0f, 1.0f);
 }
 
-glm::vec3 Scene::traceRefractedRay(std::shared_ptr<Ray> ray, int depth) {
+glm::vec3 Scene::traceRefractedRay(std::shared_ptr<Ray> ray, Sampler& sampler, int depth) {
 	std::shared_ptr<Ray> reflectedRay = std::make_shared<Ray>(glm::vec3(0.0f), glm::vec3(0.0f));
 	std::shared_ptr<Ray> refractedRay = ray->createRefractedRay(reflectedRay);
 	//float R = ray->getReflectionCoefficient();
 
 	if (!refractedRay) { // Total reflection
-		return traceRay(reflectedRay, depth + 1);// *R;
+		return traceRay(reflectedRay, sampler, depth + 1);// *R;
 	}
 	else {
 		float R = ray->getReflectionCoefficient();
-		glm::vec3 reflectedLight = traceRay(reflectedRay, depth + 1) * R;
-		glm::vec3 refractedLight = traceRay(refractedRay, depth + 1) * (1.0f - R);
+		glm::vec3 reflectedLight = traceRay(reflectedRay, sampler, depth + 1) * R;
+		glm::vec3 refractedLight = traceRay(refractedRay, sampler, depth + 1) * (1.0f - R);
 		return reflectedLight + refractedLight;
 	}
 }
 
-glm::vec3 Scene::traceDiffuseRay(std::shared_ptr<Ray> ray) {
-	glm::vec3 totalLightContribution = glm::vec3(0.0f);
-	glm::vec3 lightContribution, ptOnEmissive;
-	//glm::vec3 difference = glm::vec3(0.0f);
-	const int nrShadowRays = 1;
-
-	for (int lightIndex : m_lightIndices) {
-		lightContribution = glm::vec3(0.0f);
-		std::shared_ptr<Surface::Base> emissive = m_sceneObjects[lightIndex];
-		for (int i = 0; i < nrShadowRays; i++) {
-			// Create a shadow ray from the ray intersection point towards the a random point on the light
-			ptOnEmissive = emissive->getRandomPointOnSurface((*dis)(*gen), (*dis)(*gen));
-			std::shared_ptr<Ray> shadowRay = ray->createShadowRay(ptOnEmissive);
-			//difference = ptOnEmissive - shadowRay->getStartPt();
-
-			lightContribution += traceShadowRay(ray, shadowRay);
+glm::vec3 Scene::traceDiffuseRay(std::shared_ptr<Ray> ray, Sampler& sampler) {
+	// Direct light from one point on a light picked by its power and from one cosine weighted
+	// direction, weighted by the power heuristic (Veach and Guibas 1995). Light samples do well
+	// for small lights and BRDF samples for large ones, the weights keep the better of the two.
+	glm::vec3 directLight = glm::vec3(0.0f);
+	if (m_lightTable.isEmpty()) return directLight;
+	const float RAY_OFFSET = 1e-4f;
+
+	// Lambertian, as in the final gather (mesh normals are not unit length)
+	std::shared_ptr<Intersection> intersection = ray->getIntersection();
+	glm::vec3 position = intersection->m_intersectionPt;
+	glm::vec3 normal = glm::normalize(intersection->m_normal);
+	if (glm::dot(normal, ray->getDirection()) > 0.0f) normal *= -1.0f;
+	glm::vec3 brdf = intersection->m_material->getColour() * glm::one_over_pi<float>();
+
+	// Light sample, only the picked light counts, the BRDF sample covers lights in front of it
+	float pickPdf;
+	int pickedLight = m_lightTable.sample(sampler.next(), pickPdf);
+	float u = sampler.next(), v = sampler.next();
+	int lightIndex = m_lightIndices[pickedLight];
+	std::shared_ptr<Surface::Base> emissive = m_sceneObjects[lightIndex];
+	glm::vec3 toLight = emissive->getRandomPointOnSurface(u, v) - position;
+	float distance = glm::length(toLight);
+	float cosTheta = (distance > FLT_EPSILON) ? glm::dot(normal, toLight) / distance : 0.0f;
+	if (pickPdf > 0.0f && cosTheta > 0.0f) {
+		glm::vec3 direction = toLight / distance;
+		std::shared_ptr<Ray> shadowRay = std::make_shared<Ray>(position + normal * RAY_OFFSET, direction);
+		RenderStats::add(RenderStats::SHADOW_RAYS);
+		if (findRayIntersection(shadowRay) && shadowRay->getIntersection()->m_objectIndex == lightIndex) {
+			float lightPdf = getLightPdf(lightIndex, direction, distance, shadowRay->getIntersection()->m_normal);
+			float brdfPdf = cosTheta * glm::one_over_pi<float>();
+			if (lightPdf > 0.0f) {
+				glm::vec3 emitted = emissive->getMaterial()->getColour() * emissive->getRadiance();
+				float weight = lightPdf * lightPdf / (lightPdf * lightPdf + brdfPdf * brdfPdf);
+				directLight += weight * brdf * emitted * cosTheta / lightPdf;
+			}
 		}
-		lightContribution *= (emissive->getRadiance() * emissive->getArea()) / nrShadowRays / (glm::pi<float>() * 2.0f);
-		//lightContribution *= emissive->getArea() / nrShadowRays / (glm::pi<float>() * 2.0f);
-		totalLightContribution += lightContribution;
 	}
 
-	return glm::clamp(totalLightContribution, 0.0f, 1.0f);
-}
-
-glm::vec3 Scene::traceShadowRay(std::shared_ptr<Ray> ray, std::shared_ptr<Ray> shadowRay) {
-	glm::vec3 shadowRayDirection = glm::normalize(shadowRay->getDirection());
-
-	// Find an intersection for the shadow ray
-	// http://www.pbr-book.org/3ed-2018/Light_Transport_I_Surface_Reflection/Path_Tracing.html
-	if (!findRayIntersection(shadowRay) || !shadowRay->hitsEmissiveSurface()) return glm::vec3(0.0f);
-
-	// Compute the geometric term
-	// Incoming angle
-	float cosBeta = glm::dot(shadowRayDirection, ray->getIntersection()->m_normal);
-	if (cosBeta < 0.0f) return glm::vec3(0.0f);
-
-	// Outgoing angle
-	float cosAlpha = glm::dot(shadowRay->getIntersection()->m_normal, -shadowRayDirection);
-	if (cosAlpha < 0.0f) return glm::vec3(0.0f);
-
-	//float lengthShadowRay = glm::length(shadowRayDirection);
-	//float lengthSquared = lengthShadowRay * lengthShadowRay;
-
-	// Get brdf of surface
-	glm::vec3 brdf = ray->getBRDFValue(shadowRay);
-
-	glm::vec3 lightNormal = shadowRay->getIntersection()->m_normal;
-	float lightFactor = glm::dot(-shadowRay->getDirection(), lightNormal);
-	if (lightFactor < FLT_EPSILON) {
-		return glm::vec3(0.0f);
+	// BRDF sample, counts if it hits the front of any light. The cosine cancels against its pdf.
+	float rand1 = sampler.next(), rand2 = sampler.next();
+	glm::vec3 direction = glm::normalize(Utility::CosineWeightedHemisphereSampleDirection(normal, rand1, rand2));
+	std::shared_ptr<Ray> brdfRay = std::make_shared<Ray>(position + normal * RAY_OFFSET, direction);
+	RenderStats::add(RenderStats::SHADOW_RAYS);
+	if (findRayIntersection(brdfRay) && brdfRay->hitsEmissiveSurface()) {
+		std::shared_ptr<Intersection> lightIntersection = brdfRay->getIntersection();
+		float brdfPdf = glm::dot(normal, direction) * glm::one_over_pi<float>();
+		if (lightIntersection->m_objectIndex >= 0 && brdfPdf > 0.0f && glm::dot(lightIntersection->m_normal, direction) < 0.0f) {
+			float lightPdf = getLightPdf(lightIntersection->m_objectIndex, direction, lightIntersection->m_t, lightIntersection->m_normal);
+			std::shared_ptr<Surface::Base> hitLight = m_sceneObjects[lightIntersection->m_objectIndex];
+			glm::vec3 emitted = hitLight->getMaterial()->getColour() * hitLight->getRadiance();
+			float weight = brdfPdf * brdfPdf / (lightPdf * lightPdf + brdfPdf * brdfPdf);
+			directLight += weight * brdf * emitted * glm::pi<float>();
+		}
 	}
 
-	// Direct diffuse lighting.
-	const glm::vec3 radiance = lightFactor * brdf;
+	return glm::clamp(directLight, 0.0f, 1.0f);
+}
 
-	// Return shadow ray contribution
-	//glm::vec3 radiance = cosBeta * cosAlpha * brdf;
-	//return brdf * (cosAlpha * cosBeta) / lengthSquared;
-	return glm::clamp(radiance, 0.0f, 1.0f);
+float Scene::getLightPdf(const int objectIndex, const glm::vec3 direction, const float distance, const glm::vec3 lightNormal) const {
+	// Pick probability times the area density of a uniform point, converted to solid angle
+	if (objectIndex < 0 || objectIndex >= (int)m_lightOfObject.size() || m_lightOfObject[objectIndex] < 0) return 0.0f;
+	std::shared_ptr<Surface::Base> emissive = m_sceneObjects[objectIndex];
+	float cosAlpha = -glm::dot(glm::normalize(lightNormal), direction);
+	if (cosAlpha <= FLT_EPSILON || emissive->getArea() <= 0.0f) return 0.0f;
+	return m_lightTable.getPdf(m_lightOfObject[objectIndex]) * distance * distance / (emissive->getArea() * cosAlpha);
 }
 
+
 glm::vec3 Scene::traceCausticsRay(std::shared_ptr<Ray> ray) {
 	// TODO: Check the normals (as they create a black edge/line)
 
@@ -528,6 +905,9 @@ glm::vec3 Scene::traceCausticsRay(std::shared_ptr<Ray> ray) {
 	// Find closest photon to ray intersection point
 	std::vector<KDTreeNode> closestPhotons;
 	m_photonMap.find_within_range(refNode, PHOTON_RADIUS, std::back_insert_iterator<std::vector<KDTreeNode>>(closestPhotons));
+	RenderStats::add(RenderStats::GATHER_QUERIES);
+	RenderStats::add(RenderStats::PHOTONS_GATHERED, closestPhotons.size());
+	RenderStats::record(RenderStats::PHOTONS_PER_QUERY, RenderStats::getLog2Bucket(closestPhotons.size()));
 
 	glm::vec3 brdf, radiance = glm::vec3(0.0f);
 	float photonArea = 0.0f, projectedArea = 0.0f, distance = 0.0f, lenDistance = 0.0f;
@@ -538,7 +918,7 @@ glm::vec3 Scene::traceCausticsRay(std::shared_ptr<Ray> ray) {
 		// Calculate brdf for current photon (using direction of photon and of ray)
 		distance = glm::length(node.p.m_position - refNode.p.m_position);
 		lenDistance = glm::length(distance);
-		brdf = ray->getBRDFValue(node.p.m_direction); // No difference with negative....
+		brdf = ray->getBRDFValue(node.p.getDirection()); // No difference with negative....
 
 		// The area of the photon if its inclination angle
 		// is 90 degrees and the surface is flat.
@@ -546,7 +926,7 @@ glm::vec3 Scene::traceCausticsRay(std::shared_ptr<Ray> ray) {
 		projectedArea = photonArea;
 
 		// Calculate the radiance
-		radiance += closestPhotons[i].p.m_flux *
+		radiance += closestPhotons[i].p.getFlux() * photonArea * glm::pi<float>() *
 			((distance < PHOTON_RADIUS) ? 1.0f : 0.0f) / // this affects the black lines (lines disappear if both give 1.0f
 			(projectedArea * glm::pi<float>() * 2.0f) *
 			brdf; // *(glm::pi<float>() * 2.0f); // Hemisphere
@@ -556,16 +936,678 @@ glm::vec3 Scene::traceCausticsRay(std::shared_ptr<Ray> ray) {
 	return glm::clamp((nrClosePhotons > 0) ? radiance / (float)nrClosePhotons : glm::vec3(0.0f), 0.0f, 1.0f);
 }
 
+void Scene::gatherCaustics(std::vector<GatherPoint>& gatherPoints, std::vector<glm::vec3>& caustics,
+	std::vector<float>* costs) const {
+	caustics.assign(gatherPoints.size(), glm::vec3(0.0f));
+	if (costs) costs->assign(gatherPoints.size(), 0.0f);
+	if (gatherPoints.empty()) return;
+
+	// Blocks are split until they are small enough that one photon map query covers them well
+	std::vector<int> order(gatherPoints.size());
+	for (int i = 0; i < (int)order.size(); ++i) order[i] = i;
+	gatherCausticsBlock(gatherPoints, order.data(), (int)order.size(), caustics, costs);
+}
+
+void Scene::gatherCausticsBlock(const std::vector<GatherPoint>& gatherPoints, int* block, const int blockSize,
+	std::vector<glm::vec3>& caustics, std::vector<float>* costs) const {
+	const int MIN_BLOCK_SIZE = 16;
+
+	// Bounds of the block
+	glm::vec3 blockMin = gatherPoints[block[0]].m_position;
+	glm::vec3 blockMax = blockMin;
+	for (int i = 1; i < blockSize; ++i) {
+		blockMin = glm::min(blockMin, gatherPoints[block[i]].m_position);
+		blockMax = glm::max(blockMax, gatherPoints[block[i]].m_position);
+	}
+
+	// Split along the longest axis if the block spans much more than the photon radius
+	glm::vec3 extent = blockMax - blockMin;
+	int axis = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+	if (blockSize > MIN_BLOCK_SIZE && extent[axis] > 8.0f * PHOTON_RADIUS) {
+		int half = blockSize / 2;
+		std::nth_element(block, block + half, block + blockSize, [&](const int a, const int b) {
+			return gatherPoints[a].m_position[axis] < gatherPoints[b].m_position[axis];
+		});
+		gatherCausticsBlock(gatherPoints, block, half, caustics, costs);
+		gatherCausticsBlock(gatherPoints, block + half, blockSize - half, caustics, costs);
+		return;
+	}
+
+	// One traversal of the photon map for the whole block
+	CostSnapshot snapshot;
+	if (costs) snapshot = getCostSnapshot();
+	KDTreeNode refNode; // Reference node
+	refNode.p.m_position = blockMin;
+	KDTree::KDTree<3, KDTreeNode>::_Region_ region(refNode);
+	for (int k = 0; k < 3; ++k) {
+		region._M_low_bounds[k] = blockMin[k] - PHOTON_RADIUS;
+		region._M_high_bounds[k] = blockMax[k] + PHOTON_RADIUS;
+	}
+
+	std::vector<KDTreeNode> blockPhotons;
+	m_photonMap.find_within_range(region, std::back_insert_iterator<std::vector<KDTreeNode>>(blockPhotons));
+	int nrPhotons = (int)blockPhotons.size();
+	RenderStats::add(RenderStats::GATHER_QUERIES);
+	RenderStats::add(RenderStats::PHOTONS_GATHERED, nrPhotons);
+	RenderStats::record(RenderStats::PHOTONS_PER_QUERY, RenderStats::getLog2Bucket(nrPhotons));
+	if (nrPhotons == 0) {
+		if (costs && m_heatmap == HEATMAP_TIME) {
+			float cost = getCostSince(snapshot) / blockSize;
+			for (int i = 0; i < blockSize; ++i) (*costs)[block[i]] += cost;
+		}
+		return;
+	}
+
+	// Unpack the photons once into flat arrays for the kernel
+	std::vector<float> px(nrPhotons), py(nrPhotons), pz(nrPhotons);
+	std::vector<float> fr(nrPhotons), fg(nrPhotons), fb(nrPhotons);
+	for (int i = 0; i < nrPhotons; ++i) {
+		glm::vec3 flux = blockPhotons[i].p.getFlux();
+		px[i] = blockPhotons[i].p.m_position.x;
+		py[i] = blockPhotons[i].p.m_position.y;
+		pz[i] = blockPhotons[i].p.m_position.z;
+		fr[i] = flux.r;
+		fg[i] = flux.g;
+		fb[i] = flux.b;
+	}
+	const float* pX = px.data(); const float* pY = py.data(); const float* pZ = pz.data();
+	const float* fR = fr.data(); const float* fG = fg.data(); const float* fB = fb.data();
+
+	// Same estimate as traceCausticsRay: photons are counted inside the query box and
+	// contribute inside the sphere. The diffuse brdf does not depend on the photon
+	// direction, so it is applied once per point.
+	const float radius = PHOTON_RADIUS;
+	const float radiusSquared = PHOTON_RADIUS * PHOTON_RADIUS;
+	const float photonArea = PHOTON_RADIUS * PHOTON_RADIUS * glm::pi<float>();
+	const float projectedArea = photonArea;
+	const float fluxScale = photonArea * glm::pi<float>() / (projectedArea * glm::pi<float>() * 2.0f);
+
+	for (int i = 0; i < blockSize; ++i) {
+		const GatherPoint& gatherPoint = gatherPoints[block[i]];
+		const float x = gatherPoint.m_position.x, y = gatherPoint.m_position.y, z = gatherPoint.m_position.z;
+		float sumR = 0.0f, sumG = 0.0f, sumB = 0.0f;
+		int nrClosePhotons = 0;
+
+		#pragma omp simd reduction(+:sumR, sumG, sumB, nrClosePhotons)
+		for (int j = 0; j < nrPhotons; ++j) {
+			float dx = pX[j] - x, dy = pY[j] - y, dz = pZ[j] - z;
+			bool inBox = glm::abs(dx) <= radius && glm::abs(dy) <= radius && glm::abs(dz) <= radius;
+			float inSphere = (inBox && dx * dx + dy * dy + dz * dz < radiusSquared) ? 1.0f : 0.0f;
+			sumR += fR[j] * inSphere;
+			sumG += fG[j] * inSphere;
+			sumB += fB[j] * inSphere;
+			nrClosePhotons += inBox ? 1 : 0;
+		}
+
+		if (nrClosePhotons > 0) {
+			glm::vec3 radiance = glm::vec3(sumR, sumG, sumB) * fluxScale * gatherPoint.m_brdf;
+			caustics[block[i]] = glm::clamp(radiance / (float)nrClosePhotons, 0.0f, 1.0f);
+		}
+	}
+
+	// Every point of the block tests all photons of the block, the query time is shared
+	if (costs && (m_heatmap == HEATMAP_PHOTONS || m_heatmap == HEATMAP_TIME)) {
+		float cost = (m_heatmap == HEATMAP_PHOTONS) ? (float)nrPhotons : getCostSince(snapshot) / blockSize;
+		for (int i = 0; i < blockSize; ++i) (*costs)[block[i]] += cost;
+	}
+}
+
+glm::vec3 Scene::traceIndirectDiffuseRay(std::shared_ptr<Ray> ray, Sampler& sampler) {
+	std::shared_ptr<Intersection> intersection = ray->getIntersection();
+	glm::vec3 position = intersection->m_intersectionPt;
+
+	// Gather on the side of the surface the ray arrived from (mesh normals are not unit length)
+	glm::vec3 normal = glm::normalize(intersection->m_normal);
+	if (glm::dot(normal, ray->getDirection()) > 0.0f) normal *= -1.0f;
+
+	glm::vec3 irradiance;
+	if (!m_irradianceCache->interpolate(position, normal, irradiance)) {
+		IrradianceRecord record = computeIrradianceRecord(position, normal, sampler);
+		m_irradianceCache->insert(record);
+		irradiance = record.m_irradiance;
+	}
+
+	return irradiance * intersection->m_material->getColour() * glm::one_over_pi<float>();
+}
+
+glm::vec3 Scene::getPhotonDensityRadiance(std::shared_ptr<Ray> ray) const {
+	// Flux of the photons inside the gather disc over its area, Jensen 1996. Unlike the caustics
+	// estimate this grows with the nr of photons that reach the point.
+	std::shared_ptr<Intersection> intersection = ray->getIntersection();
+	KDTreeNode refNode; // Reference node
+	refNode.p.m_position = intersection->m_intersectionPt;
+
+	std::vector<KDTreeNode> closestPhotons;
+	m_photonMap.find_within_range(refNode, PHOTON_RADIUS, std::back_insert_iterator<std::vector<KDTreeNode>>(closestPhotons));
+	RenderStats::add(RenderStats::GATHER_QUERIES);
+	RenderStats::add(RenderStats::PHOTONS_GATHERED, closestPhotons.size());
+	RenderStats::record(RenderStats::PHOTONS_PER_QUERY, RenderStats::getLog2Bucket(closestPhotons.size()));
+
+	glm::vec3 flux = glm::vec3(0.0f);
+	for (const KDTreeNode& node : closestPhotons) {
+		if (glm::length(node.p.m_position - refNode.p.m_position) < PHOTON_RADIUS) flux += node.p.getFlux();
+	}
+
+	// Lambertian, as in the rest of the final gather
+	glm::vec3 brdf = intersection->m_material->getColour() * glm::one_over_pi<float>();
+	return flux * brdf * m_photonPower / (glm::pi<float>() * PHOTON_RADIUS * PHOTON_RADIUS);
+}
+
+IrradianceRecord Scene::computeIrradianceRecord(const glm::vec3 position, const glm::vec3 normal, Sampler& sampler) {
+	// Stratified final gather over the hemisphere (Ward and Heckbert 1992).
+	// Radiance at the gathered points is a photon density estimate, light
+	// sources are skipped as the direct light is computed separately.
+	const int M = 8;		// Nr of strata in inclination
+	const int N = 24;		// Nr of strata in azimuth
+	const float MIN_DISTANCE = 0.1f, MAX_DISTANCE = 2.0f;
+	const float GATHER_RAY_OFFSET = 1e-4f;
+
+	// Local frame around the normal
+	glm::vec3 tangent = glm::normalize(glm::cross(Utility::NonParallellVector(normal), normal));
+	glm::vec3 bitangent = glm::cross(normal, tangent);
+
+	std::vector<glm::vec3> radiance(M * N, glm::vec3(0.0f));
+	std::vector<float> distance(M * N, MAX_DISTANCE);
+	float invDistanceSum = 0.0f;
+	glm::vec3 radianceSum = glm::vec3(0.0f);
+
+	for (int j = 0; j < M; ++j) {
+		for (int k = 0; k < N; ++k) {
+			// Cosine weighted direction inside stratum [j, k]
+			float sinTheta = glm::sqrt((j + sampler.next()) / M);
+			float cosTheta = glm::sqrt(glm::max(0.0f, 1.0f - sinTheta * sinTheta));
+			float phi = glm::two_pi<float>() * (k + sampler.next()) / N;
+			glm::vec3 direction = sinTheta * glm::cos(phi) * tangent + sinTheta * glm::sin(phi) * bitangent + cosTheta * normal;
+
+			std::shared_ptr<Ray> gatherRay = std::make_shared<Ray>(position + normal * GATHER_RAY_OFFSET, direction);
+			RenderStats::add(RenderStats::SECONDARY_RAYS);
+			int i = j * N + k;
+			if (findRayIntersection(gatherRay)) {
+				distance[i] = glm::clamp(gatherRay->getIntersection()->m_t, MIN_DISTANCE, MAX_DISTANCE);
+				if (gatherRay->hitsDiffuseSurface()) radiance[i] = getPhotonDensityRadiance(gatherRay);
+			}
+			radianceSum += radiance[i];
+			invDistanceSum += 1.0f / distance[i];
+		}
+	}
+
+	IrradianceRecord record;
+	record.m_position = position;
+	record.m_normal = normal;
+	record.m_irradiance = radianceSum * glm::pi<float>() / (float)(M * N);
+	record.m_harmonicDistance = (float)(M * N) / invDistanceSum;
+	for (int c = 0; c < 3; ++c) {
+		record.m_rotGradient[c] = glm::vec3(0.0f);
+		record.m_transGradient[c] = glm::vec3(0.0f);
+	}
+
+	for (int k = 0; k < N; ++k) {
+		// Directions in the tangent plane, at the centre and at the edge of azimuth stratum k
+		float phiCentre = glm::two_pi<float>() * (k + 0.5f) / N;
+		float phiEdge = glm::two_pi<float>() * k / N;
+		glm::vec3 uCentre = glm::cos(phiCentre) * tangent + glm::sin(phiCentre) * bitangent;
+		glm::vec3 vCentre = -glm::sin(phiCentre) * tangent + glm::cos(phiCentre) * bitangent;
+		glm::vec3 vEdge = -glm::sin(phiEdge) * tangent + glm::cos(phiEdge) * bitangent;
+		int kPrev = (k + N - 1) % N;
+
+		for (int j = 0; j < M; ++j) {
+			int i = j * N + k;
+			float sinTheta = glm::sqrt((j + 0.5f) / M);
+			float cosTheta = glm::sqrt(1.0f - sinTheta * sinTheta);
+			float cosThetaMinus = glm::sqrt(1.0f - (float)j / M);
+			float cosThetaPlus = glm::sqrt(1.0f - (float)(j + 1) / M);
+
+			// Change across the azimuthal edge between strata k - 1 and k
+			glm::vec3 azimuthDelta = (radiance[i] - radiance[j * N + kPrev]) *
+				cosTheta * (cosThetaMinus - cosThetaPlus) / (sinTheta * glm::min(distance[i], distance[j * N + kPrev]));
+
+			// Change across the inclination edge between strata j - 1 and j
+			glm::vec3 inclinationDelta = glm::vec3(0.0f);
+			if (j > 0) {
+				float sinThetaMinus = glm::sqrt((float)j / M);
+				inclinationDelta = (radiance[i] - radiance[i - N]) * glm::two_pi<float>() / (float)N *
+					sinThetaMinus * cosThetaMinus * cosThetaMinus / glm::min(distance[i], distance[i - N]);
+			}
+
+			float tanTheta = sinTheta / cosTheta;
+			for (int c = 0; c < 3; ++c) {
+				record.m_rotGradient[c] -= vCentre * tanTheta * radiance[i][c];
+				record.m_transGradient[c] += uCentre * inclinationDelta[c] + vEdge * azimuthDelta[c];
+			}
+		}
+	}
+	for (int c = 0; c < 3; ++c) {
+		record.m_rotGradient[c] *= glm::pi<float>() / (float)(M * N);
+	}
+
+	// Limit the validity radius where the irradiance changes quickly
+	float maxGradient = glm::max(glm::max(glm::length(record.m_transGradient[0]), glm::length(record.m_transGradient[1])), glm::length(record.m_transGradient[2]));
+	float maxIrradiance = glm::max(glm::max(record.m_irradiance.r, record.m_irradiance.g), record.m_irradiance.b);
+	if (maxGradient > FLT_EPSILON) {
+		record.m_harmonicDistance = glm::min(record.m_harmonicDistance, maxIrradiance / maxGradient);
+	}
+	record.m_harmonicDistance = glm::clamp(record.m_harmonicDistance, MIN_DISTANCE, MAX_DISTANCE);
+
+	return record;
+}
+
+int Scene::renderProgressive(std::shared_ptr<Camera> camera) {
+	// Stochastic progressive photon mapping, Hachisuka and Jensen 2009.
+	// Every pass traces new visible points, emits a new batch of photons and
+	// shrinks the gather radius of each pixel. The photon map only ever holds
+	// one batch, so memory does not grow with the total number of photons.
+	std::cout << "------- Progressive rendering started -------" << std::endl;
+	if (m_lightIndices.empty()) {
+		std::cout << "No lights sources in scene. Could not render progressively :(" << std::endl;
+		return 0;
+	}
+
+	std::chrono::steady_clock::time_point startRenderTime = std::chrono::steady_clock::now();
+
+	int width = camera->getPixelWidth();
+	int height = camera->getPixelHeight();
+	int nrPasses = glm::max(m_nrPasses, 1);
+	int nrPhotonsPerPass = glm::max(m_nrPhotonEmission, 1);
+	double nrEmittedPhotons = 0.0;
+
+	// Per pixel statistics are kept for the whole render
+	std::vector<VisiblePoint> visiblePoints(width * height);
+	for (VisiblePoint& visiblePoint : visiblePoints) {
+		visiblePoint.m_radius = m_initialPhotonRadius;
+	}
+	std::vector<float> costs((m_heatmap != HEATMAP_NONE) ? width * height : 0); // Summed over the passes
+
+	// Continue from the last checkpoint of the same render
+	CheckpointState state = getCheckpointState(camera);
+	int firstPass = 0;
+	if (!m_checkpointPath.empty()) {
+		CheckpointState checkpoint;
+		if (Checkpoint::read(m_checkpointPath, checkpoint, camera->getFilm(), &visiblePoints) &&
+			checkpoint.isCompatible(state) && visiblePoints.size() == (size_t)(width * height)) {
+			firstPass = checkpoint.m_nrCompletedPasses;
+			nrEmittedPhotons = checkpoint.m_nrEmittedPhotons;
+			std::cout << "Resuming from " << m_checkpointPath << " after " << firstPass << " passes" << std::endl;
+			if (m_imageStream) {
+				resolveProgressive(camera, visiblePoints, nrEmittedPhotons, firstPass);
+				m_imageStream->publish(camera->getFilm());
+				m_imageStream->setProgress(firstPass);
+			}
+		}
+		else {
+			visiblePoints.assign(width * height, VisiblePoint());
+			for (VisiblePoint& visiblePoint : visiblePoints) {
+				visiblePoint.m_radius = m_initialPhotonRadius;
+			}
+		}
+	}
+	double lastCheckpointTime = 0.0;
+
+	// With a time budget the first pass gives the throughput of the camera and photon passes
+	if (m_timeBudget > 0.0f) nrPasses = firstPass + 1;
+	std::chrono::steady_clock::time_point budgetStartTime;
+	double photonSeconds = 0.0;
+
+	for (int pass = firstPass; pass < nrPasses; ++pass) {
+		beginGeometryFrame();
+		std::chrono::steady_clock::time_point passStartTime = std::chrono::steady_clock::now();
+
+		// Camera pass: find a visible point for every pixel
+		for (int x = 0; x < width; ++x) {
+			#pragma omp parallel
+			{
+				// The share of every thread, so that stragglers show up in the trace
+				Trace::ScopedEvent event("camera column", "render", "column", x, "pass", pass);
+				#pragma omp for
+				for (int y = 0; y < height; ++y) {
+					CostSnapshot snapshot;
+					if (m_heatmap != HEATMAP_NONE) snapshot = getCostSnapshot();
+
+					Sampler sampler(m_seed, (uint64_t)y * width + x, pass);
+					float randX = sampler.next() - 0.5f, randY = sampler.next() - 0.5f;
+					RenderStats::add(RenderStats::CAMERA_RAYS);
+					std::shared_ptr<Ray> ray = camera->castCameraRay(
+						x,							// Pixel x
+						(height - y - 1),			// Pixel y
+						randX,						// Parameter x (>= -0.5, < 0.5), for subsampling
+						randY);						// Parameter y (>= -0.5, < 0.5), for subsampling
+					traceVisiblePoint(ray, visiblePoints[y * width + x], sampler);
+					if (m_heatmap != HEATMAP_NONE) costs[y * width + x] += getCostSince(snapshot);
+				}
+			}
+		}
+
+		// Photon pass: a fresh batch of photons replaces the previous one
+		std::chrono::steady_clock::time_point photonStartTime = std::chrono::steady_clock::now();
+		m_photonMap.clear();
+		emitPhotons(nrPhotonsPerPass, pass);
+		{
+			RenderStats::ScopedTimer timer(RenderStats::KDTREE_OPTIMIZE);
+			Trace::ScopedEvent event("kd-tree optimize", "build", "photons", (int64_t)m_photonMap.size());
+			m_photonMap.optimize();
+		}
+		nrEmittedPhotons += nrPhotonsPerPass;
+		if (pass == firstPass) photonSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - photonStartTime).count();
+
+		// Gather pass: update flux and radius of every visible point
+		#pragma omp parallel
+		{
+			Trace::ScopedEvent event("gather", "render", "pass", pass);
+			#pragma omp for
+			for (int i = 0; i < width * height; ++i) {
+				CostSnapshot snapshot;
+				if (m_heatmap != HEATMAP_NONE) snapshot = getCostSnapshot();
+				gatherVisiblePoint(visiblePoints[i]);
+				if (m_heatmap != HEATMAP_NONE) costs[i] += getCostSince(snapshot);
+			}
+		}
+
+		// Photons per pass are scaled once so that their share of a pass matches the budget, and the
+		// passes continue while another pass at the average time fits. The estimate is only exact if
+		// the photon pass time grows linearly with the nr of photons, the later passes correct it.
+		if (m_timeBudget > 0.0f) {
+			std::chrono::steady_clock::time_point currTime = std::chrono::steady_clock::now();
+			if (pass == firstPass) {
+				double passSeconds = std::chrono::duration<double>(currTime - passStartTime).count();
+				double share = glm::clamp(photonSeconds / passSeconds, 1e-6, 1.0 - 1e-6);
+				double scale = PHOTON_BUDGET_SHARE * (1.0 - share) / (share * (1.0 - PHOTON_BUDGET_SHARE));
+				int nrFirstPhotons = nrPhotonsPerPass;
+				nrPhotonsPerPass = (int)glm::clamp(nrPhotonsPerPass * scale, 1.0, 16.0 * nrPhotonsPerPass);
+				nrPasses = pass + 1 + getNrBudgetedPasses(passSeconds + photonSeconds * ((double)nrPhotonsPerPass / nrFirstPhotons - 1.0));
+				budgetStartTime = currTime;
+			}
+			else {
+				nrPasses = pass + 1 + getNrBudgetedPasses(std::chrono::duration<double>(currTime - budgetStartTime).count() / (pass - firstPass));
+			}
+		}
+
+		double renderTimeElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startRenderTime).count();
+		std::cout << "Pass " << pass + 1 << "/" << nrPasses << " finished" << std::setw(30);
+		std::cout << "Time elapsed: " << renderTimeElapsed << "s" << std::endl;
+		reportGeometryFrame(pass);
+
+		if (m_imageStream && pass + 1 < nrPasses) {
+			resolveProgressive(camera, visiblePoints, nrEmittedPhotons, pass + 1);
+			m_imageStream->publish(camera->getFilm());
+			m_imageStream->setProgress(pass + 1);
+		}
+
+		if (!m_checkpointPath.empty() && pass + 1 < nrPasses &&
+			renderTimeElapsed - lastCheckpointTime >= m_checkpointInterval) {
+			state.m_nrCompletedPasses = pass + 1;
+			state.m_nrEmittedPhotons = nrEmittedPhotons;
+			if (Checkpoint::write(m_checkpointPath, state, camera->getFilm(), &visiblePoints)) {
+				std::cout << "Checkpoint written after " << pass + 1 << " passes" << std::endl;
+			}
+			lastCheckpointTime = renderTimeElapsed;
+		}
+	}
+	m_photonMap.clear();
+	if (!m_checkpointPath.empty()) std::remove(m_checkpointPath.c_str());
+
+	resolveProgressive(camera, visiblePoints, nrEmittedPhotons, nrPasses);
+	if (m_heatmap != HEATMAP_NONE) {
+		for (int x = 0; x < width; ++x) {
+			for (int y = 0; y < height; ++y) {
+				camera->setPixelValues(x, y, glm::vec3(costs[y * width + x] / (nrPasses - firstPass)));
+			}
+		}
+	}
+	if (m_imageStream) m_imageStream->publish(camera->getFilm());
+
+	if (m_timeBudget > 0.0f) {
+		std::cout << "Time budget: " << nrPasses << " passes of " << nrPhotonsPerPass << " photons, " << nrPasses
+			<< " samples per pixel, " << getSecondsLeft() << "s left" << std::endl;
+	}
+	return nrPasses;
+}
+
+void Scene::resolveProgressive(std::shared_ptr<Camera> camera, const std::vector<VisiblePoint>& visiblePoints,
+	const double nrEmittedPhotons, const int nrCompletedPasses) {
+	int width = camera->getPixelWidth();
+	int height = camera->getPixelHeight();
+	float totalLightPower = getTotalLightPower();
+
+	// Radiance estimate from the accumulated statistics
+	for (int x = 0; x < width; ++x) {
+		for (int y = 0; y < height; ++y) {
+			const VisiblePoint& visiblePoint = visiblePoints[y * width + x];
+			float gatherArea = glm::pi<float>() * visiblePoint.m_radius * visiblePoint.m_radius;
+			glm::vec3 radiance = visiblePoint.m_flux * totalLightPower / (gatherArea * (float)nrEmittedPhotons);
+			glm::vec3 emitted = visiblePoint.m_emitted / (float)nrCompletedPasses;
+			camera->setPixelValues(x, y, glm::clamp(radiance + emitted, 0.0f, 1.0f));
+		}
+	}
+}
+
+void Scene::traceVisiblePoint(std::shared_ptr<Ray> ray, VisiblePoint& visiblePoint, Sampler& sampler) {
+	visiblePoint.m_isValid = false;
+	glm::vec3 throughput = glm::vec3(1.0f);
+
+	// Follow specular bounces until a diffuse surface is found
+	for (int depth = 0; depth <= MAX_DEPTH; ++depth) {
+		if (depth > 0) RenderStats::add(RenderStats::SECONDARY_RAYS);
+		if (!findRayIntersection(ray)) return;
+
+		if (ray->hitsEmissiveSurface()) {
+			visiblePoint.m_emitted += throughput * ray->getIntersection()->m_material->getColour();
+			return;
+		}
+		else if (ray->hitsTransparentSurface()) {
+			// Pick either the reflected or the refracted ray based on the Fresnel term
+			std::shared_ptr<Ray> reflectedRay = std::make_shared<Ray>(glm::vec3(0.0f), glm::vec3(0.0f));
+			std::shared_ptr<Ray> refractedRay = ray->createRefractedRay(reflectedRay);
+			ray = (!refractedRay || sampler.next() < ray->getReflectionCoefficient()) ? reflectedRay : refractedRay;
+		}
+		else if (ray->hitsPerfectReflectorSurface()) {
+			float rand1 = sampler.next(), rand2 = sampler.next();
+			ray = ray->createReflectedRay(rand1, rand2);
+			throughput *= 0.98f;
+		}
+		else if (ray->hitsDiffuseSurface()) {
+			// Diffuse surfaces are treated as Lambertian when gathering photons
+			std::shared_ptr<Intersection> intersection = ray->getIntersection();
+			visiblePoint.m_position = intersection->m_intersectionPt + intersection->m_normal * FLT_EPSILON;
+			visiblePoint.m_normal = intersection->m_normal;
+			visiblePoint.m_weight = throughput * intersection->m_material->getColour() * glm::one_over_pi<float>();
+			visiblePoint.m_isValid = true;
+			return;
+		}
+		else {
+			return;
+		}
+	}
+}
+
+void Scene::gatherVisiblePoint(VisiblePoint& visiblePoint) {
+	if (!visiblePoint.m_isValid) return;
+
+	KDTreeNode refNode; // Reference node
+	refNode.p.m_position = visiblePoint.m_position;
+
+	std::vector<KDTreeNode> closestPhotons;
+	m_photonMap.find_within_range(refNode, visiblePoint.m_radius, std::back_insert_iterator<std::vector<KDTreeNode>>(closestPhotons));
+	RenderStats::add(RenderStats::GATHER_QUERIES);
+	RenderStats::add(RenderStats::PHOTONS_GATHERED, closestPhotons.size());
+	RenderStats::record(RenderStats::PHOTONS_PER_QUERY, RenderStats::getLog2Bucket(closestPhotons.size()));
+
+	// Sum the flux of the photons inside the gather sphere
+	glm::vec3 flux = glm::vec3(0.0f);
+	int nrNewPhotons = 0;
+	for (const KDTreeNode& node : closestPhotons) {
+		if (glm::length(node.p.m_position - visiblePoint.m_position) < visiblePoint.m_radius) {
+			flux += node.p.getFlux() * visiblePoint.m_weight;
+			nrNewPhotons++;
+		}
+	}
+	if (nrNewPhotons == 0) return;
+
+	// Keep a fraction alpha of the new photons and shrink the radius accordingly
+	const float alpha = 0.7f;
+	float nrPhotons = visiblePoint.m_nrPhotons + alpha * nrNewPhotons;
+	float radiusRatio = glm::sqrt(nrPhotons / (visiblePoint.m_nrPhotons + nrNewPhotons));
+
+	visiblePoint.m_flux = (visiblePoint.m_flux + flux) * radiusRatio * radiusRatio;
+	visiblePoint.m_radius *= radiusRatio;
+	visiblePoint.m_nrPhotons = nrPhotons;
+}
+
+Scene::CostSnapshot Scene::getCostSnapshot() const {
+	CostSnapshot snapshot;
+	const uint64_t* counters = RenderStats::getThreadStats().m_counters;
+	switch (m_heatmap) {
+	case HEATMAP_NODES:		snapshot.m_count = counters[RenderStats::NODE_VISITS]; break;
+	case HEATMAP_TRIANGLES:	snapshot.m_count = counters[RenderStats::TRIANGLE_TESTS]; break;
+	case HEATMAP_PHOTONS:	snapshot.m_count = counters[RenderStats::PHOTONS_GATHERED]; break;
+	default:				snapshot.m_count = 0; break;
+	}
+	if (m_heatmap == HEATMAP_TIME) snapshot.m_time = std::chrono::steady_clock::now();
+	return snapshot;
+}
+
+float Scene::getCostSince(const CostSnapshot& snapshot) const {
+	if (m_heatmap == HEATMAP_TIME) {
+		return (float)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - snapshot.m_time).count();
+	}
+	return (float)(getCostSnapshot().m_count - snapshot.m_count);
+}
+
+void Scene::resolveHeatmap(std::shared_ptr<Camera> camera) const {
+	static const char* NAMES[] = { "", "octree node visits", "triangle tests", "photons gathered", "nanoseconds" };
+	Film& film = camera->getFilm();
+	int width = film.getWidth();
+	int height = film.getHeight();
+	if (width <= 0 || height <= 0) return;
+
+	// The colour scale ends at the 99th percentile, so that a few expensive pixels do not hide the rest
+	std::vector<float> costs(width * height);
+	float maxCost = 0.0f;
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			costs[y * width + x] = film.getPixel(x, y).r;
+			maxCost = glm::max(maxCost, costs[y * width + x]);
+		}
+	}
+	std::vector<float> sorted = costs;
+	std::vector<float>::iterator percentile = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+	std::nth_element(sorted.begin(), percentile, sorted.end());
+	float scale = (*percentile > 0.0f) ? *percentile : ((maxCost > 0.0f) ? maxCost : 1.0f);
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			film.setPixel(x, y, getHeatColour(costs[y * width + x] / scale));
+		}
+	}
+	std::cout << "Heatmap of " << NAMES[m_heatmap] << " per sample: white at " << scale << ", maximum " << maxCost << std::endl;
+}
+
+CheckpointState Scene::getCheckpointState(std::shared_ptr<Camera> camera) const {
+	CheckpointState state;
+	state.m_seed = m_seed;
+	state.m_renderMode = m_renderMode;
+	state.m_width = camera->getPixelWidth();
+	state.m_height = camera->getPixelHeight();
+	state.m_aovs = camera->getFilm().getAOVs();
+	state.m_nrPasses = (m_renderMode == PROGRESSIVE) ? glm::max(m_nrPasses, 1) : m_nrSubsamples;
+	state.m_nrPhotonEmission = m_nrPhotonEmission;
+	state.m_shardMode = m_shardMode;
+	state.m_shardIndex = m_shardIndex;
+	state.m_nrShards = m_nrShards;
+	return state;
+}
+
+double Scene::getSecondsLeft() const {
+	return std::chrono::duration<double>(m_deadline - std::chrono::steady_clock::now()).count();
+}
+
+int Scene::getNrBudgetedPasses(const double secondsPerPass) const {
+	double secondsLeft = getSecondsLeft();
+	if (secondsLeft <= 0.0 || secondsPerPass <= 0.0) return 0;
+	return (int)glm::min(secondsLeft / secondsPerPass, (double)std::numeric_limits<int>::max() / 2);
+}
+
+void Scene::collectOutOfCoreOctrees() {
+	// Instances of a mesh have their own octree
+	m_outOfCoreOctrees.clear();
+	for (const std::shared_ptr<Surface::Base>& object : m_sceneObjects) {
+		std::shared_ptr<Surface::Mesh> mesh = std::dynamic_pointer_cast<Surface::Mesh>(object);
+		if (mesh && mesh->getOctree()->isTrackingClusters()) m_outOfCoreOctrees.emplace_back(mesh->getOctree());
+	}
+}
+
+void Scene::beginGeometryFrame() {
+	if (m_outOfCoreOctrees.empty()) return;
+	for (const std::shared_ptr<OctreeAABB>& octree : m_outOfCoreOctrees) {
+		octree->beginFrame();
+	}
+	m_pageFaultCount = MappedFile::getPageFaultCount();
+}
+
+void Scene::reportGeometryFrame(const int frame) {
+	if (m_outOfCoreOctrees.empty()) return;
+	OctreeAABB::ClusterStats total;
+	for (const std::shared_ptr<OctreeAABB>& octree : m_outOfCoreOctrees) {
+		OctreeAABB::ClusterStats stats = octree->getClusterStats();
+		total.m_nrClusters += stats.m_nrClusters;
+		total.m_nrUsed += stats.m_nrUsed;
+		total.m_nrMisses += stats.m_nrMisses;
+	}
+	uint64_t pageFaults = MappedFile::getPageFaultCount() - m_pageFaultCount;
+
+	float missRate = (total.m_nrUsed > 0) ? 100.0f * total.m_nrMisses / (float)total.m_nrUsed : 0.0f;
+	std::cout << "Frame " << frame + 1 << " geometry: " << total.m_nrUsed << "/" << total.m_nrClusters << " clusters used, "
+		<< total.m_nrMisses << " cluster misses (" << missRate << "%), " << pageFaults << " page faults" << std::endl;
+}
+
+void Scene::buildLightTable() {
+	// Emitted power of each light, the mean colour is its share of the white radiance
+	std::vector<float> powers;
+	m_lightOfObject.assign(m_sceneObjects.size(), -1);
+	for (int lightIndex : m_lightIndices) {
+		m_lightOfObject[lightIndex] = (int)powers.size();
+		std::shared_ptr<Surface::Base> emissive = m_sceneObjects[lightIndex];
+		glm::vec3 colour = emissive->getMaterial()->getColour();
+		powers.emplace_back((colour.r + colour.g + colour.b) / 3 * emissive->getRadiance() * emissive->getArea());
+	}
+	m_lightTable.build(powers);
+	m_isLightTableBuilt = true;
+}
+
+void Scene::updateLightTable() {
+	// Lights can be added after the scene is created, the table is built before it is used
+	if (!m_isLightTableBuilt) buildLightTable();
+}
+
+float Scene::getLightPower(const int objectIndex) const {
+	// Emitted radiance times area over the hemisphere gives the emissivity of the light
+	std::shared_ptr<Surface::Base> emissive = m_sceneObjects[objectIndex];
+	return emissive->getRadiance() * emissive->getArea() * glm::pi<float>();
+}
+
+float Scene::getTotalLightPower() const {
+	float totalPower = 0.0f;
+	for (int lightIndex : m_lightIndices) totalPower += getLightPower(lightIndex);
+	return totalPower;
+}
+
 // TODO: Should probably change photonRadiance to a reference
-glm::vec3 Scene::tracePhotonRay(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance, int depth) {
+glm::vec3 Scene::tracePhotonRay(std::shared_ptr<Ray> ray, Sampler& sampler, glm::vec3 photonRadiance, int depth) {
+	RenderStats::add(RenderStats::PHOTON_RAYS);
+
 	// Check if ray intersects an objects surface
-	if (!findRayIntersection(ray)) return photonRadiance;
+	if (!findRayIntersection(ray)) {
+		RenderStats::record(RenderStats::PHOTON_PATH_LENGTH, depth);
+		return photonRadiance;
+	}
 
 	// Russian roulette
-	bool terminateRay = russianRoulette(depth);
+	bool terminateRay = russianRoulette(depth, sampler);
+	bool continuesPath = !terminateRay && !ray->hitsEmissiveSurface() &&
+		(ray->hitsTransparentSurface() || !ray->hitsPerfectReflectorSurface());
+	if (!continuesPath) RenderStats::record(RenderStats::PHOTON_PATH_LENGTH, depth + 1);
 
 	// Create reflected ray
-	std::shared_ptr<Ray> reflectedRay = ray->createReflectedRay((*dis)(*gen), (*dis)(*gen));
+	float rand1 = sampler.next(), rand2 = sampler.next();
+	std::shared_ptr<Ray> reflectedRay = ray->createReflectedRay(rand1, rand2);
 	glm::vec3 brdf = ray->getBRDFValue(reflectedRay); // Might not need this one
 
 	// Could change this to be only recursive for transparent and reflective surfaces
@@ -573,12 +1615,12 @@ glm::vec3 Scene::tracePhotonRay(std::shared_ptr<Ray> ray, glm::vec3 photonRadian
 		photonRadiance += brdf; // Could multiply with surface colour for different coloured lights
 	}
 	else if (ray->hitsTransparentSurface() && !terminateRay) {
-		photonRadiance += traceRefractedPhotonRay(ray, photonRadiance, depth);
+		photonRadiance += traceRefractedPhotonRay(ray, sampler, photonRadiance, depth);
  	}
 	else if (!ray->hitsPerfectReflectorSurface() && !terminateRay) { // Should it be && or ||?? Probably && 
 		// TODO: Test which should be used (&& or ||)
 		// Continue traversing
-		photonRadiance += tracePhotonRay(reflectedRay, photonRadiance, depth + 1) * brdf;
+		photonRadiance += tracePhotonRay(reflectedRay, sampler, photonRadiance, depth + 1) * brdf;
 	}
 
 	if (ray->hitsDiffuseSurface()) {
@@ -589,7 +1631,7 @@ glm::vec3 Scene::tracePhotonRay(std::shared_ptr<Ray> ray, glm::vec3 photonRadian
 	return photonRadiance;
 }
 
-glm::vec3 Scene::tracePhotonShadowRay(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance) {
+glm::vec3 Scene::tracePhotonShadowRay(std::shared_ptr<Ray> ray, Sampler& sampler, glm::vec3 photonRadiance) {
 	glm::vec3 totalLightContribution = glm::vec3(0.0f);
 	glm::vec3 lightContribution, ptOnEmissive;
 
@@ -598,11 +1640,13 @@ glm::vec3 Scene::tracePhotonShadowRay(std::shared_ptr<Ray> ray, glm::vec3 photon
 		std::shared_ptr<Surface::Base> emissive = m_sceneObjects[lightIndex];
 
 		// Create a shadow ray from the ray intersection point towards the a random point on the light
-		ptOnEmissive = emissive->getRandomPointOnSurface((*dis)(*gen), (*dis)(*gen));
+		float u = sampler.next(), v = sampler.next();
+		ptOnEmissive = emissive->getRandomPointOnSurface(u, v);
 		std::shared_ptr<Ray> shadowRay = ray->createShadowRay(ptOnEmissive);
 
 		glm::vec3 shadowRayDirection = glm::normalize(shadowRay->getDirection());
 		//ray = shadowRay;
+		RenderStats::add(RenderStats::SHADOW_RAYS);
 
 		if (!findRayIntersection(shadowRay) || !shadowRay->hitsEmissiveSurface() && !shadowRay->hitsTransparentSurface()) return glm::vec3(0.0f);
 		/*
@@ -628,17 +1672,17 @@ glm::vec3 Scene::tracePhotonShadowRay(std::shared_ptr<Ray> ray, glm::vec3 photon
 	return photonRadiance;
 }
 
-glm::vec3 Scene::traceRefractedPhotonRay(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance, int depth) {
+glm::vec3 Scene::traceRefractedPhotonRay(std::shared_ptr<Ray> ray, Sampler& sampler, glm::vec3 photonRadiance, int depth) {
 	std::shared_ptr<Ray> reflectedRay = std::make_shared<Ray>(glm::vec3(0.0f), glm::vec3(0.0f));
 	std::shared_ptr<Ray> refractedRay = ray->createRefractedRay(reflectedRay);
 	float R = ray->getReflectionCoefficient();
 
 	if (!refractedRay) { // Total reflection
-		return tracePhotonRay(reflectedRay, photonRadiance, depth + 1) * R;
+		return tracePhotonRay(reflectedRay, sampler, photonRadiance, depth + 1) * R;
 	}
 	else {
-		glm::vec3 reflectedLight = tracePhotonRay(reflectedRay, photonRadiance, depth + 1) * R;
-		glm::vec3 refractedLight = tracePhotonRay(refractedRay, photonRadiance, depth + 1) * (1.0f - R);
+		glm::vec3 reflectedLight = tracePhotonRay(reflectedRay, sampler, photonRadiance, depth + 1) * R;
+		glm::vec3 refractedLight = tracePhotonRay(refractedRay, sampler, photonRadiance, depth + 1) * (1.0f - R);
 		return reflectedLight + refractedLight;
 	}
 }
@@ -659,15 +1703,12 @@ void Scene::addPhotonToMap(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance, i
 	// Create photon
 	Photon p;
 	p.m_position = photonOrigin;
-	p.m_direction = photonDirection; 
+	p.setDirection(photonDirection);
 
-	float photonArea = PHOTON_RADIUS * PHOTON_RADIUS * glm::pi<float>();
-	float projectedArea = photonArea;
-	float solidAngle = glm::pi<float>();
 	float nonTerminationProbablity = (depth == 0) ? 1.0f : 0.8f;
 
-	// Calculate photon flux
-	p.m_flux = photonRadiance / nonTerminationProbablity * projectedArea * solidAngle;
+	// Calculate photon flux (the footprint of the photon is applied when the map is gathered)
+	p.setFlux(photonRadiance / nonTerminationProbablity);
 
 	// Create KDtree node and add to photon map
 	KDTreeNode node;
@@ -676,20 +1717,33 @@ void Scene::addPhotonToMap(std::shared_ptr<Ray> ray, glm::vec3 photonRadiance, i
 }
 
 bool Scene::findRayIntersection(std::shared_ptr<Ray> ray) {
+	RenderStats::add(RenderStats::TRACED_RAYS);
 	bool hasIntersected = false;
-	for (auto& object : m_sceneObjects) {
-		if (object->intersect(ray) && !hasIntersected) {
+	for (int i = 0; i < (int)m_sceneObjects.size(); ++i) {
+		// A closer hit replaces the intersection of the ray, an object may replace it several times
+		const std::shared_ptr<Intersection>& intersection = ray->getIntersection();
+		float previousT = (intersection) ? intersection->m_t : std::numeric_limits<float>::infinity();
+		if (m_sceneObjects[i]->intersect(ray)) {
 			hasIntersected = true;
+			if (intersection && intersection->m_t < previousT) intersection->m_objectIndex = i;
 		}
 	}
 	return hasIntersected;
 }
 
-bool Scene::russianRoulette(const int depth) {
+bool Scene::russianRoulette(const int depth, Sampler& sampler) {
 	// Russian roulette
 	// http://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/Russian_Roulette_and_Splitting.html
-	float rand = (*dis)(*gen);
+	float rand = sampler.next();
 	float nonTerminationProbability = (depth == 0) ? 1.0f : 0.8f;
 
-	return (rand > nonTerminationProbability || depth > MAX_DEPTH);
+	if (rand > nonTerminationProbability) {
+		RenderStats::add(RenderStats::RUSSIAN_ROULETTE_TERMINATIONS);
+		return true;
+	}
+	if (depth > MAX_DEPTH) {
+		RenderStats::add(RenderStats::DEPTH_TERMINATIONS);
+		return true;
+	}
+	return false;
 }
\ No newline at end of file
@@ -0,0 +1,381 @@
+#include "../include/Scene.h"
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <algorithm>
+#include <cstring>
+
+#include "../external/glm/glm/gtc/matrix_transform.hpp"
+#include "../external/glm/glm/gtc/constants.hpp"
+#include "../external/glm/glm/gtx/rotate_vector.hpp"
+
+namespace {
+	struct MeshEntry {
+		int m_objectIndex;		// Index in the scene object list
+		int m_sourceIndex;		// Entry with the same file and transform that is loaded, -1 if this entry is loaded
+		int m_lineNr;			// Line of the mesh in the scene file
+		glm::mat4 m_transform;
+		std::string m_filePath;
+		std::shared_ptr<Material> m_material;
+	};
+
+	bool readVec3(std::istringstream& line, glm::vec3& v) {
+		return (bool)(line >> v.x >> v.y >> v.z);
+	}
+
+	bool isEmissive(const std::shared_ptr<Material>& material) {
+		return std::dynamic_pointer_cast<EmissiveMaterial>(material) != nullptr;
+	}
+}
+
+/**************** Scene file ****************/
+// Line based format, '#' starts a comment. Objects are added in file order.
+//
+// set <width|height|photons|subsamples|passes> <int>
+// set mode <caustics|montecarlo|progressive>
+// set heatmap <off|nodes|triangles|photons|time>
+// set irradiancecache <on|off> [accuracy]
+// set aov <albedo|normal|depth>...
+// set output <image path, .ppm .pfm or .hdr>
+// set seed <int>
+// set checkpoint <path> [interval in seconds]
+// set stream <path>
+// set outofcore <on|off>
+// set weld <epsilon> (snap mesh vertices to a grid and merge them, 0 only merges identical vertices)
+// set stats <path>
+// set trace <path>
+// set shard <tiles|samples> <index> <nr shards> <path> (film of one worker, combined with merge/merge.cpp)
+// camera <eye xyz> <center xyz> <up xyz> <fov degrees>
+// view <output path> <eye xyz> <center xyz> <up xyz> <fov degrees>
+// turntable <nr views> <output path> (views around the camera center, named path_000.ext and so on)
+//
+// If there are views only the views are rendered, the camera is then only used by turntable.
+// material <name> lambertian <colour rgb>
+// material <name> orennayar <colour rgb> <roughness>
+// material <name> mirror
+// material <name> transparent <refraction index>
+// material <name> emissive <colour rgb> <emissivity>
+// triangle <material> <v0> <v1> <v2>
+// plane <material> <v0> <v1> <v2> <v3>
+// box <material> <origin xyz> <dimension xyz>
+// sphere <material> <radius> <origin xyz>
+// mesh <material> <obj path> [translate xyz] [rotate <degrees> <axis xyz>] [scale xyz]
+//
+// Objects with an emissive material are light sources. Meshes are loaded in
+// parallel after the whole file has been read.
+std::shared_ptr<Scene> Scene::loadScene(const std::string& filePath, RenderSettings& settings) {
+	std::cout << "------- Loading scene " << filePath << " -------" << std::endl;
+	std::ifstream file(filePath);
+	if (!file) {
+		std::cout << "Could not open scene file " << filePath << std::endl;
+		return nullptr;
+	}
+
+	std::shared_ptr<Scene> scene = std::make_shared<Scene>();
+	std::map<std::string, std::shared_ptr<Material>> materials;
+	std::vector<MeshEntry> meshes;
+
+	std::string text;
+	int lineNr = 0;
+	while (std::getline(file, text)) {
+		lineNr++;
+		size_t comment = text.find('#');
+		if (comment != std::string::npos) text.erase(comment);
+
+		std::istringstream line(text);
+		std::string keyword;
+		if (!(line >> keyword)) continue;
+
+		std::string error;
+		if (keyword == "set") {
+			std::string name;
+			line >> name;
+			if (name == "mode") {
+				std::string mode;
+				line >> mode;
+				if (mode == "caustics")			settings.m_renderMode = CAUSTICS;
+				else if (mode == "montecarlo")	settings.m_renderMode = MONTE_CARLO;
+				else if (mode == "progressive")	settings.m_renderMode = PROGRESSIVE;
+				else error = "unknown render mode '" + mode + "'";
+			}
+			else if (name == "heatmap") {
+				std::string heatmap;
+				line >> heatmap;
+				if (!parseHeatmap(heatmap, settings.m_heatmap)) error = "unknown heatmap '" + heatmap + "'";
+			}
+			else if (name == "outofcore") {
+				std::string state;
+				line >> state;
+				settings.m_outOfCore = (state == "on");
+			}
+			else if (name == "weld") {
+				if (!(line >> settings.m_weldEpsilon) || settings.m_weldEpsilon < 0.0f) error = "expected a weld epsilon of 0 or more";
+			}
+			else if (name == "irradiancecache") {
+				std::string state;
+				line >> state;
+				settings.m_irradianceCaching = (state == "on");
+				float accuracy;
+				if (line >> accuracy) settings.m_irradianceAccuracy = accuracy;
+			}
+			else if (name == "seed") {
+				unsigned long long seed;
+				if (line >> seed) settings.m_seed = seed;
+				else error = "expected a seed";
+			}
+			else if (name == "checkpoint") {
+				int interval;
+				if (!(line >> settings.m_checkpointPath)) error = "expected a checkpoint path";
+				else if (line >> interval) settings.m_checkpointInterval = interval;
+			}
+			else if (name == "stats") {
+				if (!(line >> settings.m_statsPath)) error = "expected a stats path";
+			}
+			else if (name == "shard") {
+				std::string mode;
+				line >> mode;
+				if (!parseShard(mode, settings.m_shardMode) ||
+					!(line >> settings.m_shardIndex >> settings.m_nrShards >> settings.m_shardPath) ||
+					settings.m_nrShards <= 0 || settings.m_shardIndex < 0 || settings.m_shardIndex >= settings.m_nrShards) {
+					error = "expected tiles or samples, an index below the nr of shards and a path";
+				}
+			}
+			else if (name == "budget") {
+				if (!(line >> settings.m_timeBudget) || settings.m_timeBudget <= 0.0f) error = "expected a time budget in seconds";
+			}
+			else if (name == "trace") {
+				if (!(line >> settings.m_tracePath)) error = "expected a trace path";
+			}
+			else if (name == "stream") {
+				if (!(line >> settings.m_imageStreamPath)) error = "expected a stream path";
+			}
+			else if (name == "output") {
+				if (!(line >> settings.m_outputPath)) error = "expected an image path";
+			}
+			else if (name == "aov") {
+				std::string aov;
+				while (error.empty() && line >> aov) {
+					if (aov == "albedo")		settings.m_aovs |= Film::AOV_ALBEDO;
+					else if (aov == "normal")	settings.m_aovs |= Film::AOV_NORMAL;
+					else if (aov == "depth")	settings.m_aovs |= Film::AOV_DEPTH;
+					else error = "unknown AOV '" + aov + "'";
+				}
+			}
+			else {
+				int value;
+				if (!(line >> value) || value <= 0) error = "expected a positive integer";
+				else if (name == "width")		settings.m_width = value;
+				else if (name == "height")		settings.m_height = value;
+				else if (name == "photons")		settings.m_nrPhotonEmission = value;
+				else if (name == "subsamples")	settings.m_nrSubsamples = value;
+				else if (name == "passes")		settings.m_nrPasses = value;
+				else error = "unknown setting '" + name + "'";
+			}
+		}
+		else if (keyword == "camera") {
+			float fov;
+			if (!readVec3(line, settings.m_eye) || !readVec3(line, settings.m_center) ||
+				!readVec3(line, settings.m_up) || !(line >> fov)) error = "expected eye, center, up and fov";
+			else settings.m_fov = glm::radians(fov);
+		}
+		else if (keyword == "view") {
+			RenderSettings::View view;
+			float fov;
+			if (!(line >> view.m_outputPath) || !readVec3(line, view.m_eye) || !readVec3(line, view.m_center) ||
+				!readVec3(line, view.m_up) || !(line >> fov)) error = "expected output, eye, center, up and fov";
+			else {
+				view.m_fov = glm::radians(fov);
+				settings.m_views.emplace_back(view);
+			}
+		}
+		else if (keyword == "turntable") {
+			int nrViews;
+			std::string outputPath;
+			if (!(line >> nrViews >> outputPath) || nrViews <= 0) error = "expected the nr of views and an output path";
+			else {
+				// The eye of the current camera is rotated around the up axis through the center
+				size_t dot = outputPath.find_last_of('.');
+				std::string stem = (dot == std::string::npos) ? outputPath : outputPath.substr(0, dot);
+				std::string extension = (dot == std::string::npos) ? "" : outputPath.substr(dot);
+				for (int i = 0; i < nrViews; ++i) {
+					std::string index = std::to_string(i);
+					RenderSettings::View view;
+					view.m_outputPath = stem + "_" + std::string((index.size() < 3) ? 3 - index.size() : 0, '0') + index + extension;
+					view.m_eye = settings.m_center + glm::rotate(settings.m_eye - settings.m_center,
+						glm::two_pi<float>() * i / nrViews, glm::normalize(settings.m_up));
+					view.m_center = settings.m_center;
+					view.m_up = settings.m_up;
+					view.m_fov = settings.m_fov;
+					settings.m_views.emplace_back(view);
+				}
+			}
+		}
+		else if (keyword == "material") {
+			std::string name, type;
+			glm::vec3 colour;
+			float value;
+			line >> name >> type;
+			if (type == "lambertian" && readVec3(line, colour)) {
+				materials[name] = std::make_shared<LambertianMaterial>(colour);
+			}
+			else if (type == "orennayar" && readVec3(line, colour) && line >> value) {
+				materials[name] = std::make_shared<OrenNayarMaterial>(colour, value);
+			}
+			else if (type == "mirror") {
+				materials[name] = std::make_shared<PerfectReflectorMaterial>();
+			}
+			else if (type == "transparent" && line >> value) {
+				materials[name] = std::make_shared<TransparentMaterial>(value);
+			}
+			else if (type == "emissive" && readVec3(line, colour) && line >> value) {
+				materials[name] = std::make_shared<EmissiveMaterial>(colour, value);
+			}
+			else error = "invalid material '" + name + "'";
+		}
+		else {
+			// Scene objects
+			std::string materialName;
+			line >> materialName;
+			auto it = materials.find(materialName);
+			if (it == materials.end()) {
+				std::cout << "Scene file " << filePath << ":" << lineNr << ": unknown material '" << materialName << "'" << std::endl;
+				return nullptr;
+			}
+			std::shared_ptr<Material> material = it->second;
+			bool emissive = isEmissive(material);
+
+			glm::vec3 v0, v1, v2, v3;
+			float radius;
+			if (keyword == "triangle") {
+				if (readVec3(line, v0) && readVec3(line, v1) && readVec3(line, v2)) scene->addTriangle(v0, v1, v2, material, emissive);
+				else error = "expected 3 vertices";
+			}
+			else if (keyword == "plane") {
+				if (readVec3(line, v0) && readVec3(line, v1) && readVec3(line, v2) && readVec3(line, v3)) scene->addPlane(v0, v1, v2, v3, material, emissive);
+				else error = "expected 4 vertices";
+			}
+			else if (keyword == "box") {
+				if (readVec3(line, v0) && readVec3(line, v1)) scene->addBox(v0, v1, material, emissive);
+				else error = "expected origin and dimension";
+			}
+			else if (keyword == "sphere") {
+				if (line >> radius && readVec3(line, v0)) scene->addSphere(radius, v0, material, emissive);
+				else error = "expected radius and origin";
+			}
+			else if (keyword == "mesh") {
+				MeshEntry entry;
+				entry.m_material = material;
+				entry.m_sourceIndex = -1;
+				entry.m_lineNr = lineNr;
+				entry.m_transform = glm::mat4(1.0f);
+				if (!(line >> entry.m_filePath)) error = "expected an OBJ file";
+				else if (!settings.m_meshDirectory.empty()) {
+					entry.m_filePath = settings.m_meshDirectory + "/" + entry.m_filePath.substr(entry.m_filePath.find_last_of("/\\") + 1);
+				}
+
+				// Transforms are composed in the order they are written, as with glm::translate etc.
+				std::string operation;
+				while (error.empty() && line >> operation) {
+					float angle;
+					if (operation == "translate" && readVec3(line, v0)) {
+						entry.m_transform = glm::translate(entry.m_transform, v0);
+					}
+					else if (operation == "rotate" && line >> angle && readVec3(line, v0)) {
+						entry.m_transform = glm::rotate(entry.m_transform, glm::radians(angle), v0);
+					}
+					else if (operation == "scale" && readVec3(line, v0)) {
+						entry.m_transform = glm::scale(entry.m_transform, v0);
+					}
+					else error = "invalid transform '" + operation + "'";
+				}
+
+				// Meshes are created later, reserve their place in the object list
+				entry.m_objectIndex = (int)scene->m_sceneObjects.size();
+				scene->m_sceneObjects.emplace_back(nullptr);
+				if (emissive) scene->m_lightIndices.emplace_back(entry.m_objectIndex);
+
+				// The same file with the same transform is only loaded once
+				for (int i = 0; i < (int)meshes.size(); ++i) {
+					if (meshes[i].m_sourceIndex < 0 && meshes[i].m_filePath == entry.m_filePath &&
+						std::memcmp(&meshes[i].m_transform, &entry.m_transform, sizeof(glm::mat4)) == 0) {
+						entry.m_sourceIndex = i;
+						break;
+					}
+				}
+				meshes.emplace_back(entry);
+			}
+			else error = "unknown keyword '" + keyword + "'";
+		}
+
+		if (!error.empty()) {
+			std::cout << "Scene file " << filePath << ":" << lineNr << ": " << error << std::endl;
+			return nullptr;
+		}
+	}
+
+	// Load meshes and build their octrees in parallel, largest files first
+	std::vector<int> loadOrder;
+	std::vector<long long> fileSizes(meshes.size(), 0);
+	for (int i = 0; i < (int)meshes.size(); ++i) {
+		if (meshes[i].m_sourceIndex >= 0) continue;
+		std::ifstream meshFile(meshes[i].m_filePath, std::ios::binary | std::ios::ate);
+		if (meshFile) fileSizes[i] = (long long)meshFile.tellg();
+		loadOrder.emplace_back(i);
+	}
+	std::stable_sort(loadOrder.begin(), loadOrder.end(), [&](int a, int b) { return fileSizes[a] > fileSizes[b]; });
+
+	// A single mesh leaves the threads to the parallel parse and weld inside
+	// the mesh, nested parallel regions would only get one thread each
+	std::vector<std::shared_ptr<Surface::Mesh>> loadedMeshes(meshes.size());
+#pragma omp parallel for schedule(dynamic, 1) if (loadOrder.size() > 1)
+	for (int i = 0; i < (int)loadOrder.size(); ++i) {
+		const MeshEntry& entry = meshes[loadOrder[i]];
+		loadedMeshes[loadOrder[i]] = std::make_shared<Surface::Mesh>(entry.m_transform, entry.m_filePath.c_str(), entry.m_material, settings.m_outOfCore,
+			settings.m_rebuildMeshCache, settings.m_weldEpsilon);
+	}
+
+	for (int i : loadOrder) {
+		if (!loadedMeshes[i]->isLoaded()) {
+			std::cout << "Scene file " << filePath << ":" << meshes[i].m_lineNr << ": could not load mesh " << meshes[i].m_filePath << std::endl;
+			return nullptr;
+		}
+	}
+
+	for (int i = 0; i < (int)meshes.size(); ++i) {
+		const MeshEntry& entry = meshes[i];
+		if (entry.m_sourceIndex >= 0) {
+			// Instance sharing the geometry of an already loaded mesh
+			loadedMeshes[i] = std::make_shared<Surface::Mesh>(*loadedMeshes[entry.m_sourceIndex], entry.m_material);
+		}
+		scene->m_sceneObjects[entry.m_objectIndex] = loadedMeshes[i];
+	}
+
+	scene->m_isLightTableBuilt = false;
+	return scene;
+}
+
+bool Scene::parseHeatmap(const std::string& name, int& heatmap) {
+	if (name == "off")				heatmap = HEATMAP_NONE;
+	else if (name == "nodes")		heatmap = HEATMAP_NODES;
+	else if (name == "triangles")	heatmap = HEATMAP_TRIANGLES;
+	else if (name == "photons")		heatmap = HEATMAP_PHOTONS;
+	else if (name == "time")		heatmap = HEATMAP_TIME;
+	else return false;
+	return true;
+}
+
+bool Scene::parseShard(const std::string& name, int& shardMode) {
+	if (name == "tiles")			shardMode = SHARD_TILES;
+	else if (name == "samples")		shardMode = SHARD_SAMPLES;
+	else return false;
+	return true;
+}
+
+std::shared_ptr<Camera> RenderSettings::createCamera() const {
+	return std::make_shared<Camera>(m_eye, m_center, m_up, m_fov, m_width, m_height, m_aovs);
+}
+
+std::shared_ptr<Camera> RenderSettings::createCamera(const View& view) const {
+	return std::make_shared<Camera>(view.m_eye, view.m_center, view.m_up, view.m_fov, m_width, m_height, m_aovs);
+}
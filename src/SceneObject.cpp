@@ -5,6 +5,9 @@
 
 #include "../include/Ray.h"
 #include "../include/OctreeAABB.h"
+#include "../include/MeshCache.h"
+#include "../include/RenderStats.h"
+#include "../include/Trace.h"
 
 namespace Surface {
 	/**************** Base ****************/
@@ -30,47 +33,139 @@ namespace Surface {
 	}
 
 	/**************** Mesh ****************/
-	Mesh::Mesh(glm::mat4 transform, const char* filePath, std::shared_ptr<Material> material) 
+	Mesh::Mesh(glm::mat4 transform, const char* filePath, std::shared_ptr<Material> material, const bool outOfCore, const bool rebuildCache,
+		const float weldEpsilon) 
 		: m_transform(transform), Base(material) {
 
-		std::vector<glm::vec3> tmpVertices;
-		std::vector<glm::vec3> tmpNormals;
-		std::vector<glm::vec2> tmpUvs;
-
-		if (!loadOBJ(filePath, tmpVertices, tmpUvs, tmpNormals)) exit(EXIT_FAILURE);
-
-		for (int i = 0; i < (int)tmpVertices.size(); ++i) {
-			tmpVertices[i] = glm::vec3(m_transform * glm::vec4(tmpVertices[i], 1));
-			tmpNormals[i] = glm::vec3(m_transform * glm::vec4(tmpNormals[i], 0));
+		// Use the cached mesh and octree if the OBJ file, transform and weld are unchanged,
+		// the buffers then point directly into the mapped cache file
+		std::string cachePath = MeshCache::getCachePath(filePath, m_transform, weldEpsilon);
+		if (!rebuildCache && loadCache(cachePath, filePath, weldEpsilon, outOfCore)) {
+			std::cout << "Loaded mesh and octree from " << cachePath << std::endl;
+			return;
 		}
 
-		indexVBO(
-			tmpVertices,
-			tmpUvs,
-			tmpNormals,
-
-			m_indices,
-			m_vertices,
-			m_uvs,
-			m_normals);
-		/*
-		std::cout << "Nr vertices = " << m_vertices.size() - 1 << std::endl;
-		int triangleNr = 1;
-		glm::vec3 v0, v1, v2;
-		for (int i = 0; i < m_vertices.size(); i = i + 3) {
-			v0 = m_vertices[m_indices[i + 0]];
-			v1 = m_vertices[m_indices[i + 1]];
-			v2 = m_vertices[m_indices[i + 2]];
-			std::cout << i << ": Triangle nr " << triangleNr << std::endl;
-			std::cout << "v0 = (" << v0.x << ", " << v0.y << ", " << v0.z << ")" << std::endl;
-			std::cout << "v1 = (" << v1.x << ", " << v1.y << ", " << v1.z << ")" << std::endl;
-			std::cout << "v2 = (" << v2.x << ", " << v2.y << ", " << v2.z << ")" << std::endl;
-			triangleNr++;
+		{
+			std::vector<glm::vec3> tmpVertices;
+			std::vector<glm::vec3> tmpNormals;
+			std::vector<glm::vec2> tmpUvs;
+
+			// isLoaded() is false, the caller reports the file
+			if (!loadOBJ(filePath, tmpVertices, tmpUvs, tmpNormals)) return;
+
+			for (int i = 0; i < (int)tmpVertices.size(); ++i) {
+				tmpVertices[i] = glm::vec3(m_transform * glm::vec4(tmpVertices[i], 1));
+				tmpNormals[i] = glm::vec3(m_transform * glm::vec4(tmpNormals[i], 0));
+			}
+
+			std::vector<unsigned int> indices;
+			std::vector<glm::vec3> vertices;
+			std::vector<glm::vec2> uvs;
+			std::vector<glm::vec3> normals;
+			indexVBO(
+				tmpVertices,
+				tmpUvs,
+				tmpNormals,
+
+				indices,
+				vertices,
+				uvs,
+				normals,
+				weldEpsilon);
+
+			// The unindexed triangles are released at the end of this scope
+			m_indices = SharedBuffer<unsigned int>(std::move(indices));
+			m_vertices = SharedBuffer<glm::vec3>(std::move(vertices));
+			m_uvs = SharedBuffer<glm::vec2>(std::move(uvs));
+			m_normals = SharedBuffer<glm::vec3>(std::move(normals));
 		}
-		*/
+
 		std::cout << "Building octree for mesh" << std::endl;
-		m_otAABB = std::make_shared<OctreeAABB>(std::make_shared<Surface::Mesh>(*this));
+		{
+			RenderStats::ScopedTimer timer(RenderStats::OCTREE_BUILD);
+			Trace::ScopedEvent event("octree build", "build", "triangles", (int64_t)m_indices.size() / 3);
+			m_otAABB = std::make_shared<OctreeAABB>(*this);
+			clusterGeometry();
+		}
 		std::cout << "Octree has been built" << std::endl;
+
+		if (MeshCache::write(cachePath, filePath, m_transform, weldEpsilon,
+			m_vertices, m_normals, m_uvs, m_indices,
+			m_otAABB->getNodes(), m_otAABB->getTriangleIndices())) {
+			// Release the loaded geometry and continue from the file
+			if (outOfCore && !loadCache(cachePath, filePath, weldEpsilon, outOfCore)) {
+				std::cout << "Could not map " << cachePath << ", the mesh stays in memory" << std::endl;
+			}
+		}
+		else if (outOfCore) {
+			std::cout << "Could not write " << cachePath << ", the mesh stays in memory" << std::endl;
+		}
+	}
+
+	Mesh::Mesh(const Mesh& mesh, std::shared_ptr<Material> material)
+		: Base(material), m_vertices(mesh.m_vertices), m_normals(mesh.m_normals), m_uvs(mesh.m_uvs),
+		m_indices(mesh.m_indices), m_transform(mesh.m_transform) {
+		m_surfaceArea = mesh.m_surfaceArea;
+		computeRadiance();
+		m_otAABB = std::make_shared<OctreeAABB>(*this, mesh.m_otAABB->getNodes(), mesh.m_otAABB->getTriangleIndices());
+		if (mesh.m_otAABB->isTrackingClusters()) m_otAABB->enableClusterTracking();
+	}
+
+	bool Mesh::loadCache(const std::string& cachePath, const std::string& sourcePath, const float weldEpsilon, const bool outOfCore) {
+		MeshCache cache(cachePath, sourcePath, m_transform, weldEpsilon);
+		if (!cache.isValid()) return false;
+
+		m_vertices = cache.getVertices();
+		m_normals = cache.getNormals();
+		m_uvs = cache.getUvs();
+		m_indices = cache.getIndices();
+		SharedBuffer<OctreeNodeAABB> nodes = cache.getNodes();
+		if (outOfCore) {
+			// The nodes are a small part of the file and used by every ray
+			nodes = SharedBuffer<OctreeNodeAABB>(std::vector<OctreeNodeAABB>(nodes.begin(), nodes.end()));
+		}
+		m_otAABB = std::make_shared<OctreeAABB>(*this, nodes, cache.getTriangleIndices());
+		if (outOfCore) m_otAABB->enableClusterTracking();
+		return true;
+	}
+
+	void Mesh::clusterGeometry() {
+		// Number the vertices in the order the leaves of the octree use them, so
+		// the triangles of a leaf are a few consecutive pages of the cache file
+		const unsigned int UNUSED = 0xFFFFFFFF;
+		std::vector<unsigned int> newIndices(m_vertices.size(), UNUSED);
+		std::vector<glm::vec3> vertices, normals;
+		std::vector<glm::vec2> uvs;
+		vertices.reserve(m_vertices.size());
+		normals.reserve(m_normals.size());
+		uvs.reserve(m_uvs.size());
+
+		auto renumber = [&](const unsigned int i) {
+			if (newIndices[i] == UNUSED) {
+				newIndices[i] = (unsigned int)vertices.size();
+				vertices.emplace_back(m_vertices[i]);
+				normals.emplace_back(m_normals[i]);
+				uvs.emplace_back(m_uvs[i]);
+			}
+			return newIndices[i];
+		};
+
+		const SharedBuffer<unsigned int>& triangleIndices = m_otAABB->getTriangleIndices();
+		std::vector<unsigned int> clusteredTriangleIndices(triangleIndices.size());
+		for (size_t i = 0; i < triangleIndices.size(); ++i) {
+			clusteredTriangleIndices[i] = renumber(triangleIndices[i]);
+		}
+		std::vector<unsigned int> indices(m_indices.size());
+		for (size_t i = 0; i < m_indices.size(); ++i) {
+			indices[i] = renumber(m_indices[i]);
+		}
+
+		m_vertices = SharedBuffer<glm::vec3>(std::move(vertices));
+		m_normals = SharedBuffer<glm::vec3>(std::move(normals));
+		m_uvs = SharedBuffer<glm::vec2>(std::move(uvs));
+		m_indices = SharedBuffer<unsigned int>(std::move(indices));
+		SharedBuffer<OctreeNodeAABB> nodes = m_otAABB->getNodes();
+		m_otAABB = std::make_shared<OctreeAABB>(*this, nodes, SharedBuffer<unsigned int>(std::move(clusteredTriangleIndices)));
 	}
 
 	bool Mesh::intersect(std::shared_ptr<Ray> ray) const {
@@ -104,6 +199,10 @@ namespace Surface {
 		return max;
 	}
 
+	bool Mesh::isLoaded() const {
+		return m_otAABB != nullptr;
+	}
+
 	glm::mat4 Mesh::getTransform() const {
 		return m_transform;
 	}
@@ -112,10 +211,26 @@ namespace Surface {
 		return m_indices.size() / 3;
 	}
 
-	std::vector<unsigned int> Mesh::getIndices() const {
+	const SharedBuffer<glm::vec3>& Mesh::getVertices() const {
+		return m_vertices;
+	}
+
+	const SharedBuffer<glm::vec3>& Mesh::getNormals() const {
+		return m_normals;
+	}
+
+	const SharedBuffer<glm::vec2>& Mesh::getUvs() const {
+		return m_uvs;
+	}
+
+	const SharedBuffer<unsigned int>& Mesh::getIndices() const {
 		return m_indices;
 	}
 
+	std::shared_ptr<OctreeAABB> Mesh::getOctree() const {
+		return m_otAABB;
+	}
+
 	glm::vec3 Mesh::getVertex(const int i) const {
 		return m_vertices[i];
 	}
@@ -223,8 +338,10 @@ namespace Surface {
 		computeRadiance();
 	}
 
-	// Mller-Trumbore intersection algorithm
+	// Möller-Trumbore intersection algorithm
 	bool Triangle::intersect(std::shared_ptr<Ray> ray) const {
+		RenderStats::add(RenderStats::TRIANGLE_TESTS);
+
 		// Calculate determinant
 		glm::vec3 D = ray->getDirection();
 		glm::vec3 P = glm::cross(D, m_e2);
@@ -267,8 +384,8 @@ namespace Surface {
 	glm::vec3 Triangle::getRandomPointOnSurface(float u, float v) const {
 		// Random point on triangle: https://adamswaab.wordpress.com/2009/12/11/random-point-in-a-triangle-barycentric-coordinates/
 		
-		float rand = glm::clamp((float)std::rand() / RAND_MAX, 0.01f, 0.99f);
-		float randU = rand / ((std::rand() % 8) + 2.0f);
+		float rand = glm::clamp(u, 0.01f, 0.99f);
+		float randU = rand / (glm::min((int)(v * 8.0f), 7) + 2.0f);
 		float randV = rand - randU;
 
 		return (1.0f - randU - randV) * m_v0 + randU * m_v1 + randV * m_v2;
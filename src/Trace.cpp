@@ -0,0 +1,156 @@
+#include "../include/Trace.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+namespace {
+	// Ring buffer of one thread, only written by that thread
+	struct ThreadBuffer {
+		std::vector<Trace::Event> m_events;
+		uint64_t m_nrRecorded = 0;	// The newest event is at (m_nrRecorded - 1) % capacity
+		uint64_t m_generation = 0;	// Trace the events belong to
+		int m_threadId = 0;
+	};
+
+	// Buffers outlive their threads so that events of threads that have exited are written too
+	struct Registry {
+		std::mutex m_mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+		std::string m_path;
+		size_t m_capacity = 0;
+		std::atomic<uint64_t> m_generation{0};	// Incremented by start(), buffers of older traces are reset
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	Registry& getRegistry() {
+		static Registry* registry = new Registry();
+		return *registry;
+	}
+
+	ThreadBuffer* getThreadBuffer() {
+		thread_local ThreadBuffer* buffer = nullptr;
+
+		Registry& registry = getRegistry();
+		if (!buffer || buffer->m_generation != registry.m_generation.load(std::memory_order_acquire)) {
+			std::lock_guard<std::mutex> lock(registry.m_mutex);
+			if (!buffer) {
+				registry.m_buffers.emplace_back(std::make_unique<ThreadBuffer>());
+				buffer = registry.m_buffers.back().get();
+				buffer->m_threadId = (int)registry.m_buffers.size() - 1;
+			}
+			buffer->m_events.assign(registry.m_capacity, Trace::Event());
+			buffer->m_nrRecorded = 0;
+			buffer->m_generation = registry.m_generation;
+		}
+		return buffer;
+	}
+
+	void writeString(std::ostream& stream, const char* text) {
+		stream << '"';
+		for (const char* c = text; *c; ++c) {
+			if (*c == '"' || *c == '\\') stream << '\\';
+			stream << *c;
+		}
+		stream << '"';
+	}
+}
+
+namespace Trace {
+	std::atomic<bool> s_isEnabled(false);
+
+	void start(const std::string& path, const size_t capacity) {
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.m_mutex);
+		registry.m_path = path;
+		registry.m_capacity = (capacity > 0) ? capacity : 1;
+		registry.m_generation++;
+		registry.m_start = std::chrono::steady_clock::now();
+		s_isEnabled.store(true, std::memory_order_release);
+	}
+
+	bool stop() {
+		if (!isEnabled()) return false;
+		s_isEnabled.store(false, std::memory_order_release);
+
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.m_mutex);
+		std::ofstream file(registry.m_path, std::ios::trunc);
+		if (!file) return false;
+
+		// Complete events, timestamps are in microseconds
+		file << std::fixed << std::setprecision(3);
+		file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		bool isFirst = true;
+		for (const std::unique_ptr<ThreadBuffer>& buffer : registry.m_buffers) {
+			size_t capacity = buffer->m_events.size();
+			if (buffer->m_generation != registry.m_generation || buffer->m_nrRecorded == 0) continue;
+
+			file << ((isFirst) ? "" : ",\n");
+			file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << buffer->m_threadId
+				<< ", \"args\": {\"name\": \"thread " << buffer->m_threadId << "\"}}";
+			isFirst = false;
+
+			uint64_t first = (buffer->m_nrRecorded > capacity) ? buffer->m_nrRecorded - capacity : 0;
+			for (uint64_t i = first; i < buffer->m_nrRecorded; ++i) {
+				const Event& event = buffer->m_events[i % capacity];
+				file << ",\n{\"name\": ";
+				writeString(file, event.m_name);
+				file << ", \"cat\": ";
+				writeString(file, event.m_category);
+				file << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << buffer->m_threadId
+					<< ", \"ts\": " << event.m_start * 1e-3 << ", \"dur\": " << event.m_duration * 1e-3;
+				if (event.m_argNames[0]) {
+					file << ", \"args\": {";
+					for (int a = 0; a < 2 && event.m_argNames[a]; ++a) {
+						file << ((a == 0) ? "" : ", ");
+						writeString(file, event.m_argNames[a]);
+						file << ": " << event.m_args[a];
+					}
+					file << "}";
+				}
+				file << "}";
+			}
+			if (buffer->m_nrRecorded > capacity) {
+				std::cout << "Trace buffer of thread " << buffer->m_threadId << " overflowed, the first "
+					<< buffer->m_nrRecorded - capacity << " events were dropped" << std::endl;
+			}
+		}
+		file << "\n]}\n";
+		return (bool)file;
+	}
+
+	uint64_t now() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - getRegistry().m_start).count();
+	}
+
+	void record(const Event& event) {
+		ThreadBuffer* buffer = getThreadBuffer();
+		buffer->m_events[buffer->m_nrRecorded % buffer->m_events.size()] = event;
+		buffer->m_nrRecorded++;
+	}
+
+	/**************** Scoped event ****************/
+	ScopedEvent::ScopedEvent(const char* name, const char* category,
+		const char* argName0, const int64_t arg0, const char* argName1, const int64_t arg1)
+		: m_isRecording(isEnabled()) {
+		if (!m_isRecording) return;
+		m_event.m_name = name;
+		m_event.m_category = category;
+		m_event.m_argNames[0] = argName0;
+		m_event.m_argNames[1] = argName1;
+		m_event.m_args[0] = arg0;
+		m_event.m_args[1] = arg1;
+		m_event.m_start = now();
+	}
+
+	ScopedEvent::~ScopedEvent() {
+		if (!m_isRecording || !isEnabled()) return;
+		m_event.m_duration = now() - m_event.m_start;
+		record(m_event);
+	}
+}
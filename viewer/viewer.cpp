@@ -0,0 +1,64 @@
+// Follows the image stream of a running render. The stream file is polled and
+// every new generation is written to the output image, which an image viewer
+// that reloads changed files can show. Ends when the render is finished.
+//
+// Usage: viewer [--interval seconds] [--exposure value] stream image
+//
+// The stream is only read, any number of viewers can follow the same render.
+
+// Includes
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+
+#include "../include/ImageStream.h"
+#include "../include/ImageWriter.h"
+
+int main(int argc, char* argv[]) {
+	float interval = 1.0f;
+	float exposure = 1.0f;
+	std::string streamPath, outputPath;
+	bool isValid = true;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--interval" && i + 1 < argc) interval = (float)std::atof(argv[++i]);
+		else if (arg == "--exposure" && i + 1 < argc) exposure = (float)std::atof(argv[++i]);
+		else if (arg.compare(0, 2, "--") != 0 && streamPath.empty()) streamPath = arg;
+		else if (arg.compare(0, 2, "--") != 0 && outputPath.empty()) outputPath = arg;
+		else isValid = false;
+	}
+	if (!isValid || streamPath.empty() || outputPath.empty() || interval <= 0.0f) {
+		std::cout << "Usage: " << argv[0] << " [--interval seconds] [--exposure value] stream image" << std::endl;
+		return 1;
+	}
+
+	// The render may not have created the stream yet
+	Image image;
+	ImageStreamState state;
+	uint64_t lastGeneration = 0;
+	bool hasWritten = false, isWaiting = false;
+	while (true) {
+		if (ImageStream::read(streamPath, image, state)) {
+			isWaiting = false;
+			if (!hasWritten || state.m_generation != lastGeneration) {
+				if (!ImageWriter::write(outputPath, image, exposure)) {
+					std::cout << "Could not write " << outputPath << std::endl;
+					return 1;
+				}
+				std::cout << state.m_nrCompletedPasses << " of " << state.m_nrPasses << " passes" << std::endl;
+				lastGeneration = state.m_generation;
+				hasWritten = true;
+			}
+			if (state.m_isFinished) break;
+		}
+		else if (!isWaiting) {
+			std::cout << "Waiting for " << streamPath << std::endl;
+			isWaiting = true;
+		}
+		std::this_thread::sleep_for(std::chrono::duration<float>(interval));
+	}
+	std::cout << "Render finished, image written to " << outputPath << std::endl;
+	return 0;
+}